@@ -19,11 +19,13 @@ typedef struct lprint_brother_s		// Brother driver data
 {
   bool		is_pt_series;		// Is this a PT-series printer?
   bool		is_ql_800;		// Is this the QL-800 printer?
+  bool		packbits;		// Use TIFF PackBits compression?
+  bool		cut_every;		// Cut after every label?
+  bool		cut_at_end;		// Cut after the last label?
+  bool		need_print;		// Need to send a print command?
   lprint_dither_t dither;		// Dither buffer
-  int		count;			// Output count for print info
-  size_t	alloc_bytes,		// Allocated bytes for output buffer
-		num_bytes;		// Number of bytes in output buffer
-  unsigned char	*buffer;		// Output buffer
+  lprint_buffer_t buffer;		// Output buffer
+  unsigned char	*comp_buffer;		// Compression buffer
 } lprint_brother_t;
 
 
@@ -92,9 +94,11 @@ static const char * const lprint_brother_pt_media[] =
 //
 
 static bool	lprint_brother_get_status(pappl_printer_t *printer, pappl_device_t *device);
+static size_t	lprint_brother_packbits(unsigned char *dst, const unsigned char *src, size_t srclen);
 static bool	lprint_brother_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_brother_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_brother_rendpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
+static bool	lprint_brother_reset(pappl_job_t *job, pappl_pr_options_t *options, lprint_brother_t *brother, bool warm);
 static bool	lprint_brother_rstartjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_brother_rstartpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
 static bool	lprint_brother_rwriteline(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned y, const unsigned char *line);
@@ -184,6 +188,18 @@ lprintBrother(
   data->num_source = 1;
   data->source[0]  = "main-roll";
 
+  // Label modes - the QL-500 has no cutter...
+  if (!strcmp(driver_name, "brother_ql-500"))
+  {
+    data->mode_configured = PAPPL_LABEL_MODE_TEAR_OFF;
+    data->mode_supported  = PAPPL_LABEL_MODE_TEAR_OFF;
+  }
+  else
+  {
+    data->mode_configured = PAPPL_LABEL_MODE_CUTTER;
+    data->mode_supported  = PAPPL_LABEL_MODE_CUTTER | PAPPL_LABEL_MODE_CUTTER_DELAYED | PAPPL_LABEL_MODE_TEAR_OFF;
+  }
+
   // 5 darkness/density settings
   data->darkness_configured = 50;
   data->darkness_supported  = 5;
@@ -266,6 +282,61 @@ lprint_brother_get_status(
 }
 
 
+//
+// 'lprint_brother_packbits()' - Compress a raster line using TIFF PackBits.
+//
+// The destination buffer must hold at least `srclen + (srclen + 127) / 128`
+// bytes.
+//
+
+static size_t				// O - Number of compressed bytes
+lprint_brother_packbits(
+    unsigned char       *dst,		// I - Destination buffer
+    const unsigned char *src,		// I - Source line
+    size_t              srclen)		// I - Length of source line
+{
+  unsigned char		*dstptr = dst;	// Pointer into destination
+  const unsigned char	*srcptr = src,	// Pointer into source
+			*srcend = src + srclen,
+					// End of source
+			*start;		// Start of run
+  size_t		count;		// Number of bytes in run
+
+
+  while (srcptr < srcend)
+  {
+    start = srcptr;
+
+    if ((srcptr + 1) < srcend && srcptr[0] == srcptr[1])
+    {
+      // Repeated run of up to 128 bytes...
+      for (srcptr += 2; srcptr < srcend && *srcptr == *start && (srcptr - start) < 128; srcptr ++);
+
+      count     = (size_t)(srcptr - start);
+      *dstptr++ = (unsigned char)(257 - count);
+      *dstptr++ = *start;
+    }
+    else
+    {
+      // Literal run of up to 128 bytes, stopping at the next run of 3 or more
+      // repeated bytes...
+      for (srcptr ++; srcptr < srcend && (srcptr - start) < 128; srcptr ++)
+      {
+        if ((srcptr + 2) < srcend && srcptr[0] == srcptr[1] && srcptr[0] == srcptr[2])
+          break;
+      }
+
+      count     = (size_t)(srcptr - start);
+      *dstptr++ = (unsigned char)(count - 1);
+      memcpy(dstptr, start, count);
+      dstptr += count;
+    }
+  }
+
+  return ((size_t)(dstptr - dst));
+}
+
+
 //
 // 'lprint_brother_printfile()' - Print a file.
 //
@@ -279,11 +350,22 @@ lprint_brother_printfile(
   int		fd;			// Input file
   ssize_t	bytes;			// Bytes read/written
   char		buffer[65536];		// Read/write buffer
-//  lprint_brother_t	brother;			// Driver data
+  lprint_brother_t brother;		// Driver data
+  bool		ret;			// Return value
+
 
+  // Raw data can leave the printer in any state, so always reset it and
+  // don't let the next job skip its reset...
+  memset(&brother, 0, sizeof(brother));
+  lprintBufferInit(&brother.buffer, device);
+  lprintSessionStart(job, "raw");
 
   // Reset the printer...
-  lprint_brother_rstartjob(job, options, device);
+  if (!lprint_brother_reset(job, options, &brother, false))
+  {
+    lprintBufferFinish(&brother.buffer, job);
+    return (false);
+  }
 
   // Copy the raw file...
   papplJobSetImpressions(job, 1);
@@ -291,25 +373,36 @@ lprint_brother_printfile(
   if ((fd  = open(papplJobGetFilename(job), O_RDONLY)) < 0)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    lprintBufferFinish(&brother.buffer, job);
     return (false);
   }
 
   while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
   {
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
+    LPRINT_PROBE2(raw_write_start, papplJobGetID(job), bytes);
+
+    if (!lprintBufferWrite(&brother.buffer, buffer, (size_t)bytes))
     {
+      LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 0);
       papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
       close(fd);
+      lprintBufferFinish(&brother.buffer, job);
       return (false);
     }
+
+    LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 1);
   }
   close(fd);
 
-  lprint_brother_rstartjob(job, options, device);
+  // Reset the printer again and send everything...
+  ret = lprint_brother_reset(job, options, &brother, false);
+
+  if (!lprintBufferFinish(&brother.buffer, job))
+    ret = false;
 
   papplJobSetImpressionsCompleted(job, 1);
 
-  return (true);
+  return (ret);
 }
 
 
@@ -327,8 +420,15 @@ lprint_brother_rendjob(
 					// Brother driver data
 
   (void)options;
+  (void)device;
+
+  // Print the last label, feeding it out of the printer...
+  if (brother->need_print)
+    lprintBufferWrite(&brother->buffer, "\032", 1);
 
-  free(brother->buffer);
+  lprintBufferFinish(&brother->buffer, job);
+
+  free(brother->comp_buffer);
   free(brother);
   papplJobSetData(job, NULL);
 
@@ -349,98 +449,99 @@ lprint_brother_rendpage(
 {
   lprint_brother_t	*brother = (lprint_brother_t *)papplJobGetData(job);
 					// Brother driver data
-  unsigned char	buffer[13];		// Print Information command buffer
+  unsigned		copy;		// Current copy
 
 
+  (void)page;
+
+  // Nothing more to send if the output came from the cache...
+  if (brother->buffer.cached)
+    return (true);
+
   // Write last line
   lprint_brother_rwriteline(job, options, device, options->header.cupsHeight, NULL);
 
-  // Send print information...
-  buffer[ 0] = 0x1b;
-  buffer[ 1] = 'i';
-  buffer[ 2] = 'z';
-  buffer[ 3] = !strcmp(options->media.type, "continuous") ? 0x04 : 0x0c;
-  buffer[ 4] = 0;
-  buffer[ 5] = options->media.size_width / 100;
-  buffer[ 6] = options->media.size_length / 100;
-#if 1
-  buffer[ 7] = options->header.cupsHeight & 255;
-  buffer[ 8] = (options->header.cupsHeight >> 8) & 255;
-  buffer[ 9] = (options->header.cupsHeight >> 16) & 255;
-  buffer[10] = (options->header.cupsHeight >> 24) & 255;
-#else
-  buffer[ 7] = brother->count & 255;
-  buffer[ 8] = (brother->count >> 8) & 255;
-  buffer[ 9] = (brother->count >> 16) & 255;
-  buffer[10] = (brother->count >> 24) & 255;
-#endif // 1
-  buffer[11] = page == 0 ? 0 : 1;
-  buffer[12] = 0;
-
-  if (!papplDeviceWrite(device, buffer, sizeof(buffer)))
-    return (false);
+  if (brother->buffer.recording)
+  {
+    // Send the same raster data for each additional copy...
+    lprintBufferRecord(&brother->buffer, false);
 
-  // Send label data...
-  if (brother->num_bytes > 0 && !papplDeviceWrite(device, brother->buffer, brother->num_bytes))
-    return (false);
+    for (copy = 1; copy < options->header.NumCopies; copy ++)
+    {
+      lprintBufferWrite(&brother->buffer, "\014", 1);
+      lprintBufferReplay(&brother->buffer);
+    }
+  }
 
-  // Eject/cut
-  papplDevicePrintf(device, "\033iM%c\014", !strcmp(options->media.type, "continuous") ? 64 : 0);
-  papplDeviceFlush(device);
+  // Defer the print command until we know whether this is the last label -
+  // FF prints and chains to the next label while ^Z prints and feeds...
+  brother->need_print = true;
+  lprintBufferFlush(&brother->buffer);
 
   // Free memory and return...
   lprintDitherFree(&brother->dither);
 
+  free(brother->comp_buffer);
+  brother->comp_buffer = NULL;
+
   return (true);
 }
 
 
 //
-// 'lprint_brother_rstartjob()' - Start a job.
+// 'lprint_brother_reset()' - Reset the printer and set raster mode.
+//
+// The reset sequence and status query are skipped when `warm` is `true`.
+// Everything is sent through the driver's output buffer, which is flushed
+// before the status query.
 //
 
 static bool				// O - `true` on success, `false` on failure
-lprint_brother_rstartjob(
+lprint_brother_reset(
     pappl_job_t        *job,		// I - Job
     pappl_pr_options_t *options,	// I - Job options
-    pappl_device_t     *device)		// I - Output device
+    lprint_brother_t   *brother,	// I - Brother driver data
+    bool               warm)		// I - Is the printer already set up?
 {
-  lprint_brother_t *brother = (lprint_brother_t *)calloc(1, sizeof(lprint_brother_t));
-					// Brother driver data
   const char	*driver_name = papplPrinterGetDriverName(papplJobGetPrinter(job));
 					// Driver name
   char		buffer[400];		// Reset buffer
   int		darkness;		// Combined darkness
 
 
-  (void)options;
-
-  // Save driver data...
-  papplJobSetData(job, brother);
-
-  // Reset the printer...
   memset(buffer, 0, sizeof(buffer));
   if (driver_name && !strncmp(driver_name, "brother_pt-", 11))
   {
     // Send short reset sequence for PT-series tape printers
-    papplDeviceWrite(device, buffer, 100);
+    if (!warm && !lprintBufferWrite(&brother->buffer, buffer, 100))
+      return (false);
+
     brother->is_pt_series = true;
   }
   else
   {
     // Send long reset sequence for QL-series label printers
-    papplDeviceWrite(device, buffer, sizeof(buffer));
+    if (!warm && !lprintBufferWrite(&brother->buffer, buffer, sizeof(buffer)))
+      return (false);
 
     brother->is_ql_800 = driver_name && !strcmp(driver_name, "brother_ql-800");
   }
 
   // Get status information...
-  lprint_brother_get_status(papplJobGetPrinter(job), device);
-//  if (!lprint_brother_get_status(papplJobGetPrinter(job), device))
-//    return (false);
+  if (!warm)
+  {
+    if (!lprintBufferFlush(&brother->buffer))
+      return (false);
+
+    lprint_brother_get_status(papplJobGetPrinter(job), brother->buffer.device);
+  }
 
   // Reset and set raster mode...
-  if (!papplDevicePuts(device, "\033@\033ia\001"))
+  if (!lprintBufferPuts(&brother->buffer, "\033@\033ia\001"))
+    return (false);
+
+  // Set compression mode...
+  if (brother->packbits && !lprintBufferPrintf(&brother->buffer, "M%c", 2))
     return (false);
 
   // print-darkness / printer-darkness-configured
@@ -449,7 +550,68 @@ lprint_brother_rstartjob(
   else if (darkness > 100)
     darkness = 100;
 
-  return (papplDevicePrintf(device, "\033iD%c", 4 * darkness / 100 + 1));
+  return (lprintBufferPrintf(&brother->buffer, "\033iD%c", 4 * darkness / 100 + 1));
+}
+
+
+//
+// 'lprint_brother_rstartjob()' - Start a job.
+//
+
+static bool				// O - `true` on success, `false` on failure
+lprint_brother_rstartjob(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device)		// I - Output device
+{
+  lprint_brother_t *brother = (lprint_brother_t *)calloc(1, sizeof(lprint_brother_t));
+					// Brother driver data
+  pappl_pr_driver_data_t data;		// Printer driver data
+  const char	*driver_name = papplPrinterGetDriverName(papplJobGetPrinter(job));
+					// Driver name
+  bool		warm;			// Did the printer just finish another job?
+
+
+  // Save driver data...
+  papplJobSetData(job, brother);
+  lprintBufferInit(&brother->buffer, device);
+
+  // Reset the printer unless it just finished another job...
+  warm = lprintSessionStart(job, NULL);
+
+  // The original QL-500/550/560/650TD/1050 firmware does not support
+  // compressed raster data...
+  brother->packbits = !driver_name || (strcmp(driver_name, "brother_ql-500") && strcmp(driver_name, "brother_ql-550") && strcmp(driver_name, "brother_ql-560") && strcmp(driver_name, "brother_ql-650td") && strcmp(driver_name, "brother_ql-1050"));
+
+  // Skip compression when the link is fast enough that it only costs time...
+  if (brother->packbits)
+    brother->packbits = lprintLinkCompress(job, "PackBits", "uncompressed");
+
+  // label-mode-configured
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &data);
+
+  switch (data.mode_configured)
+  {
+    case PAPPL_LABEL_MODE_CUTTER :
+        brother->cut_every  = true;
+        brother->cut_at_end = true;
+        break;
+    case PAPPL_LABEL_MODE_CUTTER_DELAYED :
+        brother->cut_at_end = true;
+        break;
+    case PAPPL_LABEL_MODE_TEAR_OFF :
+    default :
+        break;
+  }
+
+  // Reset the printer and set raster mode...
+  if (!lprint_brother_reset(job, options, brother, warm))
+    return (false);
+
+  // Send the cached output for identical jobs...
+  lprintCacheStart(&brother->buffer, job, options);
+
+  return (true);
 }
 
 
@@ -466,17 +628,73 @@ lprint_brother_rstartpage(
 {
   lprint_brother_t *brother = (lprint_brother_t *)papplJobGetData(job);
 					// Brother driver data
+  unsigned char	buffer[13];		// Print Information command buffer
+  bool		continuous = !strcmp(options->media.type, "continuous");
+					// Continuous media?
+  unsigned	margin;			// Feed margin in dots
 
 
-  (void)page;
+  // Nothing more to send if the output came from the cache...
+  if (brother->buffer.cached)
+    return (true);
+
+  // Print the previous label and chain to this one...
+  if (brother->need_print)
+  {
+    if (!lprintBufferWrite(&brother->buffer, "\014", 1))
+      return (false);
+
+    brother->need_print = false;
+  }
+
+  // Record the label so copies can be sent without dithering it again...
+  if (options->header.NumCopies > 1)
+    lprintBufferRecord(&brother->buffer, true);
 
   if (!lprintDitherAlloc(&brother->dither, job, options, CUPS_CSPACE_K, options->header.HWResolution[0] == 300 ? 1.2 : 1.0))
     return (false);
 
-  brother->count     = 0;
-  brother->num_bytes = 0;
+  // Allocate a line buffer big enough for the worst-case PackBits output...
+  if ((brother->comp_buffer = malloc(3 + brother->dither.out_width + (brother->dither.out_width + 127) / 128)) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate line buffer.");
+    return (false);
+  }
+
+  // Send print information - the raster line count is known up front so the
+  // lines can be streamed to the printer as they are dithered...
+  buffer[ 0] = 0x1b;
+  buffer[ 1] = 'i';
+  buffer[ 2] = 'z';
+  buffer[ 3] = continuous ? 0x04 : 0x0c;
+  buffer[ 4] = 0;
+  buffer[ 5] = options->media.size_width / 100;
+  buffer[ 6] = options->media.size_length / 100;
+  buffer[ 7] = options->header.cupsHeight & 255;
+  buffer[ 8] = (options->header.cupsHeight >> 8) & 255;
+  buffer[ 9] = (options->header.cupsHeight >> 16) & 255;
+  buffer[10] = (options->header.cupsHeight >> 24) & 255;
+  buffer[11] = page == 0 ? 0 : 1;
+  buffer[12] = 0;
 
-  return (true);
+  if (!lprintBufferWrite(&brother->buffer, buffer, sizeof(buffer)))
+    return (false);
+
+  // Auto-cut (cut every label) or chain printing, optionally cutting after
+  // the last label...
+  if (!lprintBufferPrintf(&brother->buffer, "\033iM%c", brother->cut_every ? 64 : 0))
+    return (false);
+
+  if (brother->cut_every && !lprintBufferPrintf(&brother->buffer, "\033iA%c", 1))
+    return (false);
+
+  if (!lprintBufferPrintf(&brother->buffer, "\033iK%c", brother->cut_at_end ? 8 : 0))
+    return (false);
+
+  // Feed margin, 0 for die-cut labels and 3mm for continuous media...
+  margin = continuous ? (unsigned)options->header.HWResolution[1] * 30 / 254 : 0;
+
+  return (lprintBufferPrintf(&brother->buffer, "\033id%c%c", margin & 255, (margin >> 8) & 255));
 }
 
 
@@ -494,62 +712,51 @@ lprint_brother_rwriteline(
 {
   lprint_brother_t	*brother = (lprint_brother_t *)papplJobGetData(job);
 					// Brother driver data
-  unsigned char		*bufptr;	// Pointer into page buffer
+  unsigned char		*bufptr;	// Pointer into line buffer
+  size_t		num_bytes;	// Number of data bytes for this line
 
 
-  if (!lprintDitherLine(&brother->dither, y, line))
+  // Nothing more to send if the output came from the cache...
+  if (brother->buffer.cached)
     return (true);
 
-  if ((brother->alloc_bytes - brother->num_bytes) < (3 + brother->dither.out_width))
-  {
-    size_t temp_alloc = brother->alloc_bytes + brother->dither.out_width + 4096;
-				      // New allocated size
-    unsigned char *temp = realloc(brother->buffer, temp_alloc);
-				      // New buffer
-
-    if (!temp)
-    {
-      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate %lu bytes of memory memory.", (unsigned long)temp_alloc);
-      return (false);
-    }
-
-    brother->alloc_bytes = temp_alloc;
-    brother->buffer      = temp;
-  }
+  if (!lprintDitherLine(&brother->dither, y, line))
+    return (true);
 
-  bufptr = brother->buffer + brother->num_bytes;
+  bufptr = brother->comp_buffer;
 
   if (brother->is_ql_800 || brother->dither.output[0] || memcmp(brother->dither.output, brother->dither.output + 1, brother->dither.out_width - 1))
   {
     // Non-blank line...
-    // TODO: Add PackBits compression support
-    brother->count += 3 + brother->dither.out_width;
+    if (brother->packbits)
+    {
+      num_bytes = lprint_brother_packbits(bufptr + 3, brother->dither.output, brother->dither.out_width);
+    }
+    else
+    {
+      num_bytes = brother->dither.out_width;
+      memcpy(bufptr + 3, brother->dither.output, num_bytes);
+    }
 
     *bufptr++ = 'g';
     if (brother->is_pt_series)
     {
-      *bufptr++ = brother->dither.out_width & 255;
-      *bufptr++ = (brother->dither.out_width >> 8) & 255;
+      *bufptr++ = num_bytes & 255;
+      *bufptr++ = (num_bytes >> 8) & 255;
     }
     else
     {
       *bufptr++ = 0;
-      *bufptr++ = brother->dither.out_width;
+      *bufptr++ = (unsigned char)num_bytes;
     }
 
-    memcpy(bufptr, brother->dither.output, brother->dither.out_width);
-    brother->num_bytes += 3 + brother->dither.out_width;
+    return (lprintBufferWrite(&brother->buffer, brother->comp_buffer, 3 + num_bytes));
   }
   else
   {
     // Blank line
-    brother->count ++;
-
-    *bufptr = 'Z';
-    brother->num_bytes ++;
+    return (lprintBufferWrite(&brother->buffer, "Z", 1));
   }
-
-  return (true);
 }
 
 
@@ -0,0 +1,592 @@
+//
+// Encoded output cache for LPrint, a Label Printer Application
+//
+// Copyright © 2019-2024 by Michael R Sweet.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include "lprint.h"
+#include <cups/dir.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+
+//
+// Constants...
+//
+
+#define LPRINT_CACHE_CHUNK	65536	// Size of print file chunks to hash
+#define LPRINT_CACHE_MAX_FILE	(16 * 1024 * 1024)
+					// Largest print file to cache
+
+#ifndef O_BINARY
+#  define O_BINARY	0		// Only needed on Windows
+#endif // !O_BINARY
+
+
+//
+// Local types...
+//
+
+typedef struct lprint_centry_s		// Cache entry
+{
+  struct lprint_centry_s *prev,		// Previous (more recently used) entry
+		*next;			// Next (less recently used) entry
+  char		key[65];		// SHA-256 hash of input and options
+  unsigned char	*data;			// Encoded output
+  size_t	size;			// Size of encoded output
+} lprint_centry_t;
+
+typedef struct lprint_cfile_s		// Cache file for eviction
+{
+  char		filename[260];		// Filename
+  time_t	mtime;			// Last use
+  size_t	size;			// Size in bytes
+} lprint_cfile_t;
+
+
+//
+// Local globals...
+//
+
+static pthread_mutex_t	cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for cache
+static char		cache_directory[1024] = "";
+					// Directory for cache files
+static size_t		cache_disk_size = 0,
+					// Maximum size of cache files
+			cache_memory_size = 0,
+					// Maximum size of memory cache
+			cache_memory_used = 0;
+					// Size of memory cache
+static lprint_centry_t	*cache_first = NULL,
+					// Most recently used entry
+			*cache_last = NULL;
+					// Least recently used entry
+
+
+//
+// Local functions...
+//
+
+static void	add_entry(const char *key, const unsigned char *data, size_t size);
+static int	compare_files(lprint_cfile_t *a, lprint_cfile_t *b);
+static void	evict_files(void);
+static lprint_centry_t *find_entry(const char *key);
+static bool	make_key(pappl_job_t *job, pappl_pr_options_t *options, char *key);
+static unsigned char *read_file(const char *key, size_t *size);
+static void	write_file(const char *key, const unsigned char *data, size_t size);
+
+
+//
+// 'lprintCacheFinish()' - Save the encoded output of a job in the cache.
+//
+// The output is only saved when the job completed without errors.
+//
+
+void
+lprintCacheFinish(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    pappl_job_t     *job,		// I - Job
+    bool            ok)			// I - Was the output sent successfully?
+{
+  if (buffer->capturing && ok && buffer->capture_used > 0 && !papplJobIsCanceled(job))
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Saving %lu bytes of output in cache.", (unsigned long)buffer->capture_used);
+
+    pthread_mutex_lock(&cache_mutex);
+
+    if (buffer->capture_used <= cache_memory_size && !find_entry(buffer->cache_key))
+      add_entry(buffer->cache_key, buffer->capture, buffer->capture_used);
+
+    if (buffer->capture_used <= cache_disk_size)
+    {
+      write_file(buffer->cache_key, buffer->capture, buffer->capture_used);
+      evict_files();
+    }
+
+    pthread_mutex_unlock(&cache_mutex);
+  }
+
+  free(buffer->capture);
+  buffer->capture      = NULL;
+  buffer->capture_used = buffer->capture_size = 0;
+  buffer->capturing    = false;
+}
+
+
+//
+// 'lprintCacheInit()' - Configure the encoded output cache.
+//
+// A size of 0 disables the corresponding cache.  Cache files are stored in a
+// "cache" subdirectory of the spool directory.
+//
+
+void
+lprintCacheInit(
+    pappl_system_t *system,		// I - System
+    size_t         memory_size,		// I - Maximum size of memory cache in bytes
+    size_t         disk_size)		// I - Maximum size of cache files in bytes
+{
+  char	spooldir[1024];			// Spool directory
+
+
+  pthread_mutex_lock(&cache_mutex);
+
+  cache_memory_size = memory_size;
+  cache_disk_size   = disk_size;
+
+  if (disk_size > 0 && papplSystemGetSpoolDirectory(system, spooldir, sizeof(spooldir)))
+  {
+    snprintf(cache_directory, sizeof(cache_directory), "%s/cache", spooldir);
+
+    if (access(cache_directory, 0) && mkdir(cache_directory, 0700))
+    {
+      papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create cache directory '%s': %s", cache_directory, strerror(errno));
+      cache_directory[0] = '\0';
+      cache_disk_size    = 0;
+    }
+    else
+    {
+      evict_files();
+    }
+  }
+  else
+  {
+    cache_directory[0] = '\0';
+    cache_disk_size    = 0;
+  }
+
+  pthread_mutex_unlock(&cache_mutex);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Output cache is %lu bytes in memory and %lu bytes on disk.", (unsigned long)cache_memory_size, (unsigned long)cache_disk_size);
+}
+
+
+//
+// 'lprintCacheStart()' - Send cached output for a job or start capturing it.
+//
+// Call this at the end of the rstartjob callback after any printer setup
+// commands.  If this function returns `true`, the job's encoded output has
+// already been queued and the driver must not write anything else to the
+// buffer for the rest of the job.  Otherwise everything written to the buffer
+// until `lprintBufferFinish()` is saved in the cache.
+//
+
+bool					// O - `true` if cached output was sent, `false` otherwise
+lprintCacheStart(
+    lprint_buffer_t    *buffer,		// I - Output buffer
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options)	// I - Job options
+{
+  char			key[65];	// Cache key
+  lprint_centry_t	*entry;		// Cache entry
+  unsigned char		*data = NULL;	// Cached output
+  size_t		size = 0;	// Size of cached output
+
+
+  if ((cache_memory_size == 0 && cache_disk_size == 0) || !make_key(job, options, key))
+    return (false);
+
+  pthread_mutex_lock(&cache_mutex);
+
+  if ((entry = find_entry(key)) != NULL)
+  {
+    // Copy the data so that other jobs can use the cache while this one is
+    // being written...
+    if ((data = malloc(entry->size)) != NULL)
+    {
+      memcpy(data, entry->data, entry->size);
+      size = entry->size;
+    }
+  }
+  else if (cache_disk_size > 0 && (data = read_file(key, &size)) != NULL)
+  {
+    if (size <= cache_memory_size)
+      add_entry(key, data, size);
+  }
+
+  pthread_mutex_unlock(&cache_mutex);
+
+  if (data)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Sending %lu bytes of cached output.", (unsigned long)size);
+
+    buffer->cached = true;
+    lprintBufferWrite(buffer, data, size);
+    free(data);
+
+    return (true);
+  }
+
+  papplCopyString(buffer->cache_key, key, sizeof(buffer->cache_key));
+
+  buffer->capturing   = true;
+  buffer->capture_max = cache_memory_size > cache_disk_size ? cache_memory_size : cache_disk_size;
+
+  return (false);
+}
+
+
+//
+// 'add_entry()' - Add an entry to the memory cache.
+//
+// The cache mutex must be held by the caller.
+//
+
+static void
+add_entry(const char          *key,	// I - Cache key
+          const unsigned char *data,	// I - Encoded output
+          size_t              size)	// I - Size of encoded output
+{
+  lprint_centry_t	*entry;		// New entry
+
+
+  // Evict the least recently used entries to make room...
+  while (cache_last && (cache_memory_used + size) > cache_memory_size)
+  {
+    entry      = cache_last;
+    cache_last = entry->prev;
+
+    if (cache_last)
+      cache_last->next = NULL;
+    else
+      cache_first = NULL;
+
+    cache_memory_used -= entry->size;
+
+    free(entry->data);
+    free(entry);
+  }
+
+  // Add the new entry to the front of the list...
+  if ((entry = (lprint_centry_t *)calloc(1, sizeof(lprint_centry_t))) == NULL)
+    return;
+
+  if ((entry->data = malloc(size)) == NULL)
+  {
+    free(entry);
+    return;
+  }
+
+  papplCopyString(entry->key, key, sizeof(entry->key));
+  memcpy(entry->data, data, size);
+  entry->size = size;
+
+  if ((entry->next = cache_first) != NULL)
+    cache_first->prev = entry;
+  else
+    cache_last = entry;
+
+  cache_first       = entry;
+  cache_memory_used += size;
+}
+
+
+//
+// 'compare_files()' - Compare two cache files by last use.
+//
+
+static int				// O - Result of comparison
+compare_files(lprint_cfile_t *a,	// I - First file
+              lprint_cfile_t *b)	// I - Second file
+{
+  if (a->mtime < b->mtime)
+    return (-1);
+  else if (a->mtime > b->mtime)
+    return (1);
+  else
+    return (strcmp(a->filename, b->filename));
+}
+
+
+//
+// 'evict_files()' - Remove the least recently used cache files.
+//
+// The cache mutex must be held by the caller.
+//
+
+static void
+evict_files(void)
+{
+  cups_dir_t		*dir;		// Cache directory
+  cups_dentry_t		*dent;		// Directory entry
+  lprint_cfile_t	*files = NULL,	// Cache files
+			*file;		// Current file
+  size_t		i,		// Looping var
+			num_files = 0,	// Number of cache files
+			alloc_files = 0,// Allocated cache files
+			total = 0;	// Total size of cache files
+  char			filename[1024];	// Cache filename
+
+
+  if (!cache_directory[0] || (dir = cupsDirOpen(cache_directory)) == NULL)
+    return;
+
+  while ((dent = cupsDirRead(dir)) != NULL)
+  {
+    if (!S_ISREG(dent->fileinfo.st_mode))
+      continue;
+
+    if (num_files >= alloc_files)
+    {
+      if ((file = realloc(files, (alloc_files + 64) * sizeof(lprint_cfile_t))) == NULL)
+        break;
+
+      files       = file;
+      alloc_files += 64;
+    }
+
+    file = files + num_files;
+    num_files ++;
+
+    papplCopyString(file->filename, dent->filename, sizeof(file->filename));
+    file->mtime = dent->fileinfo.st_mtime;
+    file->size  = (size_t)dent->fileinfo.st_size;
+    total       += file->size;
+  }
+
+  cupsDirClose(dir);
+
+  if (total > cache_disk_size)
+  {
+    // Remove the oldest files until we are under the limit...
+    qsort(files, num_files, sizeof(lprint_cfile_t), (int (*)(const void *, const void *))compare_files);
+
+    for (i = 0, file = files; i < num_files && total > cache_disk_size; i ++, file ++)
+    {
+      snprintf(filename, sizeof(filename), "%s/%s", cache_directory, file->filename);
+      if (!unlink(filename))
+        total -= file->size;
+    }
+  }
+
+  free(files);
+}
+
+
+//
+// 'find_entry()' - Find an entry in the memory cache and mark it as used.
+//
+// The cache mutex must be held by the caller.
+//
+
+static lprint_centry_t *		// O - Cache entry or `NULL` if not found
+find_entry(const char *key)		// I - Cache key
+{
+  lprint_centry_t	*entry;		// Current entry
+
+
+  for (entry = cache_first; entry; entry = entry->next)
+  {
+    if (!strcmp(entry->key, key))
+      break;
+  }
+
+  if (entry && entry != cache_first)
+  {
+    // Move to the front of the list...
+    entry->prev->next = entry->next;
+
+    if (entry->next)
+      entry->next->prev = entry->prev;
+    else
+      cache_last = entry->prev;
+
+    entry->prev       = NULL;
+    entry->next       = cache_first;
+    cache_first->prev = entry;
+    cache_first       = entry;
+  }
+
+  return (entry);
+}
+
+
+//
+// 'make_key()' - Make the cache key for a job.
+//
+// The key is a SHA-256 hash of the print file, its format, the driver, and all
+// of the options that affect the encoded output.  The print file is hashed in
+// `LPRINT_CACHE_CHUNK` byte chunks.
+//
+
+static bool				// O - `true` on success, `false` if the job cannot be cached
+make_key(pappl_job_t        *job,	// I - Job
+         pappl_pr_options_t *options,	// I - Job options
+         char               *key)	// O - Cache key (65 bytes)
+{
+  pappl_printer_t	*printer = papplJobGetPrinter(job);
+					// Printer
+  pappl_pr_driver_data_t data;		// Driver data
+  lprint_cmedia_t	*cmedia;	// Per-printer data
+  const char		*filename = papplJobGetFilename(job),
+					// Print file
+			*format = papplJobGetFormat(job);
+					// Print file format
+  char			settings[2048];	// Settings that affect the output
+  int			i;		// Looping var
+  size_t		settings_len;	// Length of settings
+  struct stat		fileinfo;	// Print file information
+  int			fd;		// Print file descriptor
+  unsigned char		*buffer,	// Hash buffer (previous hash + chunk)
+			hash[32];	// SHA-256 hash
+  size_t		bytes;		// Bytes hashed
+  ssize_t		rbytes;		// Bytes read
+  bool			ret = false;	// Return value
+
+
+  if (!filename || stat(filename, &fileinfo) || fileinfo.st_size > LPRINT_CACHE_MAX_FILE)
+    return (false);
+
+  papplPrinterGetDriverData(printer, &data);
+  cmedia = (lprint_cmedia_t *)data.extension;
+
+  snprintf(settings, sizeof(settings), "%s|%s|%s|%u|%ux%u|%ux%u|%u|%d|%d|%d|%d|%d|%d|%d|%d|%d|%d|%d|%dx%d|%d|%s|%s|%s|%d|%d|%d|%d|%d|%d|%d|%d|%d|%d", papplPrinterGetDriverName(printer), format ? format : "", cmedia ? cmedia->link_encoding : "", options->num_pages, options->header.cupsWidth, options->header.cupsHeight, options->header.HWResolution[0], options->header.HWResolution[1], options->header.cupsBitsPerPixel, options->copies, (int)options->finishings, (int)options->orientation_requested, (int)options->print_color_mode, (int)options->print_content_optimize, options->print_darkness, options->darkness_configured, (int)options->print_quality, (int)options->print_scaling, options->print_speed, (int)options->sides, options->printer_resolution[0], options->printer_resolution[1], (int)data.mode_configured, options->media.size_name, options->media.source, options->media.type, options->media.size_width, options->media.size_length, options->media.bottom_margin, options->media.left_margin, options->media.right_margin, options->media.top_margin, options->media.top_offset, (int)options->media.tracking, data.tear_offset_configured, data.speed_default);
+  settings_len = strlen(settings);
+
+  // Some drivers select the roll from the loaded media...
+  for (i = 0; i < data.num_source && settings_len < (sizeof(settings) - 1); i ++)
+  {
+    snprintf(settings + settings_len, sizeof(settings) - settings_len, "|%s", data.media_ready[i].size_name);
+    settings_len += strlen(settings + settings_len);
+  }
+
+  // Hash the print file in chunks, chaining the hash of the previous chunks
+  // in front of each one so that only one chunk is in memory...
+  if ((buffer = malloc(sizeof(hash) + LPRINT_CACHE_CHUNK)) == NULL)
+    return (false);
+
+  if ((fd = open(filename, O_RDONLY | O_BINARY)) >= 0)
+  {
+    memset(hash, 0, sizeof(hash));
+
+    for (bytes = 0; bytes < (size_t)fileinfo.st_size; bytes += (size_t)rbytes)
+    {
+      memcpy(buffer, hash, sizeof(hash));
+
+      if ((rbytes = read(fd, buffer + sizeof(hash), LPRINT_CACHE_CHUNK)) <= 0)
+        break;
+
+      if (cupsHashData("sha2-256", buffer, sizeof(hash) + (size_t)rbytes, hash, sizeof(hash)) != (ssize_t)sizeof(hash))
+        break;
+    }
+
+    close(fd);
+
+    if (bytes == (size_t)fileinfo.st_size)
+    {
+      // Then hash the file hash, settings, and dither matrix together...
+      memcpy(buffer, hash, sizeof(hash));
+      memcpy(buffer + sizeof(hash), settings, settings_len);
+      memcpy(buffer + sizeof(hash) + settings_len, options->dither, sizeof(options->dither));
+
+      if (cupsHashData("sha2-256", buffer, sizeof(hash) + settings_len + sizeof(options->dither), hash, sizeof(hash)) == (ssize_t)sizeof(hash))
+      {
+        cupsHashString(hash, sizeof(hash), key, 65);
+        ret = true;
+      }
+    }
+  }
+
+  free(buffer);
+
+  return (ret);
+}
+
+
+//
+// 'read_file()' - Read a cache file and mark it as used.
+//
+// The cache mutex must be held by the caller.
+//
+
+static unsigned char *			// O - Encoded output or `NULL` if not cached
+read_file(const char *key,		// I - Cache key
+          size_t     *size)		// O - Size of encoded output
+{
+  char			filename[1024];	// Cache filename
+  struct stat		fileinfo;	// File information
+  int			fd;		// File descriptor
+  unsigned char		*data;		// Encoded output
+  size_t		total;		// Total bytes read
+  ssize_t		bytes;		// Bytes read
+
+
+  snprintf(filename, sizeof(filename), "%s/%s.out", cache_directory, key);
+
+  if (stat(filename, &fileinfo) || fileinfo.st_size <= 0 || (size_t)fileinfo.st_size > cache_disk_size)
+    return (NULL);
+
+  if ((data = malloc((size_t)fileinfo.st_size)) == NULL)
+    return (NULL);
+
+  if ((fd = open(filename, O_RDONLY | O_BINARY)) < 0)
+  {
+    free(data);
+    return (NULL);
+  }
+
+  for (total = 0; total < (size_t)fileinfo.st_size; total += (size_t)bytes)
+  {
+    if ((bytes = read(fd, data + total, (size_t)fileinfo.st_size - total)) <= 0)
+      break;
+  }
+
+  close(fd);
+
+  if (total < (size_t)fileinfo.st_size)
+  {
+    free(data);
+    return (NULL);
+  }
+
+  // Update the modification time for LRU eviction...
+  utime(filename, NULL);
+
+  *size = total;
+
+  return (data);
+}
+
+
+//
+// 'write_file()' - Write a cache file.
+//
+// The file is written to a temporary file and then renamed so that partial
+// files are never used.  The cache mutex must be held by the caller.
+//
+
+static void
+write_file(const char          *key,	// I - Cache key
+           const unsigned char *data,	// I - Encoded output
+           size_t              size)	// I - Size of encoded output
+{
+  char		filename[1024],		// Cache filename
+		tempfile[1024];		// Temporary filename
+  int		fd;			// File descriptor
+  size_t	total;			// Total bytes written
+  ssize_t	bytes;			// Bytes written
+
+
+  if (!cache_directory[0])
+    return;
+
+  snprintf(filename, sizeof(filename), "%s/%s.out", cache_directory, key);
+  snprintf(tempfile, sizeof(tempfile), "%s/%s.tmp", cache_directory, key);
+
+  if ((fd = open(tempfile, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600)) < 0)
+    return;
+
+  for (total = 0; total < size; total += (size_t)bytes)
+  {
+    if ((bytes = write(fd, data + total, size - total)) <= 0)
+      break;
+  }
+
+  if (close(fd) || total < size || rename(tempfile, filename))
+    unlink(tempfile);
+}
@@ -19,13 +19,281 @@
 #define LPRINT_TRASH	"<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"16\" height=\"16\" fill=\"currentColor\" class=\"bi bi-trash3-fill\" viewBox=\"0 0 16 16\"><path d=\"M11 1.5v1h3.5a.5.5 0 0 1 0 1h-.538l-.853 10.66A2 2 0 0 1 11.115 16h-6.23a2 2 0 0 1-1.994-1.84L2.038 3.5H1.5a.5.5 0 0 1 0-1H5v-1A1.5 1.5 0 0 1 6.5 0h3A1.5 1.5 0 0 1 11 1.5Zm-5 0v1h4v-1a.5.5 0 0 0-.5-.5h-3a.5.5 0 0 0-.5.5ZM4.5 5.029l.5 8.5a.5.5 0 1 0 .998-.06l-.5-8.5a.5.5 0 1 0-.998.06Zm6.53-.528a.5.5 0 0 0-.528.47l-.5 8.5a.5.5 0 0 0 .998.058l.5-8.5a.5.5 0 0 0-.47-.528ZM8 4.5a.5.5 0 0 0-.5.5v8.5a.5.5 0 0 0 1 0V5a.5.5 0 0 0-.5-.5Z\"/></svg>"
 
 
+//
+// Local globals...
+//
+
+static bool	vectors_enabled = false;// Send solid rectangles as drawing commands?
+
+
 //
 // Local functions...
 //
 
+static void	clear_span(lprint_vector_t *vector, unsigned y, unsigned x, unsigned count);
+static int	compare_length(lprint_msize_t **a, lprint_msize_t **b);
+static int	compare_width(lprint_msize_t **a, lprint_msize_t **b);
+static bool	dither_line(lprint_dither_t *dither, unsigned y, const unsigned char *line);
+static bool	drain_buffer(lprint_buffer_t *buffer, bool wait);
+static void	end_session(pappl_job_t *job, bool ok);
+static const char *find_media(lprint_cmedia_t *cmedia, int width, int length);
 static void	free_cmedia(pappl_printer_t *printer, pappl_pr_driver_data_t *data);
+static void	index_media(lprint_cmedia_t *cmedia, pappl_pr_driver_data_t *data);
+static bool	is_black_span(lprint_vector_t *vector, unsigned y, unsigned x, unsigned count);
 static char	*localize_keyword(pappl_client_t *client, const char *attrname, const char *keyword, char *buffer, size_t bufsize);
 static void	media_chooser(pappl_client_t *client, pappl_pr_driver_data_t *driver_data, const char *title, const char *name, pappl_media_col_t *media);
+static bool	queue_data(lprint_buffer_t *buffer, const void *data, size_t bytes);
+static void	record_data(lprint_buffer_t *buffer, const void *data, size_t bytes);
+static void	*run_writer(lprint_buffer_t *buffer);
+static bool	save_media(pappl_printer_t *printer, lprint_cmedia_t *cmedia, int num_source);
+static bool	save_media_cb(pappl_system_t *system, void *data);
+static void	stop_writer(lprint_buffer_t *buffer);
+static void	update_link(lprint_buffer_t *buffer, pappl_job_t *job);
+static bool	write_device(lprint_buffer_t *buffer, const void *data, size_t bytes);
+
+
+//
+// 'lprintBufferFinish()' - Flush a device output buffer and log the totals.
+//
+
+bool					// O - `true` on success, `false` on error
+lprintBufferFinish(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    pappl_job_t     *job)		// I - Job
+{
+  bool	ret = lprintBufferFlush(buffer);
+					// Return value
+
+
+  stop_writer(buffer);
+
+  lprintCacheFinish(buffer, job, ret);
+  lprintMetricsBuffer(buffer);
+
+  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Sent %lu bytes to printer in %lu writes (%.3f seconds).", (unsigned long)buffer->bytes, (unsigned long)buffer->flushes, buffer->write_secs);
+
+  update_link(buffer, job);
+  end_session(job, ret);
+
+  free(buffer->record);
+  buffer->record      = NULL;
+  buffer->record_used = buffer->record_size = 0;
+  buffer->recording   = false;
+
+  return (ret);
+}
+
+
+//
+// 'lprintBufferFlush()' - Write any buffered data and flush the device.
+//
+// Call this at the end of each page and before reading from the device.
+// Any data queued for the writer thread is written before this returns.
+//
+
+bool					// O - `true` on success, `false` on error
+lprintBufferFlush(
+    lprint_buffer_t *buffer)		// I - Output buffer
+{
+  bool	ret = drain_buffer(buffer, true);
+					// Return value
+
+
+  papplDeviceFlush(buffer->device);
+
+  return (ret);
+}
+
+
+//
+// 'lprintBufferInit()' - Initialize a device output buffer.
+//
+
+void
+lprintBufferInit(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    pappl_device_t  *device)		// I - Output device
+{
+  buffer->device      = device;
+  buffer->used        = 0;
+  buffer->bytes       = 0;
+  buffer->flushes     = 0;
+  buffer->write_secs  = 0.0;
+  buffer->recording   = false;
+  buffer->record      = NULL;
+  buffer->record_used = 0;
+  buffer->record_size = 0;
+  buffer->cached      = false;
+  buffer->capturing   = false;
+  buffer->capture     = NULL;
+  buffer->capture_used = 0;
+  buffer->capture_size = 0;
+  buffer->capture_max = 0;
+  buffer->done        = false;
+  buffer->error       = false;
+  buffer->ring        = NULL;
+  buffer->ring_first  = 0;
+  buffer->ring_count  = 0;
+
+  memset(&buffer->write_hist, 0, sizeof(buffer->write_hist));
+
+  buffer->trace = lprintMetricsTrace();
+}
+
+
+//
+// 'lprintBufferPrintf()' - Add formatted text to a device output buffer.
+//
+
+bool					// O - `true` on success, `false` on error
+lprintBufferPrintf(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    const char      *format,		// I - Printf-style format string
+    ...)				// I - Additional arguments as needed
+{
+  va_list	ap;			// Pointer to arguments
+  int		bytes;			// Formatted length
+  char		*temp;			// Temporary string
+  bool		ret;			// Return value
+
+
+  // Try formatting directly into the buffer...
+  va_start(ap, format);
+  bytes = vsnprintf((char *)buffer->data + buffer->used, sizeof(buffer->data) - buffer->used, format, ap);
+  va_end(ap);
+
+  if (bytes < 0)
+    return (false);
+  else if ((size_t)bytes < (sizeof(buffer->data) - buffer->used))
+  {
+    record_data(buffer, buffer->data + buffer->used, (size_t)bytes);
+
+    buffer->used += (size_t)bytes;
+    return (true);
+  }
+
+  // Not enough room, write the buffered data and try again...
+  if (!drain_buffer(buffer, false))
+    return (false);
+
+  if ((size_t)bytes < sizeof(buffer->data))
+  {
+    va_start(ap, format);
+    vsnprintf((char *)buffer->data, sizeof(buffer->data), format, ap);
+    va_end(ap);
+
+    record_data(buffer, buffer->data, (size_t)bytes);
+
+    buffer->used = (size_t)bytes;
+    return (true);
+  }
+
+  // Larger than the buffer, so format into a temporary string...
+  if ((temp = malloc((size_t)bytes + 1)) == NULL)
+    return (false);
+
+  va_start(ap, format);
+  vsnprintf(temp, (size_t)bytes + 1, format, ap);
+  va_end(ap);
+
+  ret = lprintBufferWrite(buffer, temp, (size_t)bytes);
+
+  free(temp);
+
+  return (ret);
+}
+
+
+//
+// 'lprintBufferPuts()' - Add a string to a device output buffer.
+//
+
+bool					// O - `true` on success, `false` on error
+lprintBufferPuts(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    const char      *s)			// I - String
+{
+  return (lprintBufferWrite(buffer, s, strlen(s)));
+}
+
+
+//
+// 'lprintBufferRecord()' - Start or stop recording a page.
+//
+// Starting a recording discards any previously recorded data.  Use
+// `lprintBufferReplay()` to send the recorded page again for each additional
+// copy on printers that have no quantity command.
+//
+
+void
+lprintBufferRecord(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    bool            on)			// I - `true` to start, `false` to stop
+{
+  if (on)
+    buffer->record_used = 0;
+
+  buffer->recording = on;
+}
+
+
+//
+// 'lprintBufferReplay()' - Send the recorded page again.
+//
+
+bool					// O - `true` on success, `false` on error
+lprintBufferReplay(
+    lprint_buffer_t *buffer)		// I - Output buffer
+{
+  bool	recording = buffer->recording,	// Current recording state
+	ret;				// Return value
+
+
+  if (buffer->record_used == 0)
+    return (true);
+
+  buffer->recording = false;
+  ret               = lprintBufferWrite(buffer, buffer->record, buffer->record_used);
+  buffer->recording = recording;
+
+  return (ret);
+}
+
+
+//
+// 'lprintBufferWrite()' - Add data to a device output buffer.
+//
+// The buffered data is queued for a writer thread when the buffer fills up,
+// so the job thread can continue dithering while the device is busy.  If the
+// queue is full this waits for the writer to catch up.
+//
+
+bool					// O - `true` on success, `false` on error
+lprintBufferWrite(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    const void      *data,		// I - Data
+    size_t          bytes)		// I - Number of bytes
+{
+  record_data(buffer, data, bytes);
+
+  if ((buffer->used + bytes) > sizeof(buffer->data))
+  {
+    // Not enough room, write the buffered data...
+    if (!drain_buffer(buffer, false))
+      return (false);
+
+    if (bytes >= sizeof(buffer->data))
+    {
+      // Queue large blocks directly...
+      return (queue_data(buffer, data, bytes));
+    }
+  }
+
+  memcpy(buffer->data + buffer->used, data, bytes);
+  buffer->used += bytes;
+
+  return (true);
+}
 
 
 //
@@ -177,145 +445,157 @@ lprintDitherLine(
     unsigned            y,		// I - Input line number (starting at `0`)
     const unsigned char *line)		// I - Input line
 {
-  unsigned	x,			// Current column
-		count;			// Remaining count
-  unsigned char	*current,		// Current line
-		*prev,			// Previous line
-		*next;			// Next line
-  unsigned char	*dline,			// Dither line
-		*outptr,		// Pointer into output
-		byte,			// Current byte
-		bit;			// Current bit
+  struct timespec	start,		// Start time
+			end;		// End time
+  bool			ret;		// Return value
 
 
-  // Copy current input line...
-  count = dither->in_width;
-  next  = dither->input[y & 3];
+  if (!lprintMetricsActive())
+    return (dither_line(dither, y, line));
 
-  memset(next, 0, count);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ret = dither_line(dither, y, line);
+  clock_gettime(CLOCK_MONOTONIC, &end);
 
-  if (line)
-  {
-    switch (dither->in_bpp)
-    {
-      case 1 : // 1-bit black
-	  for (line += dither->in_left / 8, byte = *line++, bit = 128 >> (dither->in_left & 7); count > 0; count --, next ++)
-	  {
-	    // Convert to 8-bit black...
-	    if (byte & bit)
-	      *next = 255;
+  lprintMetricsDither(ret ? dither->out_width : 0, (end.tv_sec - start.tv_sec) + 0.000000001 * (end.tv_nsec - start.tv_nsec));
 
-	    if (bit > 1)
-	    {
-	      bit /= 2;
-	    }
-	    else
-	    {
-	      bit  = 128;
-	      byte = *line++;
-	    }
-	  }
-	  break;
+  LPRINT_PROBE3(dither_line, y, ret ? dither->out_width : 0, 1000000000LL * (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec));
 
-      case 8 : // Grayscale or 8-bit black
-	  if (dither->in_white)
-	  {
-	    // Convert grayscale to black...
-	    for (line += dither->in_left; count > 0; count --, next ++, line ++)
-	    {
-	      if (*line < LPRINT_WHITE)
-		*next = 255;
-	      else if (*line > LPRINT_BLACK)
-		*next = 0;
-	      else
-		*next = 255 - *line;
-	    }
-	  }
-	  else
-	  {
-	    // Copy with clamping...
-	    for (line += dither->in_left; count > 0; count --, next ++, line ++)
-	    {
-	      if (*line < LPRINT_WHITE)
-		*next = 255;
-	      else if (*line > LPRINT_BLACK)
-		*next = 0;
-	      else
-		*next = *line;
-	    }
-	  }
-	  break;
+  return (ret);
+}
 
-      default : // Something else...
-	  return (false);
-    }
-  }
 
-  // If we are outside the imageable area then don't dither...
-  if (y < (dither->in_top + 1) || y > (dither->in_bottom + 1))
-    return (false);
+//
+// 'lprintLinkCompress()' - Choose whether to compress data for a printer.
+//
+// Compression saves time on slow serial and USB links but costs more time
+// than it saves on fast network links.  The choice is based on the average
+// write rate measured for previous jobs, defaulting to compressed data until
+// a rate is known.
+//
 
-  // Dither...
-  for (x = 0, count = dither->in_width, prev = dither->input[(y - 2) & 3], current = dither->input[(y - 1) & 3], next = dither->input[y & 3], outptr = dither->output, byte = dither->out_white, bit = 128, dline = dither->dither[y & 15]; count > 0; x ++, count --, prev ++, current ++, next ++)
+bool					// O - `true` to compress, `false` otherwise
+lprintLinkCompress(
+    pappl_job_t *job,			// I - Job
+    const char  *compressed,		// I - Name of compressed encoding
+    const char  *uncompressed)		// I - Name of uncompressed encoding
+{
+  pappl_pr_driver_data_t data;		// Driver data
+  lprint_cmedia_t	*cmedia;	// Per-printer data
+  bool			compress = true;// Compress data?
+
+
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &data);
+
+  if ((cmedia = (lprint_cmedia_t *)data.extension) != NULL)
   {
-    if (*current)
-    {
-      // Not pure white/blank...
-      if (*current == 255)
-      {
-        // 100% black...
-        byte ^= bit;
-      }
-      else
-      {
-        // Only dither if this pixel does not border 100% white or black...
-	if ((x > 0 && (current[-1] == 255 || current[-1] == 0)) ||
-	    (count > 1 && (current[1] == 255 || current[1] == 0)) ||
-	    *prev == 255 || *prev == 0 || *next == 255 || *next == 0)
-        {
-          // Threshold
-          if (*current > 127)
-	    byte ^= bit;
-        }
-        else if (*current > dline[x & 15])
-        {
-          // Dither anything else
-	  byte ^= bit;
-	}
-      }
-    }
+    compress = cmedia->link_rate < LPRINT_LINK_FAST;
 
-    // Next output bit...
-    if (bit > 1)
-    {
-      bit /= 2;
-    }
-    else
-    {
-      *outptr++ = byte;
-      byte      = dither->out_white;
-      bit       = 128;
-    }
+    papplCopyString(cmedia->link_encoding, compress ? compressed : uncompressed, sizeof(cmedia->link_encoding));
+    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Using %s encoding, link rate is %.0f bytes/second.", cmedia->link_encoding, cmedia->link_rate);
   }
 
-  // Save last byte of output as needed and return...
-  if (bit < 128)
-    *outptr = byte;
-
-  return (true);
+  return (compress);
 }
 
 
 //
-// 'lprintMediaLoad()' - Load custom label sizes for a printer.
+// 'lprintLinkUI()' - Show the printer link web page.
 //
 
-bool					// O - `true` on success, `false` on error
-lprintMediaLoad(
-    pappl_printer_t        *printer,	// I - Printer
-    pappl_pr_driver_data_t *data)	// I - Driver data
+bool					// O - `true` on success, `false` on failure
+lprintLinkUI(
+    pappl_client_t  *client,		// I - Client
+    pappl_printer_t *printer)		// I - Printer
 {
-  lprint_cmedia_t	*cmedia;	// Custom media
+  pappl_pr_driver_data_t data;		// Driver data
+  lprint_cmedia_t	*cmedia;	// Per-printer data
+  const char		*status = NULL;	// Status message, if any
+
+
+  // Only allow access as appropriate...
+  if (!papplClientHTMLAuthorize(client))
+    return (true);
+
+  papplPrinterGetDriverData(printer, &data);
+  if (!data.extension)
+  {
+    lprintMediaLoad(printer, &data);
+    papplPrinterSetDriverData(printer, &data, NULL);
+  }
+  cmedia = (lprint_cmedia_t *)data.extension;
+
+  if (papplClientGetMethod(client) == HTTP_STATE_POST)
+  {
+    int			num_form = 0;	// Number of form variable
+    cups_option_t	*form = NULL;	// Form variables
+
+    if ((num_form = papplClientGetForm(client, &form)) == 0)
+    {
+      status = papplClientGetLocString(client, "Invalid form data.");
+    }
+    else if (!papplClientIsValidForm(client, num_form, form))
+    {
+      status = papplClientGetLocString(client, "Invalid form submission.");
+    }
+    else if (cmedia)
+    {
+      // Trace jobs started from now on...
+      cmedia->trace = cupsGetOption("trace", num_form, form) != NULL;
+
+      status = papplClientGetLocString(client, "Changes saved.");
+    }
+
+    cupsFreeOptions(num_form, form);
+  }
+
+  papplClientHTMLPrinterHeader(client, printer, "Link", 0, NULL, NULL);
+  if (status)
+    papplClientHTMLPrintf(client, "<div class=\"banner\">%s</div>\n", status);
+
+  papplClientHTMLStartForm(client, papplClientGetURI(client), false);
+
+  papplClientHTMLPuts(client,
+		      "          <table class=\"form\">\n"
+		      "            <tbody>\n");
+
+  if (cmedia && cmedia->link_rate > 0.0)
+  {
+    papplClientHTMLPrintf(client, "              <tr><th>%s:</th><td>%.0f bytes/second</td></tr>\n", papplClientGetLocString(client, "Average Write Rate"), cmedia->link_rate);
+    papplClientHTMLPrintf(client, "              <tr><th>%s:</th><td>%lu bytes in %.3f seconds</td></tr>\n", papplClientGetLocString(client, "Last Job"), (unsigned long)cmedia->link_bytes, cmedia->link_secs);
+  }
+  else
+  {
+    papplClientHTMLPrintf(client, "              <tr><th>%s:</th><td>%s</td></tr>\n", papplClientGetLocString(client, "Average Write Rate"), papplClientGetLocString(client, "Not measured yet"));
+  }
+
+  if (cmedia && cmedia->link_encoding[0])
+    papplClientHTMLPrintf(client, "              <tr><th>%s:</th><td>%s</td></tr>\n", papplClientGetLocString(client, "Encoding"), cmedia->link_encoding);
+
+  papplClientHTMLPrintf(client, "              <tr><th>%s:</th><td><label><input type=\"checkbox\" name=\"trace\"%s> %s</label></td></tr>\n", papplClientGetLocString(client, "Trace Jobs"), cmedia && cmedia->trace ? " checked" : "", papplClientGetLocString(client, "Write a pipeline trace file for each job"));
+
+  papplClientHTMLPrintf(client,
+			"              <tr><th></th><td><input type=\"submit\" value=\"%s\"></td></tr>\n"
+			"            </tbody>\n"
+			"          </table>\n"
+			"        </form>\n", papplClientGetLocString(client, "Save Changes"));
+
+  papplClientHTMLPrinterFooter(client);
+
+  return (true);
+}
+
+
+//
+// 'lprintMediaLoad()' - Load custom label sizes for a printer.
+//
+
+bool					// O - `true` on success, `false` on error
+lprintMediaLoad(
+    pappl_printer_t        *printer,	// I - Printer
+    pappl_pr_driver_data_t *data)	// I - Driver data
+{
+  lprint_cmedia_t	*cmedia;	// Custom media
   int			fd;		// Custom media file descriptor
   cups_file_t		*fp;		// Custom media file
   char			filename[1024],	// Custom media filename
@@ -329,8 +609,14 @@ lprintMediaLoad(
     if ((cmedia = (lprint_cmedia_t *)calloc(1, sizeof(lprint_cmedia_t))) == NULL)
       return (false);
 
+    pthread_rwlock_init(&cmedia->sizes_rwlock, NULL);
+    pthread_mutex_init(&cmedia->save_mutex, NULL);
+
     data->extension = cmedia;
     data->delete_cb = free_cmedia;
+
+    // Measure the driver callbacks for the metrics page...
+    lprintMetricsWrap(printer, data, cmedia);
   }
 
   // Load any existing custom media sizes...
@@ -348,6 +634,9 @@ lprintMediaLoad(
 
   cupsFileClose(fp);
 
+  // Remember what is in the file so unchanged sizes are not saved again...
+  memcpy(cmedia->saved_name, cmedia->custom_name, sizeof(cmedia->saved_name));
+
   return (true);
 }
 
@@ -365,62 +654,62 @@ lprintMediaMatch(
 {
   pappl_pr_driver_data_t pdata;		// Printer driver data
   lprint_cmedia_t	*cmedia;	// Custom media info
-  int			i;		// Looping var
   pwg_media_t		*pwg;		// Current size info
   const char		*ret = NULL;	// Return value
+  bool			changed = false;// Did the driver data change?
 
 
   papplPrinterGetDriverData(printer, &pdata);
 
-  for (i = 0; i < pdata.num_media; i ++)
+  if ((cmedia = (lprint_cmedia_t *)pdata.extension) == NULL)
   {
-    if ((!strncmp(pdata.media[i], "custom_", 7) || !strncmp(pdata.media[i], "roll_", 5)) && (strstr(pdata.media[i], "_min_") != NULL || strstr(pdata.media[i], "_max_") != NULL))
-      continue;
-
-    if ((pwg = pwgMediaForPWG(pdata.media[i])) == NULL)
-      continue;
+    // Load the custom sizes and build the media catalog...
+    if (!lprintMediaLoad(printer, &pdata))
+      return (NULL);
 
-    if ((abs(pwg->width - width) <= 100 || !width) && (abs(pwg->length - length) <= 100 || !length))
-    {
-      if (!ret || !strncmp(pdata.media[i], "custom_", 7) || !strncmp(pdata.media[i], "roll_", 5))
-        ret = pdata.media[i];
-    }
+    cmedia = (lprint_cmedia_t *)pdata.extension;
+    lprintMediaUpdate(printer, &pdata);
+    changed = true;
   }
 
-  if (!ret)
+  if ((ret = find_media(cmedia, width, length)) == NULL)
   {
-    if (!pdata.extension)
-      lprintMediaLoad(printer, &pdata);
+    // Update the custom size, which is saved asynchronously by save_media_cb...
+    pthread_mutex_lock(&cmedia->save_mutex);
 
-    if ((cmedia = (lprint_cmedia_t *)pdata.extension) != NULL)
-    {
-      if (length == 0)
-        pwgFormatSizeName(cmedia->custom_name[source], sizeof(cmedia->custom_name[source]), "roll", pdata.source[source], width, length, /*units*/NULL);
-      else
-        pwgFormatSizeName(cmedia->custom_name[source], sizeof(cmedia->custom_name[source]), "custom", pdata.source[source], width, length, /*units*/NULL);
+    if (length == 0)
+      pwgFormatSizeName(cmedia->custom_name[source], sizeof(cmedia->custom_name[source]), "roll", pdata.source[source], width, length, /*units*/NULL);
+    else
+      pwgFormatSizeName(cmedia->custom_name[source], sizeof(cmedia->custom_name[source]), "custom", pdata.source[source], width, length, /*units*/NULL);
 
-      lprintMediaUpdate(printer, &pdata);
-      lprintMediaSave(printer, &pdata);
+    pthread_mutex_unlock(&cmedia->save_mutex);
 
-      ret = cmedia->custom_name[source];
-    }
+    lprintMediaUpdate(printer, &pdata);
+    lprintMediaSave(printer, &pdata);
+
+    ret     = cmedia->custom_name[source];
+    changed = true;
   }
 
-  if (ret && strcmp(pdata.media_ready[source].size_name, ret) && (pwg = pwgMediaForPWG(ret)) != NULL)
+  if (strcmp(pdata.media_ready[source].size_name, ret) && (pwg = pwgMediaForPWG(ret)) != NULL)
   {
     // Ready media has changed...
     papplCopyString(pdata.media_ready[source].size_name, ret, sizeof(pdata.media_ready[source].size_name));
-    pdata.media_ready[source].size_width = pwg->width;
-    pdata.media_ready[source].size_width = pwg->length;
+    pdata.media_ready[source].size_width  = pwg->width;
+    pdata.media_ready[source].size_length = pwg->length;
 
     if (pwg->length == 0)
       papplCopyString(pdata.media_ready[source].type, "continuous", sizeof(pdata.media_ready[source].type));
     else
       papplCopyString(pdata.media_ready[source].type, "label", sizeof(pdata.media_ready[source].type));
 
-    papplPrinterSetDriverData(printer, &pdata, NULL);
+    changed = true;
   }
 
+  // Only write the driver data back when something changed...
+  if (changed)
+    papplPrinterSetDriverData(printer, &pdata, NULL);
+
   return (ret);
 }
 
@@ -428,6 +717,10 @@ lprintMediaMatch(
 //
 // 'lprintMediaSave()' - Save custom label sizes for a printer.
 //
+// Nothing is written if the custom label sizes have not changed.  Otherwise
+// the file is written `LPRINT_MEDIA_SAVE_DELAY` seconds later so that a burst
+// of changes only causes a single write.
+//
 
 bool					// O - `true` on success, `false` on error
 lprintMediaSave(
@@ -435,10 +728,9 @@ lprintMediaSave(
     pappl_pr_driver_data_t *data)	// I - Driver data
 {
   lprint_cmedia_t	*cmedia;	// Custom media
-  int			i,		// Looping var
-			fd;		// Custom media file descriptor
-  cups_file_t		*fp;		// Custom media file
   char			filename[1024];	// Custom media filename
+  bool			schedule;	// Schedule a save?
+  bool			ret = true;	// Return value
 
 
   // Get the custom media...
@@ -449,22 +741,24 @@ lprintMediaSave(
     return (true);
   }
 
-  // Save custom media sizes...
-  if ((fd = papplPrinterOpenFile(printer, filename, sizeof(filename), /*directory*/NULL, "custom-media", "txt", "w")) < 0)
-    return (true);
+  // See if the sizes changed and no save is scheduled yet...
+  pthread_mutex_lock(&cmedia->save_mutex);
 
-  if ((fp = cupsFileOpenFd(fd, "w")) == NULL)
-  {
-    close(fd);
-    return (true);
-  }
+  schedule = !cmedia->save_pending && memcmp(cmedia->custom_name, cmedia->saved_name, sizeof(cmedia->saved_name)) != 0;
+  if (schedule)
+    cmedia->save_pending = true;
 
-  for (i = 0; i < data->num_source; i ++)
-    cupsFilePrintf(fp, "%s\n", cmedia->custom_name[i]);
+  pthread_mutex_unlock(&cmedia->save_mutex);
 
-  cupsFileClose(fp);
+  // Schedule the save, or save now if we can't...
+  if (schedule && !papplSystemAddTimerCallback(papplPrinterGetSystem(printer), time(NULL) + LPRINT_MEDIA_SAVE_DELAY, 0, save_media_cb, (void *)(intptr_t)papplPrinterGetID(printer)))
+  {
+    pthread_mutex_lock(&cmedia->save_mutex);
+    ret = save_media(printer, cmedia, data->num_source);
+    pthread_mutex_unlock(&cmedia->save_mutex);
+  }
 
-  return (true);
+  return (ret);
 }
 
 
@@ -564,7 +858,9 @@ lprintMediaUI(
 
             snprintf(name, sizeof(name), "ready%d", i);
             pwgFormatSizeName(ready->size_name, sizeof(ready->size_name), "custom", name, ready->size_width, ready->size_length, custom_units);
+            pthread_mutex_lock(&cmedia->save_mutex);
             papplCopyString(cmedia->custom_name[i], ready->size_name, sizeof(cmedia->custom_name[i]));
+            pthread_mutex_unlock(&cmedia->save_mutex);
 	  }
         }
         else if ((pwg = pwgMediaForPWG(value)) != NULL)
@@ -650,61 +946,715 @@ lprintMediaUI(
 		        "    divelem.style = 'display: none;';\n"
 			"}</script>\n", papplClientGetLocString(client, "Save Changes"));
 
-  papplClientHTMLPrinterFooter(client);
-  return (true);
+  papplClientHTMLPrinterFooter(client);
+  return (true);
+}
+
+
+//
+// 'lprintMediaUpdate()' - Update the list of custom label sizes.
+//
+
+void
+lprintMediaUpdate(
+    pappl_printer_t        *printer,	// I - Printer
+    pappl_pr_driver_data_t *data)	// I - Driver data
+{
+  int			i, j;		// Looping vars
+  lprint_cmedia_t	*cmedia;	// Custom label sizes
+
+
+  (void)printer;
+
+  // Find the last size in the media list...
+  for (i = 0; i < data->num_media; i ++)
+  {
+    if (!strncmp(data->media[i], "custom_", 7) && strncmp(data->media[i], "custom_min_", 11) && strncmp(data->media[i], "custom_max_", 11))
+      break;
+  }
+
+  // Then copy any custom sizes over...
+  if ((cmedia = (lprint_cmedia_t *)data->extension) != NULL)
+  {
+    for (j = 0; j < data->num_source && i < PAPPL_MAX_MEDIA; j ++)
+    {
+      if (cmedia->custom_name[j][0])
+        data->media[i ++] = cmedia->custom_name[j];
+    }
+  }
+
+  data->num_media = i;
+
+  // Rebuild the media size catalog used by lprintMediaMatch()...
+  if (cmedia)
+    index_media(cmedia, data);
+
+  LPRINT_DEBUG("lprintMediaUpdate: num_media=%d\n", data->num_media);
+  for (i = 0; i < data->num_media; i ++)
+    LPRINT_DEBUG("lprintMediaUpdate: media[%d]='%s'\n", i, data->media[i]);
+}
+
+
+//
+// 'lprintSessionStart()' - Start a printer session for a job.
+//
+// Returns `true` when the previous job on this printer finished successfully
+// less than `LPRINT_SESSION_IDLE` seconds ago with the same setup commands, in
+// which case the driver can skip resetting and setting up the printer.  The
+// session stays "cold" until `lprintBufferFinish()` succeeds for this job.
+//
+
+bool					// O - `true` if the printer is already set up, `false` otherwise
+lprintSessionStart(
+    pappl_job_t *job,			// I - Job
+    const char  *setup)			// I - Setup commands or `NULL` for none
+{
+  pappl_pr_driver_data_t data;		// Driver data
+  lprint_cmedia_t	*cmedia;	// Per-printer data
+  struct timespec	now;		// Current time
+  double		idle;		// Idle time in seconds
+  bool			warm;		// Is the printer already set up?
+
+
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &data);
+
+  if ((cmedia = (lprint_cmedia_t *)data.extension) == NULL)
+    return (false);
+
+  if (!setup)
+    setup = "";
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  idle = now.tv_sec + 0.000000001 * now.tv_nsec - cmedia->session_time;
+  warm = cmedia->session_time > 0.0 && idle < LPRINT_SESSION_IDLE && !strcmp(cmedia->session_setup, setup);
+
+  if (warm)
+    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Printer was used %.1f seconds ago, skipping reset.", idle);
+
+  cmedia->session_time = 0.0;
+  papplCopyString(cmedia->session_setup, setup, sizeof(cmedia->session_setup));
+
+  return (warm);
+}
+
+
+//
+// 'lprintVectorAlloc()' - Allocate a page bitmap for rectangle extraction.
+//
+// Call this after `lprintDitherAlloc()`.  `false` is returned if rectangle
+// extraction is disabled (the default) or the page bitmap cannot be allocated,
+// in which case the driver should send each dithered line as usual.  Since the
+// whole page is held until it ends, the page bitmap costs memory and delays
+// output for long labels.
+//
+
+bool					// O - `true` on success, `false` on error
+lprintVectorAlloc(
+    lprint_vector_t *vector,		// I - Page bitmap
+    lprint_dither_t *dither)		// I - Dither buffer
+{
+  memset(vector, 0, sizeof(lprint_vector_t));
+
+  if (!vectors_enabled)
+    return (false);
+
+  vector->width  = dither->out_width;
+  vector->height = dither->in_height;
+  vector->white  = dither->out_white;
+
+  if ((vector->bitmap = malloc((size_t)vector->width * vector->height)) == NULL)
+    return (false);
+
+  memset(vector->bitmap, vector->white, (size_t)vector->width * vector->height);
+
+  return (true);
+}
+
+
+//
+// 'lprintVectorFind()' - Find solid rectangles in a page bitmap.
+//
+// Rectangles with an area of at least `min_area` dots are added to the
+// `rects` array and cleared from the page bitmap, leaving the residual pixels
+// to be sent as bitmap data.
+//
+
+size_t					// O - Number of rectangles
+lprintVectorFind(
+    lprint_vector_t *vector,		// I - Page bitmap
+    unsigned        min_area)		// I - Minimum area in dots
+{
+  unsigned	x, y,			// Current position
+		start,			// Start of run
+		width,			// Width of run
+		height,			// Height of rectangle
+		maxx = 8 * vector->width;// Maximum X position
+  unsigned char	*row;			// Current row
+  lprint_rect_t	*rect;			// New rectangle
+
+
+  vector->num_rects = 0;
+
+  for (y = 0, row = vector->bitmap; y < vector->height; y ++, row += vector->width)
+  {
+    for (x = 0; x < maxx;)
+    {
+      // Skip white pixels...
+      if (!(x & 7) && row[x / 8] == vector->white)
+      {
+        x += 8;
+        continue;
+      }
+
+      if (!is_black_span(vector, y, x, 1))
+      {
+        x ++;
+        continue;
+      }
+
+      // Find the end of this run of black pixels...
+      for (start = x ++; x < maxx && is_black_span(vector, y, x, 1); x ++);
+
+      width = x - start;
+
+      if (width * (vector->height - y) < min_area)
+        continue;
+
+      // Extend the run down as far as possible...
+      for (height = 1; (y + height) < vector->height && is_black_span(vector, y + height, start, width); height ++);
+
+      if (width * height < min_area)
+        continue;
+
+      // Save the rectangle and remove it from the bitmap...
+      if (vector->num_rects >= vector->alloc_rects)
+      {
+        if ((rect = realloc(vector->rects, (vector->alloc_rects + 32) * sizeof(lprint_rect_t))) == NULL)
+          return (vector->num_rects);
+
+        vector->rects       = rect;
+        vector->alloc_rects += 32;
+      }
+
+      rect = vector->rects + vector->num_rects;
+      vector->num_rects ++;
+
+      rect->x      = start;
+      rect->y      = y;
+      rect->width  = width;
+      rect->height = height;
+
+      while (height > 0)
+      {
+        height --;
+        clear_span(vector, y + height, start, width);
+      }
+    }
+  }
+
+  return (vector->num_rects);
+}
+
+
+//
+// 'lprintVectorFree()' - Free memory for a page bitmap.
+//
+
+void
+lprintVectorFree(
+    lprint_vector_t *vector)		// I - Page bitmap
+{
+  free(vector->bitmap);
+  free(vector->rects);
+
+  memset(vector, 0, sizeof(lprint_vector_t));
+}
+
+
+//
+// 'lprintVectorInit()' - Enable or disable rectangle extraction.
+//
+
+void
+lprintVectorInit(bool enabled)		// I - `true` to send solid rectangles as drawing commands
+{
+  vectors_enabled = enabled;
+}
+
+
+//
+// 'lprintVectorLine()' - Copy a dithered line to the page bitmap.
+//
+// Call this whenever `lprintDitherLine()` returns `true`.
+//
+
+void
+lprintVectorLine(
+    lprint_vector_t *vector,		// I - Page bitmap
+    lprint_dither_t *dither,		// I - Dither buffer
+    unsigned        y)			// I - Input line number
+{
+  unsigned	row = y - dither->in_top - 1;
+					// Output line (dithering is 1 line behind)
+
+
+  if (row < vector->height)
+    memcpy(vector->bitmap + row * vector->width, dither->output, vector->width);
+}
+
+
+//
+// 'clear_span()' - Set a span of pixels in a page bitmap to white.
+//
+
+static void
+clear_span(
+    lprint_vector_t *vector,		// I - Page bitmap
+    unsigned        y,			// I - Line
+    unsigned        x,			// I - Starting column
+    unsigned        count)		// I - Number of pixels
+{
+  unsigned char	*row = vector->bitmap + y * vector->width,
+					// Line in bitmap
+		bit;			// Current bit
+
+
+  for (; count > 0; count --, x ++)
+  {
+    bit = (unsigned char)(128 >> (x & 7));
+
+    if (vector->white)
+      row[x / 8] |= bit;
+    else
+      row[x / 8] &= (unsigned char)~bit;
+  }
+}
+
+
+//
+// 'compare_length()' - Compare two media sizes by length and width.
+//
+
+static int				// O - Result of comparison
+compare_length(lprint_msize_t **a,	// I - First size
+               lprint_msize_t **b)	// I - Second size
+{
+  if ((*a)->length != (*b)->length)
+    return ((*a)->length - (*b)->length);
+  else if ((*a)->width != (*b)->width)
+    return ((*a)->width - (*b)->width);
+  else
+    return ((*a)->order - (*b)->order);
+}
+
+
+//
+// 'compare_width()' - Compare two media sizes by width and length.
+//
+
+static int				// O - Result of comparison
+compare_width(lprint_msize_t **a,	// I - First size
+              lprint_msize_t **b)	// I - Second size
+{
+  if ((*a)->width != (*b)->width)
+    return ((*a)->width - (*b)->width);
+  else if ((*a)->length != (*b)->length)
+    return ((*a)->length - (*b)->length);
+  else
+    return ((*a)->order - (*b)->order);
+}
+
+
+//
+// 'dither_line()' - Copy and dither a line.
+//
+
+static bool				// O - `true` if line dithered, `false` to skip
+dither_line(
+    lprint_dither_t     *dither,	// I - Dither buffer
+    unsigned            y,		// I - Input line number (starting at `0`)
+    const unsigned char *line)		// I - Input line
+{
+  unsigned	x,			// Current column
+		count;			// Remaining count
+  unsigned char	*current,		// Current line
+		*prev,			// Previous line
+		*next;			// Next line
+  unsigned char	*dline,			// Dither line
+		*outptr,		// Pointer into output
+		byte,			// Current byte
+		bit;			// Current bit
+
+
+  // Copy current input line...
+  count = dither->in_width;
+  next  = dither->input[y & 3];
+
+  memset(next, 0, count);
+
+  if (line)
+  {
+    switch (dither->in_bpp)
+    {
+      case 1 : // 1-bit black
+	  for (line += dither->in_left / 8, byte = *line++, bit = 128 >> (dither->in_left & 7); count > 0; count --, next ++)
+	  {
+	    // Convert to 8-bit black...
+	    if (byte & bit)
+	      *next = 255;
+
+	    if (bit > 1)
+	    {
+	      bit /= 2;
+	    }
+	    else
+	    {
+	      bit  = 128;
+	      byte = *line++;
+	    }
+	  }
+	  break;
+
+      case 8 : // Grayscale or 8-bit black
+	  if (dither->in_white)
+	  {
+	    // Convert grayscale to black...
+	    for (line += dither->in_left; count > 0; count --, next ++, line ++)
+	    {
+	      if (*line < LPRINT_WHITE)
+		*next = 255;
+	      else if (*line > LPRINT_BLACK)
+		*next = 0;
+	      else
+		*next = 255 - *line;
+	    }
+	  }
+	  else
+	  {
+	    // Copy with clamping...
+	    for (line += dither->in_left; count > 0; count --, next ++, line ++)
+	    {
+	      if (*line < LPRINT_WHITE)
+		*next = 255;
+	      else if (*line > LPRINT_BLACK)
+		*next = 0;
+	      else
+		*next = *line;
+	    }
+	  }
+	  break;
+
+      default : // Something else...
+	  return (false);
+    }
+  }
+
+  // If we are outside the imageable area then don't dither...
+  if (y < (dither->in_top + 1) || y > (dither->in_bottom + 1))
+    return (false);
+
+  // Dither...
+  for (x = 0, count = dither->in_width, prev = dither->input[(y - 2) & 3], current = dither->input[(y - 1) & 3], next = dither->input[y & 3], outptr = dither->output, byte = dither->out_white, bit = 128, dline = dither->dither[y & 15]; count > 0; x ++, count --, prev ++, current ++, next ++)
+  {
+    if (*current)
+    {
+      // Not pure white/blank...
+      if (*current == 255)
+      {
+        // 100% black...
+        byte ^= bit;
+      }
+      else
+      {
+        // Only dither if this pixel does not border 100% white or black...
+	if ((x > 0 && (current[-1] == 255 || current[-1] == 0)) ||
+	    (count > 1 && (current[1] == 255 || current[1] == 0)) ||
+	    *prev == 255 || *prev == 0 || *next == 255 || *next == 0)
+        {
+          // Threshold
+          if (*current > 127)
+	    byte ^= bit;
+        }
+        else if (*current > dline[x & 15])
+        {
+          // Dither anything else
+	  byte ^= bit;
+	}
+      }
+    }
+
+    // Next output bit...
+    if (bit > 1)
+    {
+      bit /= 2;
+    }
+    else
+    {
+      *outptr++ = byte;
+      byte      = dither->out_white;
+      bit       = 128;
+    }
+  }
+
+  // Save last byte of output as needed and return...
+  if (bit < 128)
+    *outptr = byte;
+
+  return (true);
+}
+
+
+//
+// 'drain_buffer()' - Queue or write the buffered data.
+//
+// When "wait" is `true`, this also waits for the writer thread to write all
+// queued data.  Nothing is queued when no writer thread is running since the
+// data has to be written before returning anyways.
+//
+
+static bool				// O - `true` on success, `false` on error
+drain_buffer(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    bool            wait)		// I - Wait for queued data to be written?
+{
+  size_t	bytes = buffer->used;	// Bytes to write
+  bool		ret;			// Return value
+
+
+  buffer->used = 0;
+
+  if (wait && !buffer->ring)
+    return (bytes == 0 || write_device(buffer, buffer->data, bytes));
+
+  if (bytes > 0 && !queue_data(buffer, buffer->data, bytes))
+    return (false);
+
+  if (!wait)
+    return (true);
+
+  pthread_mutex_lock(&buffer->mutex);
+  while (buffer->ring_count > 0)
+    pthread_cond_wait(&buffer->cond, &buffer->mutex);
+  ret = !buffer->error;
+  pthread_mutex_unlock(&buffer->mutex);
+
+  return (ret);
+}
+
+
+//
+// 'end_session()' - Record the end of a printer session.
+//
+
+static void
+end_session(pappl_job_t *job,		// I - Job
+            bool        ok)		// I - Was the job sent successfully?
+{
+  pappl_pr_driver_data_t data;		// Driver data
+  lprint_cmedia_t	*cmedia;	// Per-printer data
+  struct timespec	now;		// Current time
+
+
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &data);
+
+  if ((cmedia = (lprint_cmedia_t *)data.extension) == NULL)
+    return;
+
+  if (ok && !papplJobIsCanceled(job))
+  {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    cmedia->session_time = now.tv_sec + 0.000000001 * now.tv_nsec;
+  }
+  else
+    cmedia->session_time = 0.0;
+}
+
+
+//
+// 'find_media()' - Find the media size that best matches the loaded media.
+//
+// Sizes within 1mm of the requested dimensions match.  The last matching
+// custom or roll size in the media list is preferred, otherwise the first
+// matching standard size is used.
+//
+
+static const char *			// O - Media size name or `NULL` if none
+find_media(lprint_cmedia_t *cmedia,	// I - Custom media info
+           int             width,	// I - Width in hundredths of millimeters or `0` if unknown
+           int             length)	// I - Length in hundredths of millimeters or `0` if unknown
+{
+  lprint_msize_t	**sizes,	// Sizes sorted by the known dimension
+			*size,		// Current size
+			*match = NULL;	// Best match
+  int			key,		// Known dimension
+			left,		// Left side of search
+			right,		// Right side of search
+			current;	// Current element
+  const char		*ret = NULL;	// Return value
+
+
+  pthread_rwlock_rdlock(&cmedia->sizes_rwlock);
+
+  // Search by width if known, otherwise by length...
+  if (width)
+  {
+    sizes = cmedia->by_width;
+    key   = width;
+  }
+  else
+  {
+    sizes = cmedia->by_length;
+    key   = length;
+  }
+
+  // Find the first size that is no more than 1mm smaller...
+  left  = 0;
+  right = cmedia->num_sizes;
+
+  if (key)
+  {
+    while (left < right)
+    {
+      current = (left + right) / 2;
+
+      if ((width ? sizes[current]->width : sizes[current]->length) < key - 100)
+        left = current + 1;
+      else
+        right = current;
+    }
+  }
+
+  // Then check every size that is no more than 1mm larger...
+  for (; left < cmedia->num_sizes; left ++)
+  {
+    size = sizes[left];
+
+    if (key && (width ? size->width : size->length) > key + 100)
+      break;
+
+    if (width && length && abs(size->length - length) > 100)
+      continue;
+
+    if (!match || (size->custom && (!match->custom || size->order > match->order)) || (!size->custom && !match->custom && size->order < match->order))
+      match = size;
+  }
+
+  if (match)
+    ret = match->name;
+
+  pthread_rwlock_unlock(&cmedia->sizes_rwlock);
+
+  return (ret);
+}
+
+
+//
+// 'free_cmedia()' - Free custom media information.
+//
+
+static void
+free_cmedia(
+    pappl_printer_t        *printer,	// I - Printer (unused)
+    pappl_pr_driver_data_t *data)	// I - Driver data
+{
+  lprint_cmedia_t	*cmedia = (lprint_cmedia_t *)data->extension;
+					// Custom media
+
+
+  if (cmedia)
+  {
+    // Write any pending changes before the timer has a chance to...
+    if (cmedia->save_pending && !papplPrinterIsDeleted(printer))
+      save_media(printer, cmedia, data->num_source);
+
+    pthread_mutex_destroy(&cmedia->save_mutex);
+    pthread_rwlock_destroy(&cmedia->sizes_rwlock);
+    free(cmedia);
+  }
 }
 
 
 //
-// 'lprintMediaUpdate()' - Update the list of custom label sizes.
+// 'index_media()' - Build the media size catalog for a printer.
 //
 
-void
-lprintMediaUpdate(
-    pappl_printer_t        *printer,	// I - Printer
+static void
+index_media(
+    lprint_cmedia_t        *cmedia,	// I - Custom media info
     pappl_pr_driver_data_t *data)	// I - Driver data
 {
-  int			i, j;		// Looping vars
-  lprint_cmedia_t	*cmedia;	// Custom label sizes
+  int			i;		// Looping var
+  const char		*name;		// Media size name
+  pwg_media_t		*pwg;		// PWG media info
+  lprint_msize_t	*size;		// Current size
 
 
-  (void)printer;
+  pthread_rwlock_wrlock(&cmedia->sizes_rwlock);
 
-  // Find the last size in the media list...
-  for (i = 0; i < data->num_media; i ++)
+  for (i = 0, size = cmedia->sizes, cmedia->num_sizes = 0; i < data->num_media; i ++)
   {
-    if (!strncmp(data->media[i], "custom_", 7) && strncmp(data->media[i], "custom_min_", 11) && strncmp(data->media[i], "custom_max_", 11))
-      break;
-  }
+    name = data->media[i];
 
-  // Then copy any custom sizes over...
-  if ((cmedia = (lprint_cmedia_t *)data->extension) != NULL)
-  {
-    for (j = 0; j < data->num_source && i < PAPPL_MAX_MEDIA; j ++)
-    {
-      if (cmedia->custom_name[j][0])
-        data->media[i ++] = cmedia->custom_name[j];
-    }
+    // Skip custom size ranges...
+    if ((!strncmp(name, "custom_", 7) || !strncmp(name, "roll_", 5)) && (strstr(name, "_min_") != NULL || strstr(name, "_max_") != NULL))
+      continue;
+
+    if ((pwg = pwgMediaForPWG(name)) == NULL)
+      continue;
+
+    size->width  = pwg->width;
+    size->length = pwg->length;
+    size->order  = i;
+    size->custom = !strncmp(name, "custom_", 7) || !strncmp(name, "roll_", 5);
+    size->name   = name;
+
+    cmedia->by_width[cmedia->num_sizes]  = size;
+    cmedia->by_length[cmedia->num_sizes] = size;
+
+    cmedia->num_sizes ++;
+    size ++;
   }
 
-  data->num_media = i;
+  qsort(cmedia->by_width, (size_t)cmedia->num_sizes, sizeof(lprint_msize_t *), (int (*)(const void *, const void *))compare_width);
+  qsort(cmedia->by_length, (size_t)cmedia->num_sizes, sizeof(lprint_msize_t *), (int (*)(const void *, const void *))compare_length);
 
-  LPRINT_DEBUG("lprintMediaUpdate: num_media=%d\n", data->num_media);
-  for (i = 0; i < data->num_media; i ++)
-    LPRINT_DEBUG("lprintMediaUpdate: media[%d]='%s'\n", i, data->media[i]);
+  pthread_rwlock_unlock(&cmedia->sizes_rwlock);
 }
 
 
 //
-// 'free_cmedia()' - Free custom media information.
+// 'is_black_span()' - Determine whether a span of pixels is all black.
 //
 
-static void
-free_cmedia(
-    pappl_printer_t        *printer,	// I - Printer (unused)
-    pappl_pr_driver_data_t *data)	// I - Driver data
+static bool				// O - `true` if all black, `false` otherwise
+is_black_span(
+    lprint_vector_t *vector,		// I - Page bitmap
+    unsigned        y,			// I - Line
+    unsigned        x,			// I - Starting column
+    unsigned        count)		// I - Number of pixels
 {
-  free(data->extension);
+  const unsigned char	*row = vector->bitmap + y * vector->width;
+					// Line in bitmap
+  unsigned char		black = (unsigned char)~vector->white;
+					// Black byte value
+
+
+  for (; count > 0; count --, x ++)
+  {
+    if (!(x & 7) && count >= 8)
+    {
+      // Check whole bytes at once...
+      if (row[x / 8] != black)
+        return (false);
+
+      x     += 7;
+      count -= 7;
+    }
+    else if ((row[x / 8] ^ black) & (128 >> (x & 7)))
+      return (false);
+  }
+
+  return (true);
 }
 
 
@@ -919,3 +1869,403 @@ media_chooser(
   }
   papplClientHTMLPrintf(client, "</select></td></tr>\n");
 }
+
+
+//
+// 'queue_data()' - Queue data for the writer thread.
+//
+// The writer thread is started the first time data is queued.  If the thread
+// cannot be started, the data is written directly.
+//
+
+static bool				// O - `true` on success, `false` on error
+queue_data(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    const void      *data,		// I - Data
+    size_t          bytes)		// I - Number of bytes
+{
+  const unsigned char	*dataptr = (const unsigned char *)data;
+					// Pointer into data
+  size_t		count;		// Bytes to queue
+  unsigned		slot;		// Queue slot
+  bool			ret;		// Return value
+
+
+  if (!buffer->ring)
+  {
+    // Start the writer thread...
+    if ((buffer->ring = malloc(LPRINT_BUFFER_COUNT * LPRINT_BUFFER_SIZE)) == NULL)
+      return (write_device(buffer, data, bytes));
+
+    pthread_mutex_init(&buffer->mutex, NULL);
+    pthread_cond_init(&buffer->cond, NULL);
+
+    buffer->done       = false;
+    buffer->error      = false;
+    buffer->ring_first = 0;
+    buffer->ring_count = 0;
+
+    if (pthread_create(&buffer->writer, NULL, (void *(*)(void *))run_writer, buffer))
+    {
+      pthread_cond_destroy(&buffer->cond);
+      pthread_mutex_destroy(&buffer->mutex);
+      free(buffer->ring);
+      buffer->ring = NULL;
+
+      return (write_device(buffer, data, bytes));
+    }
+  }
+
+  pthread_mutex_lock(&buffer->mutex);
+
+  while (bytes > 0 && !buffer->error)
+  {
+    // Wait for a free slot...
+    if (buffer->ring_count >= LPRINT_BUFFER_COUNT)
+    {
+      pthread_cond_wait(&buffer->cond, &buffer->mutex);
+      continue;
+    }
+
+    if ((count = bytes) > LPRINT_BUFFER_SIZE)
+      count = LPRINT_BUFFER_SIZE;
+
+    slot = (buffer->ring_first + buffer->ring_count) % LPRINT_BUFFER_COUNT;
+
+    memcpy(buffer->ring + slot * LPRINT_BUFFER_SIZE, dataptr, count);
+    buffer->ring_bytes[slot] = count;
+    buffer->ring_count ++;
+
+    pthread_cond_broadcast(&buffer->cond);
+
+    dataptr += count;
+    bytes   -= count;
+  }
+
+  ret = !buffer->error;
+
+  pthread_mutex_unlock(&buffer->mutex);
+
+  return (ret);
+}
+
+
+//
+// 'record_data()' - Add data to the recorded page and captured output.
+//
+
+static void
+record_data(
+    lprint_buffer_t *buffer,		// I - Output buffer
+    const void      *data,		// I - Data
+    size_t          bytes)		// I - Number of bytes
+{
+  unsigned char	*record;		// New record buffer
+  size_t	size;			// New size
+
+
+  if (buffer->capturing && bytes > 0)
+  {
+    // Capture the whole job for the output cache...
+    if ((buffer->capture_used + bytes) > buffer->capture_size)
+    {
+      if ((size = 2 * buffer->capture_size) < (buffer->capture_used + bytes))
+        size = buffer->capture_used + bytes + LPRINT_BUFFER_SIZE;
+      if (size > buffer->capture_max)
+        size = buffer->capture_max;
+
+      if ((buffer->capture_used + bytes) > size || (record = realloc(buffer->capture, size)) == NULL)
+      {
+        // Too big or out of memory, don't cache this job...
+        free(buffer->capture);
+        buffer->capture      = NULL;
+        buffer->capture_used = buffer->capture_size = 0;
+        buffer->capturing    = false;
+      }
+      else
+      {
+        buffer->capture      = record;
+        buffer->capture_size = size;
+      }
+    }
+
+    if (buffer->capturing)
+    {
+      memcpy(buffer->capture + buffer->capture_used, data, bytes);
+      buffer->capture_used += bytes;
+    }
+  }
+
+  if (!buffer->recording || bytes == 0)
+    return;
+
+  if ((buffer->record_used + bytes) > buffer->record_size)
+  {
+    if ((size = 2 * buffer->record_size) < (buffer->record_used + bytes))
+      size = buffer->record_used + bytes + LPRINT_BUFFER_SIZE;
+
+    if ((record = realloc(buffer->record, size)) == NULL)
+    {
+      // Out of memory, stop recording - copies will not be sent...
+      buffer->recording   = false;
+      buffer->record_used = 0;
+      return;
+    }
+
+    buffer->record      = record;
+    buffer->record_size = size;
+  }
+
+  memcpy(buffer->record + buffer->record_used, data, bytes);
+  buffer->record_used += bytes;
+}
+
+
+//
+// 'run_writer()' - Write queued buffers to the device.
+//
+// After a write error the queue is discarded and the error is reported by
+// the next call to queue or flush data.
+//
+
+static void *				// O - Thread exit status
+run_writer(lprint_buffer_t *buffer)	// I - Output buffer
+{
+  unsigned	slot;			// Current slot
+  bool		ok;			// Did the write succeed?
+
+
+  pthread_mutex_lock(&buffer->mutex);
+
+  for (;;)
+  {
+    if (buffer->ring_count == 0)
+    {
+      if (buffer->done)
+        break;
+
+      pthread_cond_wait(&buffer->cond, &buffer->mutex);
+      continue;
+    }
+
+    // Write the first buffer without holding the mutex...
+    slot = buffer->ring_first;
+
+    pthread_mutex_unlock(&buffer->mutex);
+    ok = write_device(buffer, buffer->ring + slot * LPRINT_BUFFER_SIZE, buffer->ring_bytes[slot]);
+    pthread_mutex_lock(&buffer->mutex);
+
+    if (ok)
+    {
+      buffer->ring_first = (buffer->ring_first + 1) % LPRINT_BUFFER_COUNT;
+      buffer->ring_count --;
+    }
+    else
+    {
+      buffer->error      = true;
+      buffer->ring_count = 0;
+    }
+
+    pthread_cond_broadcast(&buffer->cond);
+  }
+
+  pthread_mutex_unlock(&buffer->mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'save_media()' - Write the custom label sizes file.
+//
+// The file is written to a temporary file that replaces the current file,
+// so that an interrupted save never leaves a truncated file behind.
+//
+
+static bool				// O - `true` on success, `false` on error
+save_media(pappl_printer_t *printer,	// I - Printer
+           lprint_cmedia_t *cmedia,	// I - Custom media
+           int             num_source)	// I - Number of media sources
+{
+  int			i,		// Looping var
+			fd;		// Custom media file descriptor
+  cups_file_t		*fp;		// Custom media file
+  char			filename[1024],	// Custom media filename
+			tempfile[1040];	// Temporary filename
+
+
+  // Get the filename for the custom media sizes...
+  if ((fd = papplPrinterOpenFile(printer, filename, sizeof(filename), /*directory*/NULL, "custom-media", "txt", "r")) >= 0)
+    close(fd);
+
+  snprintf(tempfile, sizeof(tempfile), "%s.tmp", filename);
+
+  // Write the custom media sizes to the temporary file...
+  if ((fd = open(tempfile, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+  {
+    papplLogPrinter(printer, PAPPL_LOGLEVEL_ERROR, "Unable to create custom media file '%s': %s", tempfile, strerror(errno));
+    return (false);
+  }
+
+  if ((fp = cupsFileOpenFd(fd, "w")) == NULL)
+  {
+    close(fd);
+    unlink(tempfile);
+    return (false);
+  }
+
+  for (i = 0; i < num_source; i ++)
+    cupsFilePrintf(fp, "%s\n", cmedia->custom_name[i]);
+
+  cupsFileFlush(fp);
+  fsync(fd);
+
+  if (cupsFileClose(fp) || rename(tempfile, filename))
+  {
+    papplLogPrinter(printer, PAPPL_LOGLEVEL_ERROR, "Unable to save custom media file '%s': %s", filename, strerror(errno));
+    unlink(tempfile);
+    return (false);
+  }
+
+  memcpy(cmedia->saved_name, cmedia->custom_name, sizeof(cmedia->saved_name));
+  cmedia->save_pending = false;
+
+  papplLogPrinter(printer, PAPPL_LOGLEVEL_DEBUG, "Saved custom media sizes to '%s'.", filename);
+
+  return (true);
+}
+
+
+//
+// 'save_media_cb()' - Save custom label sizes after a change.
+//
+
+static bool				// O - `false` to remove the timer
+save_media_cb(pappl_system_t *system,	// I - System
+              void           *data)	// I - Printer ID
+{
+  pappl_printer_t	*printer;	// Printer
+  pappl_pr_driver_data_t pdata;		// Driver data
+  lprint_cmedia_t	*cmedia;	// Custom media
+
+
+  // Find the printer, which might have been deleted since the change...
+  if ((printer = papplSystemFindPrinter(system, /*resource*/NULL, (int)(intptr_t)data, /*device_uri*/NULL)) == NULL)
+    return (false);
+
+  papplPrinterGetDriverData(printer, &pdata);
+
+  if ((cmedia = (lprint_cmedia_t *)pdata.extension) != NULL)
+  {
+    pthread_mutex_lock(&cmedia->save_mutex);
+
+    if (cmedia->save_pending)
+    {
+      if (memcmp(cmedia->custom_name, cmedia->saved_name, sizeof(cmedia->saved_name)))
+        save_media(printer, cmedia, pdata.num_source);
+      else
+        cmedia->save_pending = false;
+    }
+
+    pthread_mutex_unlock(&cmedia->save_mutex);
+  }
+
+  return (false);
+}
+
+
+//
+// 'stop_writer()' - Stop the writer thread, if any.
+//
+
+static void
+stop_writer(lprint_buffer_t *buffer)	// I - Output buffer
+{
+  if (!buffer->ring)
+    return;
+
+  pthread_mutex_lock(&buffer->mutex);
+  buffer->done = true;
+  pthread_cond_broadcast(&buffer->cond);
+  pthread_mutex_unlock(&buffer->mutex);
+
+  pthread_join(buffer->writer, NULL);
+
+  pthread_cond_destroy(&buffer->cond);
+  pthread_mutex_destroy(&buffer->mutex);
+
+  free(buffer->ring);
+  buffer->ring = NULL;
+}
+
+
+//
+// 'update_link()' - Update the average link rate for a printer.
+//
+
+static void
+update_link(lprint_buffer_t *buffer,	// I - Output buffer
+            pappl_job_t     *job)	// I - Job
+{
+  pappl_pr_driver_data_t data;		// Driver data
+  lprint_cmedia_t	*cmedia;	// Per-printer data
+  double		rate;		// Write rate for this job
+
+
+  // Small jobs mostly measure the OS buffers, not the link...
+  if (buffer->bytes < LPRINT_LINK_MIN_BYTES || buffer->write_secs <= 0.0)
+    return;
+
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &data);
+
+  if ((cmedia = (lprint_cmedia_t *)data.extension) == NULL)
+    return;
+
+  rate = buffer->bytes / buffer->write_secs;
+
+  if (cmedia->link_rate > 0.0)
+    cmedia->link_rate = 0.75 * cmedia->link_rate + 0.25 * rate;
+  else
+    cmedia->link_rate = rate;
+
+  cmedia->link_bytes = buffer->bytes;
+  cmedia->link_secs  = buffer->write_secs;
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Link rate is %.0f bytes/second, average is %.0f bytes/second.", rate, cmedia->link_rate);
+}
+
+
+//
+// 'write_device()' - Write data to the device and time it.
+//
+
+static bool				// O - `true` on success, `false` on error
+write_device(lprint_buffer_t *buffer,	// I - Output buffer
+             const void      *data,	// I - Data
+             size_t          bytes)	// I - Number of bytes
+{
+  struct timespec	start,		// Start time
+			end;		// End time
+  ssize_t		written;	// Bytes written
+  double		secs;		// Time for write
+
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  written = papplDeviceWrite(buffer->device, data, bytes);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  secs = (end.tv_sec - start.tv_sec) + 0.000000001 * (end.tv_nsec - start.tv_nsec);
+
+  buffer->bytes      += bytes;
+  buffer->write_secs += secs;
+  buffer->flushes ++;
+
+  lprintMetricsObserve(&buffer->write_hist, secs);
+
+  LPRINT_PROBE3(device_write, bytes, 1000000000LL * (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec), written >= 0);
+
+  if (buffer->trace)
+    lprintMetricsTraceWrite(buffer->trace, start.tv_sec + 0.000000001 * start.tv_nsec, secs, bytes);
+
+  return (written >= 0);
+}
@@ -11,6 +11,13 @@
 #ifdef LPRINT_EXPERIMENTAL
 
 
+//
+// Constants...
+//
+
+#define LPRINT_CPCL_BAND_MAX	128	// Maximum number of lines in a CG band
+
+
 //
 // Local types...
 //
@@ -18,6 +25,13 @@
 typedef struct lprint_cpcl_s		// CPCL driver data
 {
   lprint_dither_t dither;		// Dither buffer
+  lprint_buffer_t buffer;		// Output buffer
+  lprint_vector_t vector;		// Page bitmap for rectangles
+  unsigned char	*band;			// Band buffer
+  unsigned	band_y,			// First line in band
+		band_height,		// Number of lines in band
+		band_left,		// Left-most non-blank byte in band
+		band_right;		// Right-most non-blank byte in band
 } lprint_cpcl_t;
 
 
@@ -91,6 +105,8 @@ static const char * const lprint_cpcl_media[] =
 // Local functions...
 //
 
+static bool	lprint_cpcl_add_row(lprint_cpcl_t *cpcl, unsigned y, const unsigned char *row);
+static bool	lprint_cpcl_flush_band(lprint_cpcl_t *cpcl);
 static bool	lprint_cpcl_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_cpcl_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_cpcl_rendpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
@@ -121,7 +137,7 @@ lprintCPCL(
   data->rstartpage_cb = lprint_cpcl_rstartpage;
   data->rwriteline_cb = lprint_cpcl_rwriteline;
   data->status_cb     = lprint_cpcl_status;
-  data->format        = LPRINT_EPL2_MIMETYPE;
+  data->format        = LPRINT_CPCL_MIMETYPE;
 
   data->num_resolution = 1;
 
@@ -173,6 +189,89 @@ lprintCPCL(
 }
 
 
+//
+// 'lprint_cpcl_add_row()' - Add a row of the bitmap to the current band.
+//
+
+static bool				// O - `true` on success, `false` on failure
+lprint_cpcl_add_row(
+    lprint_cpcl_t       *cpcl,		// I - CPCL driver data
+    unsigned            y,		// I - Line number on page
+    const unsigned char *row)		// I - Row of bitmap
+{
+  unsigned	left,			// Left-most non-blank byte
+		right;			// Right-most non-blank byte
+
+
+  // Find the ink extents...
+  for (left = 0; left < cpcl->dither.out_width && !row[left]; left ++);
+
+  if (left >= cpcl->dither.out_width)
+  {
+    // Blank line ends the current band...
+    return (lprint_cpcl_flush_band(cpcl));
+  }
+
+  for (right = cpcl->dither.out_width - 1; right > left && !row[right]; right --);
+
+  // Add the line to the current band...
+  if (cpcl->band_height == 0)
+  {
+    cpcl->band_y     = y;
+    cpcl->band_left  = left;
+    cpcl->band_right = right;
+  }
+  else
+  {
+    if (left < cpcl->band_left)
+      cpcl->band_left = left;
+    if (right > cpcl->band_right)
+      cpcl->band_right = right;
+  }
+
+  memcpy(cpcl->band + cpcl->band_height * cpcl->dither.out_width, row, cpcl->dither.out_width);
+
+  if (++ cpcl->band_height >= LPRINT_CPCL_BAND_MAX)
+    return (lprint_cpcl_flush_band(cpcl));
+
+  return (true);
+}
+
+
+//
+// 'lprint_cpcl_flush_band()' - Write the current band as a single CG command.
+//
+
+static bool				// O - `true` on success, `false` on failure
+lprint_cpcl_flush_band(
+    lprint_cpcl_t *cpcl)		// I - CPCL driver data
+{
+  unsigned	i,			// Looping var
+		width;			// Width of band in bytes
+  unsigned char	*bandptr;		// Pointer into band
+
+
+  if (cpcl->band_height == 0)
+    return (true);
+
+  // Only send the bytes between the left- and right-most ink...
+  width = cpcl->band_right - cpcl->band_left + 1;
+
+  if (!lprintBufferPrintf(&cpcl->buffer, "CG %u %u %u %u ", width, cpcl->band_height, 8 * cpcl->band_left, cpcl->band_y))
+    return (false);
+
+  for (i = cpcl->band_height, bandptr = cpcl->band + cpcl->band_left; i > 0; i --, bandptr += cpcl->dither.out_width)
+  {
+    if (!lprintBufferWrite(&cpcl->buffer, bandptr, width))
+      return (false);
+  }
+
+  cpcl->band_height = 0;
+
+  return (lprintBufferPuts(&cpcl->buffer, "\r\n"));
+}
+
+
 //
 // 'lprint_cpcl_printfile()' - Print a file.
 //
@@ -201,12 +300,17 @@ lprint_cpcl_printfile(
   // Copy print data...
   while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
   {
+    LPRINT_PROBE2(raw_write_start, papplJobGetID(job), bytes);
+
     if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
     {
+      LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 0);
       papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
       close(fd);
       return (false);
     }
+
+    LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 1);
   }
   close(fd);
 
@@ -232,6 +336,9 @@ lprint_cpcl_rendjob(
   (void)options;
   (void)device;
 
+  lprintBufferFinish(&cpcl->buffer, job);
+
+  free(cpcl->band);
   free(cpcl);
   papplJobSetData(job, NULL);
 
@@ -252,29 +359,57 @@ lprint_cpcl_rendpage(
 {
   lprint_cpcl_t	*cpcl = (lprint_cpcl_t *)papplJobGetData(job);
 					// CPCL driver data
-  int	darkness;			// Composite darkness value
+  int		darkness;		// Composite darkness value
+  unsigned	y;			// Current line
+  size_t	i;			// Looping var
+  lprint_rect_t	*rect;			// Current rectangle
 
 
   (void)page;
 
+  // Nothing more to send if the output came from the cache...
+  if (cpcl->buffer.cached)
+    return (true);
+
   // Write last line
   lprint_cpcl_rwriteline(job, options, device, options->header.cupsHeight, NULL);
 
+  if (cpcl->vector.bitmap)
+  {
+    // Pull out solid rectangles and send the rest of the page as bands...
+    lprintVectorFind(&cpcl->vector, LPRINT_VECTOR_MIN_AREA);
+
+    for (y = 0; y < cpcl->vector.height; y ++)
+      lprint_cpcl_add_row(cpcl, y + cpcl->dither.in_top, cpcl->vector.bitmap + y * cpcl->vector.width);
+
+    // BOX only draws outlines, so use thick lines for the rectangles...
+    for (i = cpcl->vector.num_rects, rect = cpcl->vector.rects; i > 0; i --, rect ++)
+    {
+      if (rect->width >= rect->height)
+        lprintBufferPrintf(&cpcl->buffer, "LINE %u %u %u %u %u\r\n", rect->x, rect->y + cpcl->dither.in_top, rect->x + rect->width, rect->y + cpcl->dither.in_top, rect->height);
+      else
+        lprintBufferPrintf(&cpcl->buffer, "LINE %u %u %u %u %u\r\n", rect->x, rect->y + cpcl->dither.in_top, rect->x, rect->y + cpcl->dither.in_top + rect->height, rect->width);
+    }
+  }
+
+  // Write last band
+  lprint_cpcl_flush_band(cpcl);
+
   // Set options
-  papplDevicePrintf(device, "PRESENT-AT %d 4\r\n", options->media.top_offset * options->printer_resolution[1] / 2540);
+  lprintBufferPrintf(&cpcl->buffer, "PRESENT-AT %d 4\r\n", options->media.top_offset * options->printer_resolution[1] / 2540);
 
   if ((darkness = options->print_darkness + options->darkness_configured) < 0)
     darkness = 0;
   else if (darkness > 100)
     darkness = 100;
 
-  papplDevicePrintf(device, "TONE %d\r\n", 2 * darkness);
+  lprintBufferPrintf(&cpcl->buffer, "TONE %d\r\n", 2 * darkness);
 
   if (options->print_speed > 0)
-    papplDevicePrintf(device, "SPEED %d\r\n", 5 * options->print_speed / (4 * 2540));
+    lprintBufferPrintf(&cpcl->buffer, "SPEED %d\r\n", 5 * options->print_speed / (4 * 2540));
 
   if (options->finishings & PAPPL_FINISHINGS_TRIM)
-    papplDevicePuts(device, "CUT\r\n");
+    lprintBufferPuts(&cpcl->buffer, "CUT\r\n");
 
   if (options->media.type[0] && strcmp(options->media.type, "labels"))
   {
@@ -283,14 +418,18 @@ lprint_cpcl_rendpage(
   }
 
   if (options->media.tracking != PAPPL_MEDIA_TRACKING_CONTINUOUS)
-    papplDevicePuts(device, "FORM\r\n");
+    lprintBufferPuts(&cpcl->buffer, "FORM\r\n");
 
   // Eject
-  papplDevicePuts(device, "PRINT\r\n");
-  papplDeviceFlush(device);
+  lprintBufferPuts(&cpcl->buffer, "PRINT\r\n");
+  lprintBufferFlush(&cpcl->buffer);
 
   // Free memory and return...
   lprintDitherFree(&cpcl->dither);
+  lprintVectorFree(&cpcl->vector);
+
+  free(cpcl->band);
+  cpcl->band = NULL;
 
   return (true);
 }
@@ -310,11 +449,12 @@ lprint_cpcl_rstartjob(
 					// CPCL driver data
 
 
-  (void)options;
-  (void)device;
-
   // Save driver data...
   papplJobSetData(job, cpcl);
+  lprintBufferInit(&cpcl->buffer, device);
+
+  // Send the cached output for identical jobs...
+  lprintCacheStart(&cpcl->buffer, job, options);
 
   return (true);
 }
@@ -337,19 +477,28 @@ lprint_cpcl_rstartpage(
 
   (void)page;
 
-  // Initialize the dither buffer...
-  if (!lprintDitherAlloc(&cpcl->dither, job, options, CUPS_CSPACE_W, options->header.HWResolution[0] == 300 ? 1.2 : 1.0))
+  // Nothing more to send if the output came from the cache...
+  if (cpcl->buffer.cached)
+    return (true);
+
+  // Initialize the dither and band buffers - CG uses 1 bits for black...
+  if (!lprintDitherAlloc(&cpcl->dither, job, options, CUPS_CSPACE_K, options->header.HWResolution[0] == 300 ? 1.2 : 1.0))
     return (false);
 
-  // Initialize the printer...
-  papplDevicePrintf(device, "! 0 %u %u %u %u\r\n", options->header.HWResolution[0], options->header.HWResolution[1], options->header.cupsHeight, options->header.NumCopies);
-  papplDevicePrintf(device, "PAGE-WIDTH %u\r\n", options->header.cupsWidth);
-  papplDevicePrintf(device, "PAGE-HEIGHT %u\r\n", options->header.cupsHeight);
+  if ((cpcl->band = malloc(LPRINT_CPCL_BAND_MAX * cpcl->dither.out_width)) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate band buffer.");
+    return (false);
+  }
 
+  cpcl->band_height = 0;
 
-  // Start the page image...
-  papplDevicePuts(device, "CLS\n");
-  papplDevicePrintf(device, "BITMAP 0,0,%u,%u,1,", cpcl->dither.out_width, options->header.cupsHeight);
+  lprintVectorAlloc(&cpcl->vector, &cpcl->dither);
+
+  // Initialize the printer...
+  lprintBufferPrintf(&cpcl->buffer, "! 0 %u %u %u %u\r\n", options->header.HWResolution[0], options->header.HWResolution[1], options->header.cupsHeight, options->header.NumCopies);
+  lprintBufferPrintf(&cpcl->buffer, "PAGE-WIDTH %u\r\n", options->header.cupsWidth);
+  lprintBufferPrintf(&cpcl->buffer, "PAGE-HEIGHT %u\r\n", options->header.cupsHeight);
 
   return (true);
 }
@@ -372,18 +521,21 @@ lprint_cpcl_rwriteline(
 
 
   (void)options;
+  (void)device;
 
-  // Dither and write the line...
-  if (lprintDitherLine(&cpcl->dither, y, line))
-  {
-    if (cpcl->dither.output[0] || memcmp(cpcl->dither.output, cpcl->dither.output + 1, cpcl->dither.out_width - 1))
-    {
-      papplDevicePrintf(device, "CG %u 1 0 %d ", (unsigned)cpcl->dither.out_width, y);
-      papplDeviceWrite(device, cpcl->dither.output, cpcl->dither.out_width);
-      papplDevicePuts(device, "\r\n");
-      papplDeviceFlush(device);
-    }
-  }
+  // Nothing more to send if the output came from the cache...
+  if (cpcl->buffer.cached)
+    return (true);
+
+  // Dither the line...
+  if (!lprintDitherLine(&cpcl->dither, y, line))
+    return (true);
+
+  // The output is for the previous line...
+  if (!cpcl->vector.bitmap)
+    return (lprint_cpcl_add_row(cpcl, y - 1, cpcl->dither.output));
+
+  lprintVectorLine(&cpcl->vector, &cpcl->dither, y);
 
   return (true);
 }
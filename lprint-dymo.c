@@ -26,9 +26,12 @@ typedef struct lprint_dymo_s		// DYMO driver data
 {
   lprint_dlang_t dlang;			// Printer language
   lprint_dither_t dither;		// Dithering buffer
+  lprint_buffer_t buffer;		// Output buffer
   int		feed,			// Accumulated feed
 		min_leader,		// Leader distance for cut
 		normal_leader;		// Leader distance for top of label
+  bool		need_eject;		// Need to feed out the previous label?
+  bool		compress;		// Send compressed lines?
 } lprint_dymo_t;
 
 
@@ -102,10 +105,12 @@ static const char * const lprint_dymo_tape[] =
 // Local functions...
 //
 
+static size_t	lprint_dymo_compress(unsigned char *dst, size_t dstsize, const unsigned char *src, size_t srclen);
 static void	lprint_dymo_init(pappl_job_t *job, lprint_dymo_t *dymo);
 static bool	lprint_dymo_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_dymo_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_dymo_rendpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
+static bool	lprint_dymo_reset(lprint_dymo_t *dymo);
 static bool	lprint_dymo_rstartjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_dymo_rstartpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
 static bool	lprint_dymo_rwriteline(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned y, const unsigned char *line);
@@ -137,7 +142,7 @@ lprintDYMO(
   if (!strncmp(driver_name, "dymo_lm-", 8) || strstr(driver_name, "-tape"))
   {
     // Vendor-specific format...
-    data->format = "application/vnd.dymo-lm";
+    data->format = LPRINT_DYMO_LM_MIMETYPE;
 
     // Set pages-per-minute based on 3" of tape; not exact but
     // we need to report something...
@@ -164,7 +169,7 @@ lprintDYMO(
   else
   {
     // Vendor-specific format...
-    data->format = "application/vnd.dymo-lw";
+    data->format = LPRINT_DYMO_LW_MIMETYPE;
 
     // Set pages-per-minute based on 1.125x3.5" address labels; not exact but
     // we need to report something...
@@ -221,6 +226,45 @@ lprintDYMO(
 }
 
 
+//
+// 'lprint_dymo_compress()' - Run-length compress a raster line.
+//
+// Each output byte holds the color in bit 7 (1 = black) and the run length
+// minus 1 in the lower 7 bits.  Returns 0 if the compressed line does not
+// fit in the destination buffer.
+//
+
+static size_t				// O - Number of compressed bytes or 0
+lprint_dymo_compress(
+    unsigned char       *dst,		// I - Destination buffer
+    size_t              dstsize,	// I - Size of destination buffer
+    const unsigned char *src,		// I - Source line
+    size_t              srclen)		// I - Length of source line
+{
+  unsigned char	*dstptr = dst,		// Pointer into destination
+		*dstend = dst + dstsize;// End of destination
+  size_t	bit,			// Current bit
+		bits = 8 * srclen;	// Number of bits
+  unsigned	color,			// Current color
+		count;			// Current run length
+
+
+  for (bit = 0; bit < bits;)
+  {
+    color = (src[bit / 8] >> (7 - (bit & 7))) & 1;
+
+    for (count = 0; bit < bits && count < 128 && ((src[bit / 8] >> (7 - (bit & 7))) & 1) == color; bit ++, count ++);
+
+    if (dstptr >= dstend)
+      return (0);
+
+    *dstptr++ = (unsigned char)((color << 7) | (count - 1));
+  }
+
+  return ((size_t)(dstptr - dst));
+}
+
+
 //
 // 'lprint_dymo_init()' - Initialize DYMO driver data based on the driver name...
 //
@@ -276,13 +320,24 @@ lprint_dymo_printfile(
   ssize_t	bytes;			// Bytes read/written
   char		buffer[65536];		// Read/write buffer
   lprint_dymo_t	dymo;			// Driver data
+  bool		ret;			// Return value
 
 
-  // Initialize driver data...
+  (void)options;
+
+  // Raw data can leave the printer in any state, so always reset it and
+  // don't let the next job skip its reset...
+  memset(&dymo, 0, sizeof(dymo));
   lprint_dymo_init(job, &dymo);
+  lprintBufferInit(&dymo.buffer, device);
+  lprintSessionStart(job, "raw");
 
   // Reset the printer...
-  lprint_dymo_rstartjob(job, options, device);
+  if (!lprint_dymo_reset(&dymo))
+  {
+    lprintBufferFinish(&dymo.buffer, job);
+    return (false);
+  }
 
   // Copy the raw file...
   papplJobSetImpressions(job, 1);
@@ -290,25 +345,36 @@ lprint_dymo_printfile(
   if ((fd  = open(papplJobGetFilename(job), O_RDONLY)) < 0)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    lprintBufferFinish(&dymo.buffer, job);
     return (false);
   }
 
   while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
   {
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
+    LPRINT_PROBE2(raw_write_start, papplJobGetID(job), bytes);
+
+    if (!lprintBufferWrite(&dymo.buffer, buffer, (size_t)bytes))
     {
+      LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 0);
       papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
       close(fd);
+      lprintBufferFinish(&dymo.buffer, job);
       return (false);
     }
+
+    LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 1);
   }
   close(fd);
 
-  lprint_dymo_rstartjob(job, options, device);
+  // Reset the printer again and send everything...
+  ret = lprint_dymo_reset(&dymo);
+
+  if (!lprintBufferFinish(&dymo.buffer, job))
+    ret = false;
 
   papplJobSetImpressionsCompleted(job, 1);
 
-  return (true);
+  return (ret);
 }
 
 
@@ -326,6 +392,15 @@ lprint_dymo_rendjob(
 					// DYMO driver data
 
   (void)options;
+  (void)device;
+
+  if (dymo->need_eject)
+  {
+    // Feed the last label to the tear bar...
+    lprintBufferPuts(&dymo->buffer, "\033E");
+  }
+
+  lprintBufferFinish(&dymo->buffer, job);
 
   free(dymo);
   papplJobSetData(job, NULL);
@@ -348,28 +423,51 @@ lprint_dymo_rendpage(
   lprint_dymo_t	*dymo = (lprint_dymo_t *)papplJobGetData(job);
 					// DYMO driver data
   char		buffer[256];		// Command buffer
+  unsigned	copy;			// Current copy
 
 
   (void)page;
 
+  // Nothing more to send if the output came from the cache...
+  if (dymo->buffer.cached)
+    return (true);
+
   lprint_dymo_rwriteline(job, options, device, options->header.cupsHeight, NULL);
 
   switch (dymo->dlang)
   {
     case LPRINT_DLANG_LABEL :
+        // Defer the eject so that the next label in the job can use a short
+        // form feed instead of going to the tear bar and back...
+        dymo->need_eject = true;
         break;
 
     case LPRINT_DLANG_TAPE :
 	// Skip and cut...
-        papplDevicePrintf(device, "\033D%c", 0);
+        lprintBufferPrintf(&dymo->buffer, "\033D%c", 0);
         memset(buffer, 0x16, dymo->min_leader);
-        papplDeviceWrite(device, buffer, dymo->min_leader);
+        lprintBufferWrite(&dymo->buffer, buffer, dymo->min_leader);
+
+	// Eject/cut
+	lprintBufferPuts(&dymo->buffer, "\033E");
         break;
   }
 
-  // Eject/cut
-  papplDevicePuts(device, "\033E");
-  papplDeviceFlush(device);
+  if (dymo->buffer.recording)
+  {
+    // Send the same page data for each additional copy...
+    lprintBufferRecord(&dymo->buffer, false);
+
+    for (copy = 1; copy < options->header.NumCopies; copy ++)
+    {
+      if (dymo->dlang == LPRINT_DLANG_LABEL)
+        lprintBufferPuts(&dymo->buffer, "\033G");
+
+      lprintBufferReplay(&dymo->buffer);
+    }
+  }
+
+  lprintBufferFlush(&dymo->buffer);
 
   // Free memory and return...
   lprintDitherFree(&dymo->dither);
@@ -378,6 +476,46 @@ lprint_dymo_rendpage(
 }
 
 
+//
+// 'lprint_dymo_reset()' - Reset the printer.
+//
+
+static bool				// O - `true` on success, `false` on failure
+lprint_dymo_reset(
+    lprint_dymo_t *dymo)		// I - DYMO driver data
+{
+  char		buffer[23];		// Buffer for reset command
+
+
+  switch (dymo->dlang)
+  {
+    case LPRINT_DLANG_LABEL :
+	return (lprintBufferPuts(&dymo->buffer, "\033\033\033\033\033\033\033\033\033\033"
+						"\033\033\033\033\033\033\033\033\033\033"
+						"\033\033\033\033\033\033\033\033\033\033"
+						"\033\033\033\033\033\033\033\033\033\033"
+						"\033\033\033\033\033\033\033\033\033\033"
+						"\033\033\033\033\033\033\033\033\033\033"
+						"\033\033\033\033\033\033\033\033\033\033"
+						"\033\033\033\033\033\033\033\033\033\033"
+						"\033\033\033\033\033\033\033\033\033\033"
+						"\033\033\033\033\033\033\033\033\033\033"
+						"\033@"));
+
+    case LPRINT_DLANG_TAPE :
+        // Send nul bytes to clear input buffer...
+        memset(buffer, 0, sizeof(buffer));
+        if (!lprintBufferWrite(&dymo->buffer, buffer, sizeof(buffer)))
+          return (false);
+
+        // Set tape color to black on white...
+        return (lprintBufferPrintf(&dymo->buffer, "\033C%c", 0));
+  }
+
+  return (true);
+}
+
+
 //
 // 'lprint_dymo_rstartjob()' - Start a job.
 //
@@ -390,43 +528,24 @@ lprint_dymo_rstartjob(
 {
   lprint_dymo_t		*dymo = (lprint_dymo_t *)calloc(1, sizeof(lprint_dymo_t));
 					// DYMO driver data
-  char			buffer[23];	// Buffer for reset command
 
 
-  (void)options;
-
   // Initialize driver data...
   lprint_dymo_init(job, dymo);
 
   papplJobSetData(job, dymo);
+  lprintBufferInit(&dymo->buffer, device);
 
-  // Reset the printer...
-  switch (dymo->dlang)
-  {
-    case LPRINT_DLANG_LABEL :
-	papplDevicePuts(device, "\033\033\033\033\033\033\033\033\033\033"
-				"\033\033\033\033\033\033\033\033\033\033"
-				"\033\033\033\033\033\033\033\033\033\033"
-				"\033\033\033\033\033\033\033\033\033\033"
-				"\033\033\033\033\033\033\033\033\033\033"
-				"\033\033\033\033\033\033\033\033\033\033"
-				"\033\033\033\033\033\033\033\033\033\033"
-				"\033\033\033\033\033\033\033\033\033\033"
-				"\033\033\033\033\033\033\033\033\033\033"
-				"\033\033\033\033\033\033\033\033\033\033"
-				"\033@");
-        break;
-
-    case LPRINT_DLANG_TAPE :
-        // Send nul bytes to clear input buffer...
-        memset(buffer, 0, sizeof(buffer));
-        papplDeviceWrite(device, buffer, sizeof(buffer));
+  // Compress label lines unless the link is fast...
+  if (dymo->dlang == LPRINT_DLANG_LABEL)
+    dymo->compress = lprintLinkCompress(job, "compressed lines", "uncompressed lines");
 
-        // Set tape color to black on white...
-        papplDevicePrintf(device, "\033C%c", 0);
-        break;
-  }
+  // Reset the printer unless it just finished another job...
+  if (!lprintSessionStart(job, NULL))
+    lprint_dymo_reset(dymo);
 
+  // Send the cached output for identical jobs...
+  lprintCacheStart(&dymo->buffer, job, options);
 
   return (true);
 }
@@ -457,6 +576,10 @@ lprint_dymo_rstartpage(
 
   (void)page;
 
+  // Nothing more to send if the output came from the cache...
+  if (dymo->buffer.cached)
+    return (true);
+
   if (options->header.cupsWidth > 2048)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Raster data too large for printer.");
@@ -471,13 +594,24 @@ lprint_dymo_rstartpage(
 
   dymo->feed = 0;
 
+  if (dymo->need_eject)
+  {
+    // Short form feed to the top of this label...
+    lprintBufferPuts(&dymo->buffer, "\033G");
+    dymo->need_eject = false;
+  }
+
+  // Record the label so copies can be sent without dithering it again...
+  if (options->header.NumCopies > 1)
+    lprintBufferRecord(&dymo->buffer, true);
+
   switch (dymo->dlang)
   {
     case LPRINT_DLANG_LABEL :
-	papplDevicePrintf(device, "\033Q%c%c", 0, 0);
-	papplDevicePrintf(device, "\033B%c", 0);
-	papplDevicePrintf(device, "\033L%c%c", options->header.cupsHeight >> 8, options->header.cupsHeight);
-	papplDevicePrintf(device, "\033D%c", dymo->dither.out_width);
+	lprintBufferPrintf(&dymo->buffer, "\033Q%c%c", 0, 0);
+	lprintBufferPrintf(&dymo->buffer, "\033B%c", 0);
+	lprintBufferPrintf(&dymo->buffer, "\033L%c%c", options->header.cupsHeight >> 8, options->header.cupsHeight);
+	lprintBufferPrintf(&dymo->buffer, "\033D%c", dymo->dither.out_width);
 
 	papplPrinterGetDriverData(papplJobGetPrinter(job), &data);
 
@@ -494,26 +628,26 @@ lprint_dymo_rstartpage(
 	  i = !strcmp(options->media.source, "alternate-roll");
 	}
 
-	papplDevicePrintf(device, "\033q%d", i + 1);
+	lprintBufferPrintf(&dymo->buffer, "\033q%d", i + 1);
 
 	if (darkness < 0)
 	  darkness = 0;
 	else if (darkness > 100)
 	  darkness = 100;
 
-	papplDevicePrintf(device, "\033%c", density[3 * darkness / 100]);
+	lprintBufferPrintf(&dymo->buffer, "\033%c", density[3 * darkness / 100]);
 	break;
 
     case LPRINT_DLANG_TAPE :
         // Set line width...
-        papplDevicePrintf(device, "\033D%c", 0);
+        lprintBufferPrintf(&dymo->buffer, "\033D%c", 0);
 
         // Feed for the leader...
 	memset(buffer, 0x16, dymo->normal_leader);
-	papplDeviceWrite(device, buffer, dymo->normal_leader);
+	lprintBufferWrite(&dymo->buffer, buffer, dymo->normal_leader);
 
         // Set indentation...
-        papplDevicePrintf(device, "\033B%c", 0);
+        lprintBufferPrintf(&dymo->buffer, "\033B%c", 0);
         break;
   }
 
@@ -536,7 +670,13 @@ lprint_dymo_rwriteline(
   lprint_dymo_t		*dymo = (lprint_dymo_t *)papplJobGetData(job);
 					// DYMO driver data
   unsigned char		byte;		// Byte to write
+  unsigned char		comp[256];	// Compressed line
+  size_t		comp_len = 0;	// Length of compressed line
+
 
+  // Nothing more to send if the output came from the cache...
+  if (dymo->buffer.cached)
+    return (true);
 
   if (!lprintDitherLine(&dymo->dither, y, line))
     return (true);
@@ -552,18 +692,30 @@ lprint_dymo_rwriteline(
 	  {
 	    while (dymo->feed > 255)
 	    {
-	      papplDevicePrintf(device, "\033f\001%c", 255);
+	      lprintBufferPrintf(&dymo->buffer, "\033f\001%c", 255);
 	      dymo->feed -= 255;
 	    }
 
-	    papplDevicePrintf(device, "\033f\001%c", dymo->feed);
+	    lprintBufferPrintf(&dymo->buffer, "\033f\001%c", dymo->feed);
 	    dymo->feed = 0;
 	  }
 
-	  // Then write the non-blank line...
-	  byte = 0x16;
-	  papplDeviceWrite(device, &byte, 1);
-	  papplDeviceWrite(device, dymo->dither.output, dymo->dither.out_width);
+	  // Then write the non-blank line, compressed if that is shorter...
+	  if (dymo->compress)
+	    comp_len = lprint_dymo_compress(comp, dymo->dither.out_width < sizeof(comp) ? dymo->dither.out_width - 1 : sizeof(comp), dymo->dither.output, dymo->dither.out_width);
+
+	  if (comp_len > 0)
+	  {
+	    byte = 0x17;
+	    lprintBufferWrite(&dymo->buffer, &byte, 1);
+	    lprintBufferWrite(&dymo->buffer, comp, comp_len);
+	  }
+	  else
+	  {
+	    byte = 0x16;
+	    lprintBufferWrite(&dymo->buffer, &byte, 1);
+	    lprintBufferWrite(&dymo->buffer, dymo->dither.output, dymo->dither.out_width);
+	  }
 	  break;
 
       case LPRINT_DLANG_TAPE :
@@ -571,22 +723,22 @@ lprint_dymo_rwriteline(
 	  {
 	    unsigned char buffer[256];	// Write buffer
 
-            papplDevicePrintf(device, "\033D%c", 0);
+            lprintBufferPrintf(&dymo->buffer, "\033D%c", 0);
 	    memset(buffer, 0x16, sizeof(buffer));
 	    while (dymo->feed > 255)
 	    {
-	      papplDeviceWrite(device, buffer, sizeof(buffer));
+	      lprintBufferWrite(&dymo->buffer, buffer, sizeof(buffer));
 	      dymo->feed -= 256;
 	    }
 
             if (dymo->feed > 0)
             {
-	      papplDeviceWrite(device, buffer, dymo->feed);
+	      lprintBufferWrite(&dymo->buffer, buffer, dymo->feed);
 	      dymo->feed = 0;
 	    }
 	  }
-	  papplDevicePrintf(device, "\033D%c\026", dymo->dither.out_width);
-	  papplDeviceWrite(device, dymo->dither.output, dymo->dither.out_width);
+	  lprintBufferPrintf(&dymo->buffer, "\033D%c\026", dymo->dither.out_width);
+	  lprintBufferWrite(&dymo->buffer, dymo->dither.output, dymo->dither.out_width);
           break;
     }
   }
@@ -0,0 +1,1522 @@
+//
+// Label printer emulator for LPrint, a Label Printer Application
+//
+// Usage:
+//
+//   ./lprint-emulator [OPTIONS] LANGUAGE
+//
+// Listens for raw socket connections (socket://localhost:9100 by default),
+// interprets the Brother, DYMO, EPL2, SII, TSPL, or ZPL data sent by the
+// corresponding LPrint driver, answers status queries, and optionally writes
+// the printed labels to PWG raster files.  The link bandwidth, print speed,
+// and receive buffer size can be limited to approximate serial, USB, and
+// network printers when measuring labels per minute.
+//
+// Copyright © 2023 by Michael R Sweet
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include "lprint.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+
+//
+// Local types...
+//
+
+typedef enum lprint_elang_e		// Emulated command languages
+{
+  LPRINT_ELANG_BROTHER,			// Brother raster
+  LPRINT_ELANG_DYMO,			// DYMO LabelWriter/LabelManager
+  LPRINT_ELANG_EPL2,			// Eltron EPL2
+  LPRINT_ELANG_SII,			// Seiko Instruments SLP
+  LPRINT_ELANG_TSPL,			// TSC TSPL
+  LPRINT_ELANG_ZPL			// Zebra ZPL
+} lprint_elang_t;
+
+typedef struct lprint_emu_s		// Emulator data
+{
+  // Configuration
+  lprint_elang_t	lang;		// Command language
+  unsigned		dpi;		// Resolution in dots per inch
+  double		ips;		// Print speed in inches per second (0 = unlimited)
+  size_t		bandwidth,	// Link bandwidth in bytes per second (0 = unlimited)
+			bufsize;	// Receive buffer size in bytes
+  const char		*prefix;	// Output filename prefix or `NULL`
+  bool			verbose;	// Show commands?
+
+  // Connection
+  int			fd;		// Client connection
+  unsigned		number;		// Connection number
+  int			ras_fd;		// Raster output file
+  cups_raster_t		*ras;		// Raster output stream
+  size_t		total_bytes;	// Bytes received
+  unsigned		labels;		// Labels printed
+  double		start,		// Start of connection
+			print_time;	// Simulated print time
+
+  // Page image
+  unsigned char		*bits;		// Page bitmap (1 = black)
+  unsigned		wbytes,		// Bytes per line
+			alloc_height,	// Allocated lines
+			width,		// Width in dots
+			height,		// Height in dots
+			page_width,	// Configured label width in dots
+			length;		// Configured label length in dots
+  unsigned		x,		// Current X offset in dots
+			y;		// Current line
+  unsigned		copies;		// Copies to print
+
+  // Binary data (EPL2 GW, TSPL BITMAP, ZPL ~DG)
+  size_t		data_remaining;	// Bytes of binary data remaining
+  unsigned		data_x,		// X offset for binary data
+			data_y,		// Y offset for binary data
+			data_wbytes,	// Bytes per line for binary data
+			data_col,	// Current column
+			data_row;	// Current row
+  bool			data_invert;	// Invert binary data (1 = white)?
+
+  // Language state
+  unsigned		line_bytes,	// Bytes per line (DYMO ESC D)
+			indent;		// Indentation in bytes (DYMO ESC B)
+  bool			compressed;	// PackBits rows (Brother M 2)?
+  unsigned char		*last_line;	// Last line (SII REPEAT)
+  size_t		last_bytes;	// Bytes in last line
+  unsigned char		*graphic;	// Stored ZPL graphic
+  size_t		graphic_size,	// Size of ZPL graphic
+			graphic_nibble;	// Current nibble in ZPL graphic
+  unsigned		graphic_bpr,	// Bytes per row in ZPL graphic
+			graphic_repeat;	// Pending ZPL repeat count
+  bool			in_graphic;	// Reading ZPL graphic data?
+} lprint_emu_t;
+
+
+//
+// Local globals...
+//
+
+static const char * const lprint_elangs[] =
+{					// Language names
+  "brother",
+  "dymo",
+  "epl2",
+  "sii",
+  "tspl",
+  "zpl"
+};
+
+
+//
+// Local functions...
+//
+
+static void	draw_bits(lprint_emu_t *emu, unsigned x, unsigned y, const unsigned char *data, size_t bytes, bool invert);
+static void	draw_rect(lprint_emu_t *emu, unsigned x, unsigned y, unsigned width, unsigned height);
+static size_t	get_line(const unsigned char *data, size_t bytes, bool eof, char *line, size_t linesize);
+static double	get_time(void);
+static bool	page_ensure(lprint_emu_t *emu, unsigned width, unsigned height);
+static void	page_print(lprint_emu_t *emu);
+static void	page_reset(lprint_emu_t *emu);
+static size_t	parse_binary(lprint_emu_t *emu, const unsigned char *data, size_t bytes);
+static size_t	parse_brother(lprint_emu_t *emu, const unsigned char *data, size_t bytes, bool eof);
+static size_t	parse_dymo(lprint_emu_t *emu, const unsigned char *data, size_t bytes, bool eof);
+static size_t	parse_epl2(lprint_emu_t *emu, const unsigned char *data, size_t bytes, bool eof);
+static size_t	parse_sii(lprint_emu_t *emu, const unsigned char *data, size_t bytes, bool eof);
+static size_t	parse_tspl(lprint_emu_t *emu, const unsigned char *data, size_t bytes, bool eof);
+static size_t	parse_zpl(lprint_emu_t *emu, const unsigned char *data, size_t bytes, bool eof);
+static size_t	parse_zpl_graphic(lprint_emu_t *emu, const unsigned char *data, size_t bytes);
+static void	respond(lprint_emu_t *emu, const void *data, size_t bytes);
+static void	run_client(lprint_emu_t *emu);
+static void	usage(int status);
+
+
+//
+// 'main()' - Main entry for the emulator.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int			i;		// Looping var
+  const char		*opt;		// Current option
+  lprint_emu_t		emu;		// Emulator data
+  int			port = 9100,	// Port number
+			lfd,		// Listening socket
+			val;		// Socket option value
+  struct sockaddr_in	addr;		// Listen address
+  bool			have_lang = false;
+					// Was the language specified?
+
+
+  // Parse command-line...
+  memset(&emu, 0, sizeof(emu));
+  emu.dpi     = 203;
+  emu.bufsize = 65536;
+  emu.ras_fd  = -1;
+
+  for (i = 1; i < argc; i ++)
+  {
+    if (!strcmp(argv[i], "--help"))
+    {
+      usage(0);
+    }
+    else if (argv[i][0] == '-' && argv[i][1] != '-')
+    {
+      for (opt = argv[i] + 1; *opt; opt ++)
+      {
+        switch (*opt)
+        {
+          case 'B' : // -B BUFFER-SIZE
+              i ++;
+              if (i >= argc || (emu.bufsize = strtoul(argv[i], NULL, 10)) < 1024)
+              {
+                fputs("lprint-emulator: Expected buffer size of at least 1024 bytes after '-B'.\n", stderr);
+                usage(1);
+              }
+              break;
+
+          case 'b' : // -b BYTES-PER-SECOND
+              i ++;
+              if (i >= argc)
+              {
+                fputs("lprint-emulator: Missing bandwidth after '-b'.\n", stderr);
+                usage(1);
+              }
+              emu.bandwidth = strtoul(argv[i], NULL, 10);
+              break;
+
+          case 'o' : // -o PREFIX
+              i ++;
+              if (i >= argc)
+              {
+                fputs("lprint-emulator: Missing output prefix after '-o'.\n", stderr);
+                usage(1);
+              }
+              emu.prefix = argv[i];
+              break;
+
+          case 'p' : // -p PORT
+              i ++;
+              if (i >= argc || (port = atoi(argv[i])) < 1 || port > 65535)
+              {
+                fputs("lprint-emulator: Expected port number after '-p'.\n", stderr);
+                usage(1);
+              }
+              break;
+
+          case 'r' : // -r DPI
+              i ++;
+              if (i >= argc || (emu.dpi = (unsigned)atoi(argv[i])) < 100 || emu.dpi > 1200)
+              {
+                fputs("lprint-emulator: Expected resolution after '-r'.\n", stderr);
+                usage(1);
+              }
+              break;
+
+          case 's' : // -s INCHES-PER-SECOND
+              i ++;
+              if (i >= argc || (emu.ips = strtod(argv[i], NULL)) < 0.0)
+              {
+                fputs("lprint-emulator: Expected print speed after '-s'.\n", stderr);
+                usage(1);
+              }
+              break;
+
+          case 'v' : // -v (verbose)
+              emu.verbose = true;
+              break;
+
+          default :
+              fprintf(stderr, "lprint-emulator: Unknown option '-%c'.\n", *opt);
+              usage(1);
+        }
+      }
+    }
+    else if (!have_lang)
+    {
+      for (emu.lang = LPRINT_ELANG_BROTHER; emu.lang <= LPRINT_ELANG_ZPL; emu.lang ++)
+      {
+        if (!strcmp(argv[i], lprint_elangs[emu.lang]))
+          break;
+      }
+
+      if (emu.lang > LPRINT_ELANG_ZPL)
+      {
+        fprintf(stderr, "lprint-emulator: Unknown language '%s'.\n", argv[i]);
+        usage(1);
+      }
+
+      have_lang = true;
+    }
+    else
+    {
+      fprintf(stderr, "lprint-emulator: Unknown argument '%s'.\n", argv[i]);
+      usage(1);
+    }
+  }
+
+  if (!have_lang)
+    usage(1);
+
+  // Listen for connections on the loopback interface...
+  signal(SIGPIPE, SIG_IGN);
+
+  if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+  {
+    perror("lprint-emulator: Unable to create socket");
+    return (1);
+  }
+
+  val = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port        = htons((unsigned short)port);
+
+  if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) || listen(lfd, 1))
+  {
+    perror("lprint-emulator: Unable to listen for connections");
+    close(lfd);
+    return (1);
+  }
+
+  printf("Emulating %s printer at %udpi on socket://localhost:%d\n", lprint_elangs[emu.lang], emu.dpi, port);
+  fflush(stdout);
+
+  // Print jobs one at a time like a real printer...
+  for (;;)
+  {
+    if ((emu.fd = accept(lfd, NULL, NULL)) < 0)
+    {
+      perror("lprint-emulator: Unable to accept connection");
+      continue;
+    }
+
+    // Limit the receive buffer so the sender sees the printer's flow control...
+    val = (int)emu.bufsize;
+    setsockopt(emu.fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+
+    emu.number ++;
+    run_client(&emu);
+    close(emu.fd);
+  }
+
+  return (0);
+}
+
+
+//
+// 'draw_bits()' - Draw a row of bitmap data.
+//
+
+static void
+draw_bits(lprint_emu_t        *emu,	// I - Emulator data
+          unsigned            x,	// I - X offset in dots
+          unsigned            y,	// I - Y offset in dots
+          const unsigned char *data,	// I - Bitmap data
+          size_t              bytes,	// I - Number of bytes
+          bool                invert)	// I - Invert data (1 = white)?
+{
+  unsigned char	*row,			// Pointer to page row
+		byte;			// Current byte
+  unsigned	shift = x & 7;		// Bit shift
+
+
+  if (!page_ensure(emu, x + 8 * (unsigned)bytes, y + 1))
+    return;
+
+  for (row = emu->bits + y * emu->wbytes + x / 8; bytes > 0; bytes --, data ++, row ++)
+  {
+    byte = invert ? (unsigned char)~*data : *data;
+
+    if (!byte)
+      continue;
+
+    row[0] |= byte >> shift;
+    if (shift)
+      row[1] |= (unsigned char)(byte << (8 - shift));
+  }
+}
+
+
+//
+// 'draw_rect()' - Draw a solid black rectangle.
+//
+
+static void
+draw_rect(lprint_emu_t *emu,		// I - Emulator data
+          unsigned     x,		// I - X offset in dots
+          unsigned     y,		// I - Y offset in dots
+          unsigned     width,		// I - Width in dots
+          unsigned     height)		// I - Height in dots
+{
+  unsigned	xx, yy;			// Looping vars
+
+
+  if (!width || !height || !page_ensure(emu, x + width, y + height))
+    return;
+
+  for (yy = y; yy < (y + height); yy ++)
+  {
+    for (xx = x; xx < (x + width); xx ++)
+      emu->bits[yy * emu->wbytes + xx / 8] |= 128 >> (xx & 7);
+  }
+}
+
+
+//
+// 'get_line()' - Get a text command line.
+//
+// Returns the number of bytes consumed or 0 if the line is incomplete.
+//
+
+static size_t				// O - Bytes consumed
+get_line(const unsigned char *data,	// I - Input data
+         size_t              bytes,	// I - Number of bytes
+         bool                eof,	// I - End of input?
+         char                *line,	// I - Line buffer
+         size_t              linesize)	// I - Size of line buffer
+{
+  const unsigned char	*ptr,		// Pointer into data
+			*end = data + bytes;
+					// End of data
+  char			*lineptr = line,// Pointer into line
+			*lineend = line + linesize - 1;
+					// End of line buffer
+
+
+  for (ptr = data; ptr < end && *ptr != '\n'; ptr ++)
+  {
+    if (*ptr != '\r' && lineptr < lineend)
+      *lineptr++ = (char)*ptr;
+  }
+
+  *lineptr = '\0';
+
+  if (ptr < end)
+    return ((size_t)(ptr - data + 1));
+  else if (eof)
+    return (bytes);
+  else
+    return (0);
+}
+
+
+//
+// 'get_time()' - Get the current monotonic time in seconds.
+//
+
+static double				// O - Time in seconds
+get_time(void)
+{
+  struct timespec	curtime;	// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &curtime);
+
+  return (curtime.tv_sec + 0.000000001 * curtime.tv_nsec);
+}
+
+
+//
+// 'page_ensure()' - Make sure the page image covers the given size.
+//
+
+static bool				// O - `true` on success, `false` on failure
+page_ensure(lprint_emu_t *emu,		// I - Emulator data
+            unsigned     width,		// I - Minimum width in dots
+            unsigned     height)	// I - Minimum height in dots
+{
+  unsigned	wbytes = (width + 7) / 8 + 1;
+					// Bytes per line (with room for shifts)
+  unsigned char	*bits;			// New page bitmap
+  unsigned	y;			// Current line
+
+
+  if (width > 65536 || height > 65536)
+    return (false);
+
+  if (wbytes > emu->wbytes || height > emu->alloc_height)
+  {
+    // Grow the bitmap, doubling the height to avoid reallocating every line...
+    unsigned new_wbytes = wbytes > emu->wbytes ? wbytes : emu->wbytes;
+    unsigned new_height = height > emu->alloc_height ? (height > 2 * emu->alloc_height ? height : 2 * emu->alloc_height) : emu->alloc_height;
+
+    if (new_height == 0)
+      new_height = 1;
+
+    if ((bits = calloc(new_height, new_wbytes)) == NULL)
+      return (false);
+
+    for (y = 0; y < emu->height; y ++)
+      memcpy(bits + y * new_wbytes, emu->bits + y * emu->wbytes, emu->wbytes);
+
+    free(emu->bits);
+    emu->bits         = bits;
+    emu->wbytes       = new_wbytes;
+    emu->alloc_height = new_height;
+  }
+
+  if (width > emu->width)
+    emu->width = width;
+  if (height > emu->height)
+    emu->height = height;
+
+  return (true);
+}
+
+
+//
+// 'page_print()' - "Print" the current page.
+//
+
+static void
+page_print(lprint_emu_t *emu)		// I - Emulator data
+{
+  unsigned		copy,		// Current copy
+			y,		// Current line
+			height;		// Label height
+  double		seconds;	// Simulated print time
+  cups_page_header_t	header;		// Page header
+
+
+  if (!page_ensure(emu, emu->page_width, emu->length))
+    return;
+
+  height = emu->height;
+
+  if (!emu->copies)
+    emu->copies = 1;
+
+  if (emu->verbose)
+    printf("  Label: %ux%u, %u cop%s\n", emu->width, height, emu->copies, emu->copies == 1 ? "y" : "ies");
+
+  if (emu->ras && emu->width > 0 && height > 0)
+  {
+    memset(&header, 0, sizeof(header));
+    header.HWResolution[0]  = emu->dpi;
+    header.HWResolution[1]  = emu->dpi;
+    header.NumCopies        = 1;
+    header.PageSize[0]      = 72 * emu->width / emu->dpi;
+    header.PageSize[1]      = 72 * height / emu->dpi;
+    header.cupsWidth        = emu->width;
+    header.cupsHeight       = height;
+    header.cupsBitsPerColor = 1;
+    header.cupsBitsPerPixel = 1;
+    header.cupsBytesPerLine = (emu->width + 7) / 8;
+    header.cupsColorOrder   = CUPS_ORDER_CHUNKED;
+    header.cupsColorSpace   = CUPS_CSPACE_K;
+    header.cupsNumColors    = 1;
+
+    for (copy = 0; copy < emu->copies; copy ++)
+    {
+      cupsRasterWriteHeader(emu->ras, &header);
+
+      for (y = 0; y < height; y ++)
+        cupsRasterWritePixels(emu->ras, emu->bits + y * emu->wbytes, header.cupsBytesPerLine);
+    }
+  }
+
+  emu->labels += emu->copies;
+
+  // Simulate the time needed to print the labels - we stop reading while
+  // printing so that the receive buffer fills up like on a real printer...
+  if (emu->ips > 0.0)
+  {
+    seconds = emu->copies * height / (emu->ips * emu->dpi);
+    emu->print_time += seconds;
+    usleep((useconds_t)(1000000.0 * seconds));
+  }
+
+  page_reset(emu);
+}
+
+
+//
+// 'page_reset()' - Clear the page image.
+//
+
+static void
+page_reset(lprint_emu_t *emu)		// I - Emulator data
+{
+  if (emu->bits)
+    memset(emu->bits, 0, (size_t)emu->wbytes * emu->alloc_height);
+
+  emu->width  = 0;
+  emu->height = 0;
+  emu->x      = 0;
+  emu->y      = 0;
+  emu->copies = 1;
+}
+
+
+//
+// 'parse_binary()' - Draw pending EPL2/TSPL bitmap data.
+//
+
+static size_t				// O - Bytes consumed
+parse_binary(lprint_emu_t        *emu,	// I - Emulator data
+             const unsigned char *data,	// I - Input data
+             size_t              bytes)	// I - Number of bytes
+{
+  size_t	count,			// Bytes to draw on this row
+		total = 0;		// Total bytes consumed
+
+
+  while (bytes > 0 && emu->data_remaining > 0)
+  {
+    if ((count = emu->data_wbytes - emu->data_col) > bytes)
+      count = bytes;
+
+    draw_bits(emu, emu->data_x + 8 * emu->data_col, emu->data_y + emu->data_row, data, count, emu->data_invert);
+
+    data                 += count;
+    bytes                -= count;
+    total                += count;
+    emu->data_remaining  -= count;
+    emu->data_col        += (unsigned)count;
+
+    if (emu->data_col >= emu->data_wbytes)
+    {
+      emu->data_col = 0;
+      emu->data_row ++;
+    }
+  }
+
+  return (total);
+}
+
+
+//
+// 'parse_brother()' - Parse Brother raster commands.
+//
+
+static size_t				// O - Bytes consumed
+parse_brother(lprint_emu_t        *emu,	// I - Emulator data
+              const unsigned char *data,// I - Input data
+              size_t              bytes,// I - Number of bytes
+              bool                eof)	// I - End of input?
+{
+  size_t		count,		// Data bytes for row
+			i;		// Looping var
+  unsigned char		row[1024],	// Decompressed row
+			*rowptr,	// Pointer into row
+			*rowend;	// End of row
+  const unsigned char	*ptr,		// Pointer into data
+			*end;		// End of data
+  int			n;		// PackBits count
+  static unsigned char	status[32] =	// Status response
+  {
+    0x80, 0x20, 'B', '0', '4', '0', 0, 0, 0, 0, 62, 0x0a, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  };
+
+
+  (void)eof;
+
+  switch (data[0])
+  {
+    case 0x0c : // FF - print and chain to the next label
+    case 0x1a : // ^Z - print and feed
+        page_print(emu);
+        return (1);
+
+    case 0x1b : // ESC
+        if (bytes < 2)
+          return (0);
+
+        if (data[1] == '@')
+          return (2);
+
+        if (data[1] != 'i')
+          return (2);
+
+        if (bytes < 3)
+          return (0);
+
+        switch (data[2])
+        {
+          case 'S' : // Status information request
+              respond(emu, status, sizeof(status));
+              return (3);
+
+          case 'd' : // Margin
+              return (bytes < 5 ? 0 : 5);
+
+          case 'z' : // Print information
+              if (bytes < 13)
+                return (0);
+
+              emu->length = (unsigned)(data[7] | (data[8] << 8) | (data[9] << 16) | (data[10] << 24));
+              return (13);
+
+          default : // ESC i a, A, D, K, M, etc.
+              return (bytes < 4 ? 0 : 4);
+        }
+
+    case 'M' : // Compression mode
+        if (bytes < 2)
+          return (0);
+
+        emu->compressed = data[1] == 2;
+        return (2);
+
+    case 'G' : // Raster row
+    case 'g' :
+        if (bytes < 3)
+          return (0);
+
+        // QL-series printers send 0,count while PT-series printers send a
+        // little-endian count...
+        if (data[1] == 0)
+          count = data[2];
+        else
+          count = data[1] | (data[2] << 8);
+
+        if (bytes < (3 + count))
+          return (0);
+
+        if (emu->compressed)
+        {
+          // Decompress PackBits data...
+          for (ptr = data + 3, end = ptr + count, rowptr = row, rowend = row + sizeof(row); ptr < end && rowptr < rowend;)
+          {
+            if ((n = (signed char)*ptr++) >= 0)
+            {
+              // Literal run
+              for (n ++; n > 0 && ptr < end && rowptr < rowend; n --)
+                *rowptr++ = *ptr++;
+            }
+            else if (n > -128 && ptr < end)
+            {
+              // Repeated byte
+              for (n = 1 - n; n > 0 && rowptr < rowend; n --)
+                *rowptr++ = *ptr;
+
+              ptr ++;
+            }
+          }
+
+          i = (size_t)(rowptr - row);
+        }
+        else
+        {
+          i = count < sizeof(row) ? count : sizeof(row);
+          memcpy(row, data + 3, i);
+        }
+
+        draw_bits(emu, 0, emu->y ++, row, i, false);
+        return (3 + count);
+
+    case 'Z' : // Blank raster row
+        emu->y ++;
+        page_ensure(emu, emu->width, emu->y);
+        return (1);
+
+    default : // NUL and other bytes are ignored
+        return (1);
+  }
+}
+
+
+//
+// 'parse_dymo()' - Parse DYMO commands.
+//
+
+static size_t				// O - Bytes consumed
+parse_dymo(lprint_emu_t        *emu,	// I - Emulator data
+           const unsigned char *data,	// I - Input data
+           size_t              bytes,	// I - Number of bytes
+           bool                eof)	// I - End of input?
+{
+  size_t	i;			// Looping var
+  unsigned char	status = 0;		// Status response
+
+
+  (void)eof;
+
+  if (data[0] == 0x16)
+  {
+    // SYN - Raster line, or a blank line when the width is 0...
+    if (bytes < (1 + emu->line_bytes))
+      return (0);
+
+    if (emu->line_bytes > 0)
+      draw_bits(emu, 8 * emu->indent, emu->y, data + 1, emu->line_bytes, false);
+
+    emu->y ++;
+    page_ensure(emu, emu->width, emu->y);
+
+    return (1 + emu->line_bytes);
+  }
+  else if (data[0] == 0x17)
+  {
+    // ETB - Compressed raster line, runs of (color << 7) | (count - 1)...
+    unsigned	x,			// Current dot
+		count,			// Run length
+		width = 8 * emu->line_bytes;
+					// Dots per line
+
+    for (i = 1, x = 0; x < width && i < bytes; i ++, x += count)
+      count = (data[i] & 0x7f) + 1u;
+
+    if (x < width)
+      return (eof ? bytes : 0);
+
+    for (i = 1, x = 0; x < width; i ++, x += count)
+    {
+      count = (data[i] & 0x7f) + 1u;
+
+      if (data[i] & 0x80)
+        draw_rect(emu, 8 * emu->indent + x, emu->y, x + count > width ? width - x : count, 1);
+    }
+
+    emu->y ++;
+    page_ensure(emu, emu->width, emu->y);
+
+    return (i);
+  }
+  else if (data[0] != 0x1b)
+  {
+    // Ignore NUL and other bytes...
+    return (1);
+  }
+
+  // Skip the run of ESC characters used to resynchronize the printer...
+  for (i = 1; i < bytes && data[i] == 0x1b; i ++);
+
+  if (i >= bytes)
+    return (eof ? bytes : 0);
+
+  switch (data[i])
+  {
+    case 'A' : // Status request
+        respond(emu, &status, 1);
+        return (i + 1);
+
+    case 'B' : // Dot tab
+        if (bytes < (i + 2))
+          return (0);
+
+        emu->indent = data[i + 1];
+        return (i + 2);
+
+    case 'D' : // Bytes per line
+        if (bytes < (i + 2))
+          return (0);
+
+        emu->line_bytes = data[i + 1];
+        return (i + 2);
+
+    case 'E' : // Form feed
+    case 'G' : // Short form feed
+        if (emu->y > 0)
+          page_print(emu);
+        return (i + 1);
+
+    case 'L' : // Label length
+        if (bytes < (i + 3))
+          return (0);
+
+        emu->length = (unsigned)((data[i + 1] << 8) | data[i + 2]);
+        return (i + 3);
+
+    case 'Q' : // Top offset
+    case 'f' : // Feed lines
+        if (bytes < (i + 3))
+          return (0);
+
+        if (data[i] == 'f')
+        {
+          emu->y += data[i + 2];
+          page_ensure(emu, emu->width, emu->y);
+        }
+        return (i + 3);
+
+    case 'C' : // Tape color
+    case 'q' : // Roll selection
+    case 'y' : // Speed
+        return (bytes < (i + 2) ? 0 : i + 2);
+
+    default : // ESC @, density, etc.
+        return (i + 1);
+  }
+}
+
+
+//
+// 'parse_epl2()' - Parse EPL2 commands.
+//
+
+static size_t				// O - Bytes consumed
+parse_epl2(lprint_emu_t        *emu,	// I - Emulator data
+           const unsigned char *data,	// I - Input data
+           size_t              bytes,	// I - Number of bytes
+           bool                eof)	// I - End of input?
+{
+  size_t	count;			// Bytes consumed
+  char		line[1024];		// Command line
+  unsigned	x, y, w, h;		// Command values
+
+
+  if ((count = get_line(data, bytes, eof, line, sizeof(line))) == 0)
+    return (0);
+
+  if (emu->verbose && line[0])
+    printf("  %s\n", line);
+
+  if (!strcmp(line, "N"))
+  {
+    // Clear image buffer...
+    page_reset(emu);
+  }
+  else if (sscanf(line, "GW%u,%u,%u,%u", &x, &y, &w, &h) == 4)
+  {
+    // Graphic write - binary data follows the command line...
+    emu->data_remaining = (size_t)w * h;
+    emu->data_x         = x;
+    emu->data_y         = y;
+    emu->data_wbytes    = w;
+    emu->data_col       = 0;
+    emu->data_row       = 0;
+    emu->data_invert    = true;
+  }
+  else if (sscanf(line, "LO%u,%u,%u,%u", &x, &y, &w, &h) == 4)
+  {
+    // Line draw black...
+    draw_rect(emu, x, y, w, h);
+  }
+  else if (sscanf(line, "P%u", &x) == 1)
+  {
+    // Print
+    emu->copies = x;
+    page_print(emu);
+  }
+  else if (sscanf(line, "q%u", &x) == 1)
+  {
+    // Label width
+    emu->page_width = x;
+  }
+
+  return (count);
+}
+
+
+//
+// 'parse_sii()' - Parse SII SLP commands.
+//
+
+static size_t				// O - Bytes consumed
+parse_sii(lprint_emu_t        *emu,	// I - Emulator data
+          const unsigned char *data,	// I - Input data
+          size_t              bytes,	// I - Number of bytes
+          bool                eof)	// I - End of input?
+{
+  unsigned	i;			// Looping var
+  unsigned char	status = 0;		// Status response
+
+
+  (void)eof;
+
+  switch (data[0])
+  {
+    case 0x01 : // Status
+        respond(emu, &status, 1);
+        return (1);
+
+    case 0x04 : // Print line
+        if (bytes < 2 || bytes < (size_t)(2 + data[1]))
+          return (0);
+
+        draw_bits(emu, 0, emu->y ++, data + 2, data[1], false);
+
+        if ((emu->last_line = realloc(emu->last_line, data[1] + 1)) != NULL)
+        {
+          memcpy(emu->last_line, data + 2, data[1]);
+          emu->last_bytes = data[1];
+        }
+        else
+        {
+          emu->last_bytes = 0;
+        }
+        return (2 + (size_t)data[1]);
+
+    case 0x07 : // Repeat last line
+        if (bytes < 2)
+          return (0);
+
+        for (i = 0; i < data[1]; i ++)
+          draw_bits(emu, 0, emu->y ++, emu->last_line, emu->last_bytes, false);
+        return (2);
+
+    case 0x0a : // Line feed
+        emu->y ++;
+        page_ensure(emu, emu->width, emu->y);
+        return (1);
+
+    case 0x0b : // Vertical tab
+        if (bytes < 2)
+          return (0);
+
+        emu->y += data[1];
+        page_ensure(emu, emu->width, emu->y);
+        return (2);
+
+    case 0x0c : // Form feed
+        page_print(emu);
+        return (1);
+
+    case 0x03 : // Baud rate
+    case 0x06 : // Margin
+    case 0x09 : // Tab
+    case 0x0d : // Speed
+    case 0x0e : // Density
+    case 0x12 : // Model
+    case 0x16 : // Indent
+    case 0x17 : // Fine mode
+        return (bytes < 2 ? 0 : 2);
+
+    default : // NOP, reset, etc.
+        return (1);
+  }
+}
+
+
+//
+// 'parse_tspl()' - Parse TSPL commands.
+//
+
+static size_t				// O - Bytes consumed
+parse_tspl(lprint_emu_t        *emu,	// I - Emulator data
+           const unsigned char *data,	// I - Input data
+           size_t              bytes,	// I - Number of bytes
+           bool                eof)	// I - End of input?
+{
+  size_t	count,			// Bytes consumed
+		commas;			// Number of commas
+  char		line[1024];		// Command line
+  unsigned	x, y, w, h, m;		// Command values
+
+
+  if (bytes >= 7 && !memcmp(data, "BITMAP ", 7))
+  {
+    // BITMAP x,y,width,height,mode,data - find the end of the parameters...
+    for (count = 7, commas = 0; count < bytes && count < (sizeof(line) - 1) && commas < 5; count ++)
+    {
+      if (data[count] == ',')
+        commas ++;
+    }
+
+    if (commas < 5)
+      return (count >= (sizeof(line) - 1) || eof ? count : 0);
+
+    memcpy(line, data, count);
+    line[count] = '\0';
+
+    if (emu->verbose)
+      printf("  %s\n", line);
+
+    if (sscanf(line + 7, "%u,%u,%u,%u,%u", &x, &y, &w, &h, &m) == 5)
+    {
+      emu->data_remaining = (size_t)w * h;
+      emu->data_x         = x;
+      emu->data_y         = y;
+      emu->data_wbytes    = w;
+      emu->data_col       = 0;
+      emu->data_row       = 0;
+      emu->data_invert    = true;
+    }
+
+    return (count);
+  }
+
+  if ((count = get_line(data, bytes, eof, line, sizeof(line))) == 0)
+    return (0);
+
+  if (emu->verbose && line[0])
+    printf("  %s\n", line);
+
+  if (!strcmp(line, "CLS"))
+  {
+    // Clear image buffer...
+    page_reset(emu);
+  }
+  else if (sscanf(line, "BAR %u,%u,%u,%u", &x, &y, &w, &h) == 4)
+  {
+    // Solid bar...
+    draw_rect(emu, x, y, w, h);
+  }
+  else if (sscanf(line, "PRINT %u,%u", &x, &m) >= 1)
+  {
+    // Print sets of copies...
+    emu->copies = x * (strchr(line, ',') ? m : 1);
+    page_print(emu);
+  }
+  else if (sscanf(line, "SIZE %u mm,%u mm", &w, &h) == 2)
+  {
+    // Label size...
+    emu->page_width = w * emu->dpi * 10 / 254;
+    emu->length     = h * emu->dpi * 10 / 254;
+  }
+
+  return (count);
+}
+
+
+//
+// 'parse_zpl()' - Parse ZPL commands.
+//
+
+static size_t				// O - Bytes consumed
+parse_zpl(lprint_emu_t        *emu,	// I - Emulator data
+          const unsigned char *data,	// I - Input data
+          size_t              bytes,	// I - Number of bytes
+          bool                eof)	// I - End of input?
+{
+  size_t	count,			// Bytes consumed
+		commas,			// Number of commas
+		length;			// Length of parameters
+  char		cmd[1024],		// Command parameters
+		response[1024];		// Status response
+  unsigned	a, b, c;		// Command values
+  unsigned	y;			// Current row
+
+
+  // Skip whitespace between commands...
+  if (isspace(data[0] & 255))
+    return (1);
+
+  if (data[0] != '^' && data[0] != '~')
+    return (1);
+
+  if (bytes < 3)
+    return (eof ? bytes : 0);
+
+  if (data[0] == '~' && data[1] == 'D' && data[2] == 'G')
+  {
+    // ~DGname,total,bytes-per-row, - the graphic data follows...
+    for (count = 3, commas = 0; count < bytes && count < (sizeof(cmd) - 1) && commas < 3; count ++)
+    {
+      if (data[count] == ',')
+        commas ++;
+    }
+
+    if (commas < 3)
+      return (count >= (sizeof(cmd) - 1) || eof ? count : 0);
+
+    memcpy(cmd, data + 3, count - 3);
+    cmd[count - 3] = '\0';
+
+    if (emu->verbose)
+      printf("  ~DG%s\n", cmd);
+
+    if (sscanf(cmd, "%*[^,],%u,%u", &a, &b) == 2 && b > 0 && (emu->graphic = realloc(emu->graphic, a)) != NULL)
+    {
+      memset(emu->graphic, 0, a);
+      emu->graphic_size   = a;
+      emu->graphic_bpr    = b;
+      emu->graphic_nibble = 0;
+      emu->graphic_repeat = 0;
+      emu->in_graphic     = true;
+    }
+    else
+    {
+      emu->graphic_size = 0;
+    }
+
+    return (count);
+  }
+
+  // Other commands end at the next command prefix...
+  for (count = 3; count < bytes && data[count] != '^' && data[count] != '~'; count ++);
+
+  if (count >= bytes && !eof)
+    return (count >= (sizeof(cmd) - 1) ? count : 0);
+
+  if ((count - 3) < sizeof(cmd))
+  {
+    // Copy the parameters without trailing whitespace...
+    for (length = count - 3; length > 0 && isspace(data[length + 2] & 255); length --);
+
+    memcpy(cmd, data + 3, length);
+    cmd[length] = '\0';
+  }
+  else
+  {
+    cmd[0] = '\0';
+  }
+
+  if (emu->verbose)
+    printf("  %c%c%c%s\n", data[0], data[1], data[2], cmd);
+
+  if (!memcmp(data, "^XA", 3))
+  {
+    // Start format...
+    page_reset(emu);
+    emu->length = 0;
+  }
+  else if (!memcmp(data, "^XZ", 3))
+  {
+    // End format, print if anything was drawn...
+    if (emu->height > 0)
+      page_print(emu);
+  }
+  else if (!memcmp(data, "^PW", 3) && sscanf(cmd, "%u", &a) == 1)
+  {
+    // Print width...
+    emu->page_width = a;
+  }
+  else if (!memcmp(data, "^LL", 3) && sscanf(cmd, "%u", &a) == 1)
+  {
+    // Label length...
+    emu->length = a;
+  }
+  else if (!memcmp(data, "^PQ", 3) && sscanf(cmd, "%u", &a) == 1)
+  {
+    // Print quantity...
+    emu->copies = a;
+  }
+  else if (!memcmp(data, "^FO", 3) && sscanf(cmd, "%u,%u", &a, &b) == 2)
+  {
+    // Field origin...
+    emu->x = a;
+    emu->y = b;
+  }
+  else if (!memcmp(data, "^GB", 3) && sscanf(cmd, "%u,%u,%u", &a, &b, &c) == 3)
+  {
+    // Graphic box, either solid or an outline...
+    if (c >= a || c >= b)
+    {
+      draw_rect(emu, emu->x, emu->y, a, b);
+    }
+    else
+    {
+      draw_rect(emu, emu->x, emu->y, a, c);
+      draw_rect(emu, emu->x, emu->y + b - c, a, c);
+      draw_rect(emu, emu->x, emu->y, c, b);
+      draw_rect(emu, emu->x + a - c, emu->y, c, b);
+    }
+  }
+  else if (!memcmp(data, "^XG", 3) && emu->graphic_size > 0)
+  {
+    // Recall graphic...
+    for (y = 0; y < (emu->graphic_size / emu->graphic_bpr); y ++)
+      draw_bits(emu, emu->x, emu->y + y, emu->graphic + y * emu->graphic_bpr, emu->graphic_bpr, false);
+  }
+  else if (!memcmp(data, "^ID", 3))
+  {
+    // Delete graphic...
+    emu->graphic_size = 0;
+  }
+  else if (!memcmp(data, "~HI", 3))
+  {
+    // Host identification...
+    snprintf(response, sizeof(response), "\002ZD621-%udpi,V84.20.11Z,%u,8176KB\003\r\n", emu->dpi, (emu->dpi + 12) / 25);
+    respond(emu, response, strlen(response));
+  }
+  else if (!memcmp(data, "~HQES", 5))
+  {
+    // Host query error status...
+    static const char hqes[] = "\002\r\n\r\n  PRINTER STATUS                            \r\n   ERRORS:         0 00000000 00000000\r\n   WARNINGS:       0 00000000 00000000\r\n\003\r\n";
+
+    respond(emu, hqes, sizeof(hqes) - 1);
+  }
+  else if (!memcmp(data, "~HS", 3))
+  {
+    // Host status, with the label length in the first string...
+    snprintf(response, sizeof(response), "\002030,0,0,%04u,000,0,0,0,000,0,0,0\003\r\n\002000,0,0,0,0,2,4,0,00000000,1,000\003\r\n\0021234,0\003\r\n", emu->length ? emu->length : 6 * emu->dpi);
+    respond(emu, response, strlen(response));
+  }
+
+  return (count);
+}
+
+
+//
+// 'parse_zpl_graphic()' - Parse ZPL ASCII hex graphic data.
+//
+
+static size_t				// O - Bytes consumed
+parse_zpl_graphic(
+    lprint_emu_t        *emu,		// I - Emulator data
+    const unsigned char *data,		// I - Input data
+    size_t              bytes)		// I - Number of bytes
+{
+  const unsigned char	*ptr,		// Pointer into data
+			*end = data + bytes;
+					// End of data
+  size_t		nibbles = 2 * emu->graphic_size,
+					// Total nibbles in graphic
+			row_nibbles = 2 * emu->graphic_bpr,
+					// Nibbles per row
+			count;		// Repeat count
+  unsigned		value;		// Nibble value
+
+
+  for (ptr = data; ptr < end && emu->graphic_nibble < nibbles; ptr ++)
+  {
+    if (*ptr == '^' || *ptr == '~')
+    {
+      // Graphic ended early...
+      break;
+    }
+    else if (*ptr >= 'G' && *ptr <= 'Y')
+    {
+      emu->graphic_repeat += (unsigned)(*ptr - 'F');
+    }
+    else if (*ptr >= 'g' && *ptr <= 'z')
+    {
+      emu->graphic_repeat += 20 * (unsigned)(*ptr - 'f');
+    }
+    else if (isxdigit(*ptr))
+    {
+      value = isdigit(*ptr) ? (unsigned)(*ptr - '0') : (unsigned)(tolower(*ptr) - 'a' + 10);
+      count = emu->graphic_repeat ? emu->graphic_repeat : 1;
+
+      for (emu->graphic_repeat = 0; count > 0 && emu->graphic_nibble < nibbles; count --, emu->graphic_nibble ++)
+      {
+        if (emu->graphic_nibble & 1)
+          emu->graphic[emu->graphic_nibble / 2] |= value;
+        else
+          emu->graphic[emu->graphic_nibble / 2] |= value << 4;
+      }
+    }
+    else if (*ptr == ',' || *ptr == '!')
+    {
+      // Fill the rest of the row with 0's or 1's...
+      count = row_nibbles - emu->graphic_nibble % row_nibbles;
+
+      for (emu->graphic_repeat = 0; count > 0; count --, emu->graphic_nibble ++)
+      {
+        if (*ptr == '!')
+          emu->graphic[emu->graphic_nibble / 2] |= (emu->graphic_nibble & 1) ? 0x0f : 0xf0;
+      }
+    }
+    else if (*ptr == ':' && emu->graphic_nibble >= row_nibbles && (emu->graphic_nibble % row_nibbles) == 0)
+    {
+      // Repeat the previous row...
+      memcpy(emu->graphic + emu->graphic_nibble / 2, emu->graphic + emu->graphic_nibble / 2 - emu->graphic_bpr, emu->graphic_bpr);
+      emu->graphic_nibble += row_nibbles;
+      emu->graphic_repeat = 0;
+    }
+  }
+
+  if (ptr >= end && emu->graphic_nibble < nibbles)
+    return ((size_t)(ptr - data));
+
+  emu->in_graphic = false;
+
+  return ((size_t)(ptr - data));
+}
+
+
+//
+// 'respond()' - Send a status response to the client.
+//
+
+static void
+respond(lprint_emu_t *emu,		// I - Emulator data
+        const void   *data,		// I - Response data
+        size_t       bytes)		// I - Number of bytes
+{
+  if (emu->verbose)
+    printf("  Sending %lu byte status response.\n", (unsigned long)bytes);
+
+  if (write(emu->fd, data, bytes) < 0)
+    perror("lprint-emulator: Unable to send status response");
+}
+
+
+//
+// 'run_client()' - Process data from a client connection.
+//
+
+static void
+run_client(lprint_emu_t *emu)		// I - Emulator data
+{
+  unsigned char	*buffer;		// Receive buffer
+  size_t	used = 0,		// Bytes in buffer
+		pos,			// Current position in buffer
+		count,			// Bytes consumed by command
+		request;		// Bytes to read
+  ssize_t	bytes;			// Bytes read
+  bool		eof = false;		// End of input?
+  double	elapsed,		// Elapsed time
+		target;			// Target time for bandwidth limit
+  char		filename[1024];		// Output filename
+
+
+  if ((buffer = malloc(emu->bufsize)) == NULL)
+  {
+    perror("lprint-emulator: Unable to allocate receive buffer");
+    return;
+  }
+
+  printf("Connection %u:\n", emu->number);
+
+  if (emu->prefix)
+  {
+    snprintf(filename, sizeof(filename), "%s-%04u.pwg", emu->prefix, emu->number);
+
+    if ((emu->ras_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+      perror(filename);
+    else if ((emu->ras = cupsRasterOpen(emu->ras_fd, CUPS_RASTER_WRITE_PWG)) == NULL)
+      fprintf(stderr, "%s: %s\n", filename, cupsLastErrorString());
+  }
+
+  emu->total_bytes = 0;
+  emu->labels      = 0;
+  emu->print_time  = 0.0;
+  emu->start       = get_time();
+  emu->length      = 0;
+  emu->page_width  = 0;
+  emu->line_bytes  = 0;
+  emu->indent      = 0;
+  emu->compressed  = false;
+  emu->in_graphic  = false;
+
+  emu->data_remaining = 0;
+
+  page_reset(emu);
+
+  while (!eof || used > 0)
+  {
+    // Read more data, limited to the link bandwidth...
+    if (!eof && used < emu->bufsize)
+    {
+      request = emu->bufsize - used;
+      if (emu->bandwidth > 0 && request > (emu->bandwidth / 100 + 1))
+        request = emu->bandwidth / 100 + 1;
+
+      if ((bytes = read(emu->fd, buffer + used, request)) <= 0)
+      {
+        eof = true;
+      }
+      else
+      {
+        used             += (size_t)bytes;
+        emu->total_bytes += (size_t)bytes;
+
+        if (emu->bandwidth > 0)
+        {
+          // The link time excludes the time spent printing...
+          target = emu->start + emu->print_time + (double)emu->total_bytes / emu->bandwidth;
+          if ((elapsed = target - get_time()) > 0.0)
+            usleep((useconds_t)(1000000.0 * elapsed));
+        }
+      }
+    }
+
+    // Process as many commands as possible...
+    for (pos = 0; pos < used; pos += count)
+    {
+      if (emu->data_remaining > 0)
+        count = parse_binary(emu, buffer + pos, used - pos);
+      else if (emu->in_graphic)
+      {
+        // Continue with the next command if the graphic ended early...
+        if ((count = parse_zpl_graphic(emu, buffer + pos, used - pos)) == 0 && !emu->in_graphic)
+          continue;
+      }
+      else
+      {
+        switch (emu->lang)
+        {
+          case LPRINT_ELANG_BROTHER :
+              count = parse_brother(emu, buffer + pos, used - pos, eof);
+              break;
+          case LPRINT_ELANG_DYMO :
+              count = parse_dymo(emu, buffer + pos, used - pos, eof);
+              break;
+          case LPRINT_ELANG_EPL2 :
+              count = parse_epl2(emu, buffer + pos, used - pos, eof);
+              break;
+          case LPRINT_ELANG_SII :
+              count = parse_sii(emu, buffer + pos, used - pos, eof);
+              break;
+          case LPRINT_ELANG_TSPL :
+              count = parse_tspl(emu, buffer + pos, used - pos, eof);
+              break;
+          default :
+              count = parse_zpl(emu, buffer + pos, used - pos, eof);
+              break;
+        }
+      }
+
+      if (count == 0)
+        break;
+    }
+
+    if (pos == 0 && used >= emu->bufsize)
+    {
+      // A single command is larger than the buffer...
+      fprintf(stderr, "lprint-emulator: Command too long, discarding %lu bytes.\n", (unsigned long)used);
+      pos = used;
+    }
+    else if (pos == 0 && eof)
+    {
+      // Incomplete command at the end of the data...
+      pos = used;
+    }
+
+    if (pos < used)
+      memmove(buffer, buffer + pos, used - pos);
+
+    used -= pos;
+  }
+
+  // Show statistics for the connection...
+  elapsed = get_time() - emu->start;
+
+  printf("  %lu bytes, %u label%s in %.3f seconds (%.1f labels/minute, %.0f bytes/second)\n", (unsigned long)emu->total_bytes, emu->labels, emu->labels == 1 ? "" : "s", elapsed, elapsed > 0.0 ? 60.0 * emu->labels / elapsed : 0.0, elapsed > 0.0 ? emu->total_bytes / elapsed : 0.0);
+  fflush(stdout);
+
+  if (emu->ras)
+  {
+    cupsRasterClose(emu->ras);
+    emu->ras = NULL;
+  }
+
+  if (emu->ras_fd >= 0)
+  {
+    close(emu->ras_fd);
+    emu->ras_fd = -1;
+  }
+
+  free(buffer);
+}
+
+
+//
+// 'usage()' - Show program usage.
+//
+
+static void
+usage(int status)			// I - Exit status
+{
+  FILE	*fp = status ? stderr : stdout;	// Where to send usage
+
+
+  fputs("Usage: ./lprint-emulator [OPTIONS] LANGUAGE\n", fp);
+  fputs("Languages: brother, dymo, epl2, sii, tspl, zpl\n", fp);
+  fputs("Options:\n", fp);
+  fputs("  --help            Show this help.\n", fp);
+  fputs("  -B BUFFER-SIZE    Set the receive buffer size in bytes (default 65536).\n", fp);
+  fputs("  -b BYTES-PER-SEC  Limit the link bandwidth (default unlimited).\n", fp);
+  fputs("  -o PREFIX         Write labels to PREFIX-NNNN.pwg.\n", fp);
+  fputs("  -p PORT           Listen on PORT (default 9100).\n", fp);
+  fputs("  -r DPI            Set the printer resolution (default 203).\n", fp);
+  fputs("  -s INCHES-PER-SEC Limit the print speed (default unlimited).\n", fp);
+  fputs("  -v                Show commands as they are received.\n", fp);
+
+  exit(status);
+}
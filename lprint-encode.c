@@ -0,0 +1,621 @@
+//
+// Offline driver encoder for LPrint, a Label Printer Application
+//
+// Usage:
+//
+//   ./lprint-encode [-o OUTPUT] [-q] [-v] DRIVER INPUT.pwg
+//   ./lprint-encode -l
+//   ./lprint-encode -m WIDTHxLENGTH [-r DPI] OUTPUT.pwg
+//
+// Runs a PWG raster file through the named driver without a live printer
+// and reports the time spent in each driver callback along with the output
+// bytes, compression ratio, and lines per second for each page.  The "-q"
+// option reports just the total output bytes and milliseconds, "-l" lists
+// the available drivers, and "-m" writes a synthetic test label.
+//
+// Copyright © 2023 by Michael R Sweet
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include "lprint.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+
+//
+// Local types...
+//
+
+typedef struct lprint_timing_s		// Per-stage timing data
+{
+  double	startjob,		// Time in rstartjob callback
+		startpage,		// Time in rstartpage callback
+		writeline,		// Time in rwriteline callback
+		endpage,		// Time in rendpage callback
+		endjob;			// Time in rendjob callback
+} lprint_timing_t;
+
+
+//
+// Local globals...
+//
+
+static pappl_pr_driver_t	lprint_drivers[] =
+{					// Driver list
+#ifdef LPRINT_EXPERIMENTAL
+#  include "lprint-brother.h"
+#  include "lprint-cpcl.h"
+#endif // LPRINT_EXPERIMENTAL
+#include "lprint-dymo.h"
+#include "lprint-epl2.h"
+#include "lprint-sii.h"
+#include "lprint-tspl.h"
+#include "lprint-zpl.h"
+};
+
+
+//
+// Local functions...
+//
+
+static bool	driver_cb(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
+static void	error_cb(const char *message, void *err_data);
+static double	get_time(void);
+static size_t	get_written(pappl_device_t *device);
+static void	usage(int status);
+static int	write_synthetic(const char *filename, const char *size, unsigned dpi);
+
+
+//
+// 'main()' - Main entry for the encoder.
+//
+
+int					// O - Exit status
+main(int  argc,				// I - Number of command-line arguments
+     char *argv[])			// I - Command-line arguments
+{
+  int			i;		// Looping var
+  const char		*opt,		// Current option
+			*driver_name = NULL,
+					// Driver name
+			*in_name = NULL,// Input filename
+			*out_name = "/dev/null",
+					// Output filename
+			*synthetic = NULL;
+					// Synthetic label size
+  unsigned		dpi = 203;	// Synthetic label resolution
+  bool			quiet = false;	// Only show totals?
+  pappl_loglevel_t	loglevel = PAPPL_LOGLEVEL_ERROR;
+					// Log level
+  char			cwd[1024],	// Current directory
+			out_uri[1024];	// Output device URI
+  int			in_file;	// Input file
+  cups_raster_t		*in_ras;	// Input raster stream
+  unsigned char		*in_line;	// Input line
+  pappl_system_t	*system;	// System
+  pappl_printer_t	*printer;	// Printer
+  pappl_job_t		*job;		// Job
+  pappl_device_t	*device;	// Output device
+  pappl_pr_driver_data_t data;		// Driver data
+  pappl_pr_options_t	*options;	// Print options
+  unsigned		page,		// Current page
+			y;		// Current line on page
+  double		start,		// Start time for stage
+			page_start,	// Start time for page
+			page_write;	// Time in rwriteline for page
+  size_t		page_bytes,	// Output bytes at start of page
+			raster_bytes,	// Raster bytes for page
+			out_bytes,	// Output bytes for page
+			total_raster = 0,
+					// Total raster bytes
+			total_lines = 0;// Total lines
+  lprint_timing_t	timing;		// Per-stage timing
+  bool			ok = true;	// Did everything succeed?
+
+
+  // Parse command-line...
+  for (i = 1; i < argc; i ++)
+  {
+    if (!strcmp(argv[i], "--help"))
+    {
+      usage(0);
+    }
+    else if (argv[i][0] == '-' && argv[i][1] != '-')
+    {
+      for (opt = argv[i] + 1; *opt; opt ++)
+      {
+        switch (*opt)
+        {
+          case 'l' : // -l (list drivers)
+              for (i = 0; i < (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])); i ++)
+                puts(lprint_drivers[i].name);
+              return (0);
+
+          case 'm' : // -m WIDTHxLENGTH
+              i ++;
+              if (i >= argc)
+              {
+                fputs("lprint-encode: Missing label size after '-m'.\n", stderr);
+                usage(1);
+              }
+              synthetic = argv[i];
+              break;
+
+          case 'o' : // -o OUTPUT
+              i ++;
+              if (i >= argc)
+              {
+                fputs("lprint-encode: Missing output filename after '-o'.\n", stderr);
+                usage(1);
+              }
+              out_name = argv[i];
+              break;
+
+          case 'q' : // -q (quiet)
+              quiet = true;
+              break;
+
+          case 'r' : // -r DPI
+              i ++;
+              if (i >= argc || (dpi = (unsigned)atoi(argv[i])) < 100 || dpi > 1200)
+              {
+                fputs("lprint-encode: Expected resolution after '-r'.\n", stderr);
+                usage(1);
+              }
+              break;
+
+          case 'v' : // -v (verbose logging)
+              loglevel = PAPPL_LOGLEVEL_DEBUG;
+              break;
+
+          default :
+              fprintf(stderr, "lprint-encode: Unknown option '-%c'.\n", *opt);
+              usage(1);
+        }
+      }
+    }
+    else if (!driver_name)
+    {
+      driver_name = argv[i];
+    }
+    else if (!in_name)
+    {
+      in_name = argv[i];
+    }
+    else
+    {
+      fprintf(stderr, "lprint-encode: Unknown argument '%s'.\n", argv[i]);
+      usage(1);
+    }
+  }
+
+  if (synthetic)
+  {
+    // The only argument is the output file...
+    if (!driver_name || in_name)
+      usage(1);
+
+    return (write_synthetic(driver_name, synthetic, dpi));
+  }
+
+  if (!driver_name || !in_name)
+    usage(1);
+
+  for (i = 0; i < (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])); i ++)
+  {
+    if (!strcmp(driver_name, lprint_drivers[i].name))
+      break;
+  }
+
+  if (i >= (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])))
+  {
+    fprintf(stderr, "lprint-encode: Unknown driver '%s'.\n", driver_name);
+    return (1);
+  }
+
+  // Open input raster file...
+  if ((in_file = open(in_name, O_RDONLY)) < 0)
+  {
+    perror(in_name);
+    return (1);
+  }
+
+  if ((in_ras = cupsRasterOpen(in_file, CUPS_RASTER_READ)) == NULL)
+  {
+    fprintf(stderr, "%s: %s\n", in_name, cupsLastErrorString());
+    close(in_file);
+    return (1);
+  }
+
+  // Create a system and a stopped printer so that the job we create is never
+  // processed by PAPPL itself - we call the driver callbacks directly below...
+  if ((system = papplSystemCreate(PAPPL_SOPTIONS_NONE, "lprint-encode", 0, NULL, NULL, "-", loglevel, NULL, false)) == NULL)
+  {
+    fputs("lprint-encode: Unable to create system.\n", stderr);
+    cupsRasterClose(in_ras);
+    close(in_file);
+    return (1);
+  }
+
+  papplSystemSetPrinterDrivers(system, (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])), lprint_drivers, NULL, NULL, driver_cb, NULL);
+
+  if ((printer = papplPrinterCreate(system, 0, "encode", driver_name, "", "file:///dev/null")) == NULL)
+  {
+    fprintf(stderr, "lprint-encode: Unable to create printer for '%s'.\n", driver_name);
+    papplSystemDelete(system);
+    cupsRasterClose(in_ras);
+    close(in_file);
+    return (1);
+  }
+
+  papplPrinterPause(printer);
+
+  if ((job = papplJobCreateWithFile(printer, "lprint-encode", "image/pwg-raster", in_name, 0, NULL, in_name)) == NULL)
+  {
+    fputs("lprint-encode: Unable to create job.\n", stderr);
+    papplSystemDelete(system);
+    cupsRasterClose(in_ras);
+    close(in_file);
+    return (1);
+  }
+
+  papplPrinterGetDriverData(printer, &data);
+
+  // Open the output device...
+  if (out_name[0] == '/')
+    snprintf(out_uri, sizeof(out_uri), "file://%s", out_name);
+  else
+    snprintf(out_uri, sizeof(out_uri), "file://%s/%s", getcwd(cwd, sizeof(cwd)) ? cwd : ".", out_name);
+
+  if ((device = papplDeviceOpen(out_uri, "lprint-encode", error_cb, NULL)) == NULL)
+  {
+    papplSystemDelete(system);
+    cupsRasterClose(in_ras);
+    close(in_file);
+    return (1);
+  }
+
+  // Run the driver callbacks...
+  options = papplJobCreatePrintOptions(job, INT_MAX, false);
+
+  memset(&timing, 0, sizeof(timing));
+
+  if (!quiet)
+  {
+    printf("Driver: %s (%s)\n", driver_name, data.make_and_model);
+    puts("Page   Size        Raster  Output   Ratio   Lines/sec  Total(ms)");
+  }
+
+  for (page = 0; ok && cupsRasterReadHeader(in_ras, &options->header); page ++)
+  {
+    if ((in_line = malloc(options->header.cupsBytesPerLine)) == NULL)
+    {
+      perror("Unable to allocate memory for page");
+      ok = false;
+      break;
+    }
+
+    if (page == 0)
+    {
+      start = get_time();
+      ok    = (data.rstartjob_cb)(job, options, device);
+      timing.startjob += get_time() - start;
+
+      if (!ok)
+      {
+        free(in_line);
+        break;
+      }
+    }
+
+    page_bytes = get_written(device);
+    page_start = get_time();
+    ok         = (data.rstartpage_cb)(job, options, device, page);
+    timing.startpage += get_time() - page_start;
+
+    for (y = 0, start = get_time(); ok && y < options->header.cupsHeight; y ++)
+    {
+      if (cupsRasterReadPixels(in_ras, in_line, options->header.cupsBytesPerLine) != options->header.cupsBytesPerLine)
+        break;
+
+      ok = (data.rwriteline_cb)(job, options, device, y, in_line);
+    }
+
+    page_write = get_time() - start;
+    timing.writeline += page_write;
+
+    start = get_time();
+    if (ok)
+      ok = (data.rendpage_cb)(job, options, device, page);
+    timing.endpage += get_time() - start;
+
+    raster_bytes = (size_t)options->header.cupsBytesPerLine * y;
+    out_bytes    = get_written(device) - page_bytes;
+    total_raster += raster_bytes;
+    total_lines  += y;
+
+    if (!quiet)
+      printf("%4u  %4ux%-5u  %8lu  %6lu  %6.1f:1  %9.0f  %9.3f\n", page + 1, options->header.cupsWidth, options->header.cupsHeight, (unsigned long)raster_bytes, (unsigned long)out_bytes, out_bytes ? (double)raster_bytes / out_bytes : 0.0, page_write > 0.0 ? y / page_write : 0.0, 1000.0 * (get_time() - page_start));
+
+    free(in_line);
+  }
+
+  if (page > 0)
+  {
+    start = get_time();
+    if (!(data.rendjob_cb)(job, options, device))
+      ok = false;
+    timing.endjob += get_time() - start;
+  }
+
+  out_bytes = get_written(device);
+
+  // Show the per-stage totals...
+  if (quiet)
+  {
+    printf("%lu %.3f\n", (unsigned long)out_bytes, 1000.0 * (timing.startjob + timing.startpage + timing.writeline + timing.endpage + timing.endjob));
+  }
+  else
+  {
+    printf("\nPages: %u, raster bytes: %lu, output bytes: %lu, ratio: %.1f:1, lines/sec: %.0f\n", page, (unsigned long)total_raster, (unsigned long)out_bytes, out_bytes ? (double)total_raster / out_bytes : 0.0, timing.writeline > 0.0 ? total_lines / timing.writeline : 0.0);
+    printf("rstartjob:  %9.3fms\n", 1000.0 * timing.startjob);
+    printf("rstartpage: %9.3fms\n", 1000.0 * timing.startpage);
+    printf("rwriteline: %9.3fms\n", 1000.0 * timing.writeline);
+    printf("rendpage:   %9.3fms\n", 1000.0 * timing.endpage);
+    printf("rendjob:    %9.3fms\n", 1000.0 * timing.endjob);
+  }
+
+  // Cleanup and exit...
+  papplJobDeletePrintOptions(options);
+  papplDeviceClose(device);
+  papplSystemDelete(system);
+  cupsRasterClose(in_ras);
+  close(in_file);
+
+  return (ok ? 0 : 1);
+}
+
+
+//
+// 'driver_cb()' - Driver callback for the encoder.
+//
+// This only does the parts of the main driver callback that matter for
+// encoding - the sub-driver callbacks set everything the raster callbacks
+// need.
+//
+
+static bool				// O - `true` on success, `false` on failure
+driver_cb(
+    pappl_system_t         *system,	// I - System
+    const char             *driver_name,// I - Driver name
+    const char             *device_uri,	// I - Device URI
+    const char             *device_id,	// I - 1284 device ID
+    pappl_pr_driver_data_t *data,	// I - Pointer to driver data
+    ipp_t                  **attrs,	// O - Pointer to driver attributes
+    void                   *cbdata)	// I - Callback data (not used)
+{
+  bool	ret = false;			// Return value
+  int	i;				// Looping var
+
+
+  // Copy make/model info...
+  for (i = 0; i < (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])); i ++)
+  {
+    if (!strcmp(driver_name, lprint_drivers[i].name))
+    {
+      papplCopyString(data->make_and_model, lprint_drivers[i].description, sizeof(data->make_and_model));
+      break;
+    }
+  }
+
+  data->kind            = PAPPL_KIND_LABEL;
+  data->color_supported = PAPPL_COLOR_MODE_AUTO | PAPPL_COLOR_MODE_MONOCHROME | PAPPL_COLOR_MODE_BI_LEVEL;
+  data->color_default   = PAPPL_COLOR_MODE_MONOCHROME;
+  data->raster_types    = PAPPL_PWG_RASTER_TYPE_BLACK_1 | PAPPL_PWG_RASTER_TYPE_BLACK_8 | PAPPL_PWG_RASTER_TYPE_SGRAY_8;
+  data->sides_supported = PAPPL_SIDES_ONE_SIDED;
+  data->sides_default   = PAPPL_SIDES_ONE_SIDED;
+
+  // Use the corresponding sub-driver callback to set things up...
+#ifdef LPRINT_EXPERIMENTAL
+  if (!strncmp(driver_name, "brother_", 8))
+    ret = lprintBrother(system, driver_name, device_uri, device_id, data, attrs, cbdata);
+  else if (!strncmp(driver_name, "cpcl_", 5))
+    ret = lprintCPCL(system, driver_name, device_uri, device_id, data, attrs, cbdata);
+  else
+#endif // LPRINT_EXPERIMENTAL
+  if (!strncmp(driver_name, "dymo_", 5))
+    ret = lprintDYMO(system, driver_name, device_uri, device_id, data, attrs, cbdata);
+  else if (!strncmp(driver_name, "epl2_", 5))
+    ret = lprintEPL2(system, driver_name, device_uri, device_id, data, attrs, cbdata);
+  else if (!strncmp(driver_name, "sii_", 4))
+    ret = lprintSII(system, driver_name, device_uri, device_id, data, attrs, cbdata);
+  else if (!strncmp(driver_name, "tspl_", 5))
+    ret = lprintTSPL(system, driver_name, device_uri, device_id, data, attrs, cbdata);
+  else if (!strncmp(driver_name, "zpl_", 4))
+    ret = lprintZPL(system, driver_name, device_uri, device_id, data, attrs, cbdata);
+
+  // By default use media from the main source...
+  data->media_default = data->media_ready[0];
+
+  return (ret);
+}
+
+
+//
+// 'error_cb()' - Show a device error.
+//
+
+static void
+error_cb(const char *message,		// I - Error message
+         void       *err_data)		// I - Callback data (not used)
+{
+  (void)err_data;
+
+  fprintf(stderr, "lprint-encode: %s\n", message);
+}
+
+
+//
+// 'get_time()' - Get the current monotonic time in seconds.
+//
+
+static double				// O - Time in seconds
+get_time(void)
+{
+  struct timespec	curtime;	// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &curtime);
+
+  return (curtime.tv_sec + 0.000000001 * curtime.tv_nsec);
+}
+
+
+//
+// 'get_written()' - Get the number of bytes written to the device so far.
+//
+
+static size_t				// O - Number of bytes written
+get_written(pappl_device_t *device)	// I - Output device
+{
+  pappl_devmetrics_t	metrics;	// Device metrics
+
+
+  papplDeviceGetMetrics(device, &metrics);
+
+  return (metrics.write_bytes);
+}
+
+
+//
+// 'usage()' - Show program usage.
+//
+
+static void
+usage(int status)			// I - Exit status
+{
+  FILE	*fp = status ? stderr : stdout;	// Where to send usage
+
+
+  fputs("Usage: ./lprint-encode [OPTIONS] DRIVER INPUT.pwg\n", fp);
+  fputs("       ./lprint-encode -l\n", fp);
+  fputs("       ./lprint-encode -m WIDTHxLENGTH [-r DPI] OUTPUT.pwg\n", fp);
+  fputs("Options:\n", fp);
+  fputs("  --help           Show this help.\n", fp);
+  fputs("  -l               List the available drivers.\n", fp);
+  fputs("  -m WIDTHxLENGTH  Write a synthetic label of the given size in dots.\n", fp);
+  fputs("  -o OUTPUT        Write printer data to OUTPUT (default /dev/null).\n", fp);
+  fputs("  -q               Only show the total output bytes and milliseconds.\n", fp);
+  fputs("  -r DPI           Set the synthetic label resolution (default 203).\n", fp);
+  fputs("  -v               Show debug log messages.\n", fp);
+
+  exit(status);
+}
+
+
+//
+// 'write_synthetic()' - Write a synthetic test label.
+//
+// The label repeats bands of barcode-like bars, a gray ramp, and a solid box
+// so that every part of the dither and encoders gets exercised.
+//
+
+static int				// O - Exit status
+write_synthetic(const char *filename,	// I - Output filename
+                const char *size,	// I - Label size ("WIDTHxLENGTH")
+                unsigned   dpi)		// I - Resolution
+{
+  int			fd;		// Output file
+  cups_raster_t		*ras;		// Output raster stream
+  cups_page_header_t	header;		// Page header
+  unsigned char		*line;		// Output line
+  unsigned		width,		// Width in dots
+			length,		// Length in dots
+			x, y,		// Current position
+			band;		// Position within band
+
+
+  if (sscanf(size, "%ux%u", &width, &length) != 2 || width < 8 || width > 65536 || length < 8 || length > 1000000)
+  {
+    fprintf(stderr, "lprint-encode: Bad label size '%s'.\n", size);
+    return (1);
+  }
+
+  if ((line = malloc(width)) == NULL)
+  {
+    perror("Unable to allocate memory for line");
+    return (1);
+  }
+
+  if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+  {
+    perror(filename);
+    free(line);
+    return (1);
+  }
+
+  if ((ras = cupsRasterOpen(fd, CUPS_RASTER_WRITE_PWG)) == NULL)
+  {
+    fprintf(stderr, "%s: %s\n", filename, cupsLastErrorString());
+    close(fd);
+    free(line);
+    return (1);
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.HWResolution[0]  = dpi;
+  header.HWResolution[1]  = dpi;
+  header.NumCopies        = 1;
+  header.PageSize[0]      = 72 * width / dpi;
+  header.PageSize[1]      = 72 * length / dpi;
+  header.cupsWidth        = width;
+  header.cupsHeight       = length;
+  header.cupsBitsPerColor = 8;
+  header.cupsBitsPerPixel = 8;
+  header.cupsBytesPerLine = width;
+  header.cupsColorOrder   = CUPS_ORDER_CHUNKED;
+  header.cupsColorSpace   = CUPS_CSPACE_SW;
+  header.cupsNumColors    = 1;
+
+  cupsRasterWriteHeader(ras, &header);
+
+  for (y = 0; y < length; y ++)
+  {
+    band = y % (3 * dpi / 2);
+
+    if (band < dpi / 8 || (band >= dpi / 2 && band < 5 * dpi / 8))
+    {
+      // White space between bands...
+      memset(line, 255, width);
+    }
+    else if (band < dpi / 2)
+    {
+      // Barcode-like bars of varying width...
+      for (x = 0; x < width; x ++)
+        line[x] = ((x / 3) * 7 + x / 11) % 5 < 2 ? 0 : 255;
+    }
+    else if (band < dpi)
+    {
+      // Gray ramp...
+      for (x = 0; x < width; x ++)
+        line[x] = (unsigned char)(255 * x / width);
+    }
+    else
+    {
+      // Solid box with a white border...
+      memset(line, 255, width);
+      if (width > dpi / 4)
+        memset(line + dpi / 8, 0, width - dpi / 4);
+    }
+
+    cupsRasterWritePixels(ras, line, width);
+  }
+
+  cupsRasterClose(ras);
+  close(fd);
+  free(line);
+
+  return (0);
+}
@@ -10,6 +10,18 @@
 #include "lprint.h"
 
 
+//
+// Local types...
+//
+
+typedef struct lprint_epl2_s		// EPL2 driver data
+{
+  lprint_dither_t dither;		// Dither buffer
+  lprint_buffer_t buffer;		// Output buffer
+  lprint_vector_t vector;		// Page bitmap for rectangles
+} lprint_epl2_t;
+
+
 //
 // Local globals...
 //
@@ -127,6 +139,7 @@ static bool	lprint_epl2_rstartjob(pappl_job_t *job, pappl_pr_options_t *options,
 static bool	lprint_epl2_rstartpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
 static bool	lprint_epl2_rwriteline(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned y, const unsigned char *line);
 static bool	lprint_epl2_status(pappl_printer_t *printer);
+static void	lprint_epl2_write_row(lprint_epl2_t *epl2, unsigned y, const unsigned char *row);
 
 
 //
@@ -239,12 +252,17 @@ lprint_epl2_printfile(
 
   while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
   {
+    LPRINT_PROBE2(raw_write_start, papplJobGetID(job), bytes);
+
     if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
     {
+      LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 0);
       papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
       close(fd);
       return (false);
     }
+
+    LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 1);
   }
   close(fd);
 
@@ -264,14 +282,16 @@ lprint_epl2_rendjob(
     pappl_pr_options_t *options,	// I - Job options
     pappl_device_t     *device)		// I - Output device
 {
-  lprint_dither_t *dither = (lprint_dither_t *)papplJobGetData(job);
-					// Dither buffer
+  lprint_epl2_t	*epl2 = (lprint_epl2_t *)papplJobGetData(job);
+					// EPL2 driver data
 
 
   (void)options;
   (void)device;
 
-  free(dither);
+  lprintBufferFinish(&epl2->buffer, job);
+
+  free(epl2);
   papplJobSetData(job, NULL);
 
   return (true);
@@ -289,21 +309,46 @@ lprint_epl2_rendpage(
     pappl_device_t     *device,		// I - Output device
     unsigned           page)		// I - Page number
 {
-  lprint_dither_t *dither = (lprint_dither_t *)papplJobGetData(job);
-					// Dither buffer
+  lprint_epl2_t	*epl2 = (lprint_epl2_t *)papplJobGetData(job);
+					// EPL2 driver data
+  unsigned	y;			// Current line
+  size_t	i;			// Looping var
+  lprint_rect_t	*rect;			// Current rectangle
 
 
   (void)page;
 
+  // Nothing more to send if the output came from the cache...
+  if (epl2->buffer.cached)
+    return (true);
+
   lprint_epl2_rwriteline(job, options, device, options->header.cupsHeight, NULL);
 
-  papplDevicePuts(device, "P1\n");
+  if (epl2->vector.bitmap)
+  {
+    // Pull out solid rectangles and send the rest of the page as bitmaps...
+    lprintVectorFind(&epl2->vector, LPRINT_VECTOR_MIN_AREA);
+
+    for (y = 0; y < epl2->vector.height; y ++)
+      lprint_epl2_write_row(epl2, y + epl2->dither.in_top + 1, epl2->vector.bitmap + y * epl2->vector.width);
+
+    for (i = epl2->vector.num_rects, rect = epl2->vector.rects; i > 0; i --, rect ++)
+    {
+      // Draw a black line...
+      lprintBufferPrintf(&epl2->buffer, "LO%u,%u,%u,%u\n", rect->x, rect->y + epl2->dither.in_top + 1, rect->width, rect->height);
+    }
+  }
+
+  lprintBufferPrintf(&epl2->buffer, "P%u\n", options->header.NumCopies > 1 ? options->header.NumCopies : 1);
 
   if (options->finishings & PAPPL_FINISHINGS_TRIM)
-    papplDevicePuts(device, "C\n");
+    lprintBufferPuts(&epl2->buffer, "C\n");
+
+  lprintBufferFlush(&epl2->buffer);
 
   // Free memory and return...
-  lprintDitherFree(dither);
+  lprintDitherFree(&epl2->dither);
+  lprintVectorFree(&epl2->vector);
 
   return (true);
 }
@@ -319,15 +364,16 @@ lprint_epl2_rstartjob(
     pappl_pr_options_t *options,	// I - Job options
     pappl_device_t     *device)		// I - Output device
 {
-  lprint_dither_t *dither = (lprint_dither_t *)calloc(1, sizeof(lprint_dither_t));
-					// Dither buffer
+  lprint_epl2_t	*epl2 = (lprint_epl2_t *)calloc(1, sizeof(lprint_epl2_t));
+					// EPL2 driver data
 
 
-  (void)options;
-  (void)device;
+  // Save driver data...
+  papplJobSetData(job, epl2);
+  lprintBufferInit(&epl2->buffer, device);
 
-  // Save dither buffer for job...
-  papplJobSetData(job, dither);
+  // Send the cached output for identical jobs...
+  lprintCacheStart(&epl2->buffer, job, options);
 
   return (true);
 }
@@ -345,23 +391,29 @@ lprint_epl2_rstartpage(
     unsigned           page)		// I - Page number
 {
   int		ips;			// Inches per second
-  lprint_dither_t *dither = (lprint_dither_t *)papplJobGetData(job);
-					// Dither buffer
+  lprint_epl2_t	*epl2 = (lprint_epl2_t *)papplJobGetData(job);
+					// EPL2 driver data
   int		darkness;		// Composite darkness value
   double	out_gamma = 1.0;	// Output gamma correction
 
 
   (void)page;
 
+  // Nothing more to send if the output came from the cache...
+  if (epl2->buffer.cached)
+    return (true);
+
   // Initialize the dither buffer...
   if (options->header.HWResolution[0] == 300)
     out_gamma = 1.2;
 
-  if (!lprintDitherAlloc(dither, job, options, CUPS_CSPACE_W, out_gamma))
+  if (!lprintDitherAlloc(&epl2->dither, job, options, CUPS_CSPACE_W, out_gamma))
     return (false);
 
+  lprintVectorAlloc(&epl2->vector, &epl2->dither);
+
   // Start a new label...
-  papplDevicePuts(device, "\nN\n");
+  lprintBufferPuts(&epl2->buffer, "\nN\n");
 
   // print-darkness
   if ((darkness = options->print_darkness + options->darkness_configured) < 0)
@@ -369,14 +421,14 @@ lprint_epl2_rstartpage(
   else if (darkness > 100)
     darkness = 100;
 
-  papplDevicePrintf(device, "D%d\n", 15 * darkness / 100);
+  lprintBufferPrintf(&epl2->buffer, "D%d\n", 15 * darkness / 100);
 
   // print-speed
   if ((ips = options->print_speed / 2540) > 0)
-    papplDevicePrintf(device, "S%d\n", ips);
+    lprintBufferPrintf(&epl2->buffer, "S%d\n", ips);
 
   // Set label width...
-  papplDevicePrintf(device, "q%u\n", dither->out_width * 8);
+  lprintBufferPrintf(&epl2->buffer, "q%u\n", epl2->dither.out_width * 8);
 
   return (true);
 }
@@ -394,20 +446,24 @@ lprint_epl2_rwriteline(
     unsigned            y,		// I - Line number
     const unsigned char *line)		// I - Line
 {
-  lprint_dither_t *dither = (lprint_dither_t *)papplJobGetData(job);
-					// Dither buffer
+  lprint_epl2_t	*epl2 = (lprint_epl2_t *)papplJobGetData(job);
+					// EPL2 driver data
+
 
+  (void)options;
+  (void)device;
 
-  if (!lprintDitherLine(dither, y, line))
+  // Nothing more to send if the output came from the cache...
+  if (epl2->buffer.cached)
     return (true);
 
-  if (dither->output[0] || memcmp(dither->output, dither->output + 1, dither->out_width - 1))
-  {
-    // Not a blank line
-    papplDevicePrintf(device, "GW0,%u,%u,1\n", y, dither->out_width);
-    papplDeviceWrite(device, dither->output, dither->out_width);
-    papplDevicePuts(device, "\n");
-  }
+  if (!lprintDitherLine(&epl2->dither, y, line))
+    return (true);
+
+  if (epl2->vector.bitmap)
+    lprintVectorLine(&epl2->vector, &epl2->dither, y);
+  else
+    lprint_epl2_write_row(epl2, y, epl2->dither.output);
 
   return (true);
 }
@@ -425,3 +481,23 @@ lprint_epl2_status(
 
   return (true);
 }
+
+
+//
+// 'lprint_epl2_write_row()' - Write a row of the bitmap.
+//
+
+static void
+lprint_epl2_write_row(
+    lprint_epl2_t       *epl2,		// I - EPL2 driver data
+    unsigned            y,		// I - Line number
+    const unsigned char *row)		// I - Row of bitmap
+{
+  if (row[0] != epl2->dither.out_white || memcmp(row, row + 1, epl2->dither.out_width - 1))
+  {
+    // Not a blank line
+    lprintBufferPrintf(&epl2->buffer, "GW0,%u,%u,1\n", y, epl2->dither.out_width);
+    lprintBufferWrite(&epl2->buffer, row, epl2->dither.out_width);
+    lprintBufferPuts(&epl2->buffer, "\n");
+  }
+}
@@ -0,0 +1,1274 @@
+//
+// Server metrics for LPrint, a Label Printer Application
+//
+// Copyright © 2019-2024 by Michael R Sweet.
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include "lprint.h"
+#include <stddef.h>
+
+
+//
+// Local types...
+//
+
+enum lprint_ttid_e			// Trace event "threads"
+{
+  LPRINT_TTID_JOB = 1,			// Job processing
+  LPRINT_TTID_WRITER,			// Device writes
+  LPRINT_TTID_STATUS			// Status queries
+};
+
+typedef struct lprint_tevent_s		// Trace event
+{
+  char			name[32];	// Event name
+  const char		*cat;		// Event category
+  int			tid;		// Event "thread"
+  double		start,		// Start time in seconds
+			secs;		// Duration in seconds
+  char			args[128];	// JSON arguments, if any
+} lprint_tevent_t;
+
+typedef struct lprint_trace_s		// Pipeline trace for the current job
+{
+  lprint_cmedia_t	*cmedia;	// Per-printer data
+  pthread_mutex_t	mutex;		// Mutex for events
+  double		origin,		// Time when the job was created
+			job_start,	// Time when the job was started
+			page_start;	// Time when the page was started
+  size_t		num_events,	// Number of events
+			alloc_events;	// Allocated events
+  lprint_tevent_t	*events;	// Events
+  double		batch_start,	// Start of write line batch
+			batch_end,	// End of write line batch
+			batch_secs,	// Time in write line callbacks for batch
+			batch_dither;	// Dither time at start of batch
+  unsigned		batch_y,	// First line in batch
+			batch_lines;	// Number of lines in batch
+} lprint_trace_t;
+
+typedef struct lprint_mjob_s		// Metrics for the current job
+{
+  pappl_job_t		*job;		// Job
+  pappl_pr_rstartjob_cb_t rstartjob_cb;	// Driver start job callback
+  pappl_pr_rstartpage_cb_t rstartpage_cb;
+					// Driver start page callback
+  pappl_pr_rwriteline_cb_t rwriteline_cb;
+					// Driver write line callback
+  pappl_pr_rendpage_cb_t rendpage_cb;	// Driver end page callback
+  pappl_pr_rendjob_cb_t	rendjob_cb;	// Driver end job callback
+  double		page_secs,	// Time in page callbacks for this page
+			dither_secs;	// Time dithering this page
+  size_t		page_bytes,	// Dithered bytes for this page
+			raster_bytes,	// Dithered bytes for this job
+			written_bytes;	// Bytes written for this job
+  lprint_histogram_t	dither,		// Dither times per page
+			encode,		// Encode times per page
+			write;		// Device write times
+  lprint_trace_t	*trace;		// Pipeline trace, if any
+} lprint_mjob_t;
+
+typedef struct lprint_pmetrics_s	// Per-printer metrics
+{
+  int			printer_id;	// Printer ID
+  size_t		jobs[3],	// Completed, canceled, and aborted jobs
+			pages,		// Pages printed
+			labels,		// Labels printed (pages * copies)
+			raster_bytes,	// Dithered bytes
+			written_bytes;	// Bytes written to the printer
+  lprint_histogram_t	dither,		// Dither times per page
+			encode,		// Encode times per page
+			write,		// Device write times
+			status;		// Status query times
+  pappl_pr_status_cb_t	status_cb;	// Driver status callback
+  lprint_cmedia_t	*cmedia;	// Per-printer data for the status callback
+} lprint_pmetrics_t;
+
+typedef struct lprint_mprinter_s	// Printer snapshot for output
+{
+  char			name[256],	// Printer name
+			driver_name[128];
+					// Driver name
+  ipp_pstate_t		state;		// "printer-state" value
+  pappl_preason_t	reasons;	// "printer-state-reasons" bits
+  lprint_pmetrics_t	metrics;	// Metrics
+} lprint_mprinter_t;
+
+typedef struct lprint_msnapshot_s	// Snapshot of all printers
+{
+  size_t		num_printers,	// Number of printers
+			alloc_printers;	// Allocated printers
+  lprint_mprinter_t	*printers;	// Printers
+} lprint_msnapshot_t;
+
+
+//
+// Local globals...
+//
+
+static const double	metrics_bounds[LPRINT_METRICS_BUCKETS] =
+{					// Upper bounds of histogram buckets in seconds
+  0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0
+};
+static pthread_key_t	metrics_key;	// Thread-local job metrics
+static pthread_mutex_t	metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for printer metrics
+static pthread_once_t	metrics_once = PTHREAD_ONCE_INIT;
+					// One-time initialization of thread-local key
+static cups_array_t	*metrics_printers = NULL;
+					// Per-printer metrics
+static const struct
+{
+  pappl_preason_t	value;		// Reason bit
+  const char		*keyword;	// "printer-state-reasons" keyword
+}			metrics_reasons[] =
+{					// Printer state reasons
+  { PAPPL_PREASON_OTHER,		"other" },
+  { PAPPL_PREASON_COVER_OPEN,		"cover-open" },
+  { PAPPL_PREASON_INPUT_TRAY_MISSING,	"input-tray-missing" },
+  { PAPPL_PREASON_MARKER_SUPPLY_EMPTY,	"marker-supply-empty" },
+  { PAPPL_PREASON_MARKER_SUPPLY_LOW,	"marker-supply-low" },
+  { PAPPL_PREASON_MARKER_WASTE_ALMOST_FULL, "marker-waste-almost-full" },
+  { PAPPL_PREASON_MARKER_WASTE_FULL,	"marker-waste-full" },
+  { PAPPL_PREASON_MEDIA_EMPTY,		"media-empty" },
+  { PAPPL_PREASON_MEDIA_JAM,		"media-jam" },
+  { PAPPL_PREASON_MEDIA_LOW,		"media-low" },
+  { PAPPL_PREASON_MEDIA_NEEDED,		"media-needed" },
+  { PAPPL_PREASON_OFFLINE,		"offline" },
+  { PAPPL_PREASON_SPOOL_AREA_FULL,	"spool-area-full" },
+  { PAPPL_PREASON_TONER_EMPTY,		"toner-empty" },
+  { PAPPL_PREASON_TONER_LOW,		"toner-low" }
+};
+
+
+//
+// Local functions...
+//
+
+static void	add_event(lprint_trace_t *trace, int tid, const char *cat, const char *name, double start, double secs, const char *format, ...);
+static void	add_histogram(lprint_histogram_t *dst, const lprint_histogram_t *src);
+static void	collect_cb(pappl_printer_t *printer, lprint_msnapshot_t *snapshot);
+static int	compare_metrics(lprint_pmetrics_t *a, lprint_pmetrics_t *b, void *data);
+static char	*escape_label(const char *s, char *buffer, size_t bufsize);
+static lprint_pmetrics_t *find_metrics(int printer_id);
+static void	flush_lines(lprint_mjob_t *mjob);
+static void	free_job(lprint_mjob_t *mjob);
+static lprint_mjob_t *get_job(pappl_job_t *job);
+static double	get_time(void);
+static void	init_key(void);
+static bool	metrics_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
+static bool	metrics_rendpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
+static bool	metrics_rstartjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
+static bool	metrics_rstartpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
+static bool	metrics_rwriteline(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned y, const unsigned char *line);
+static bool	metrics_status(pappl_printer_t *printer);
+static void	write_counter(pappl_client_t *client, lprint_msnapshot_t *snapshot, const char *name, const char *help, size_t offset);
+static void	write_header(pappl_client_t *client, const char *name, const char *type, const char *help);
+static void	write_histogram(pappl_client_t *client, lprint_msnapshot_t *snapshot, const char *name, const char *help, size_t offset);
+static void	write_trace(pappl_job_t *job, lprint_trace_t *trace);
+
+
+//
+// 'lprintMetricsActive()' - Determine whether the current job is being measured.
+//
+
+bool					// O - `true` if measuring, `false` otherwise
+lprintMetricsActive(void)
+{
+  pthread_once(&metrics_once, init_key);
+
+  return (pthread_getspecific(metrics_key) != NULL);
+}
+
+
+//
+// 'lprintMetricsBuffer()' - Add the output totals for the current job.
+//
+
+void
+lprintMetricsBuffer(
+    lprint_buffer_t *buffer)		// I - Output buffer
+{
+  lprint_mjob_t	*mjob;			// Job metrics
+
+
+  pthread_once(&metrics_once, init_key);
+
+  if ((mjob = (lprint_mjob_t *)pthread_getspecific(metrics_key)) == NULL)
+    return;
+
+  // Output from the cache says nothing about the driver's compression...
+  if (!buffer->cached)
+    mjob->written_bytes += buffer->bytes;
+
+  add_histogram(&mjob->write, &buffer->write_hist);
+}
+
+
+//
+// 'lprintMetricsDither()' - Add the time spent dithering a line.
+//
+
+void
+lprintMetricsDither(size_t bytes,	// I - Bytes of dithered output
+                    double secs)	// I - Time in seconds
+{
+  lprint_mjob_t	*mjob;			// Job metrics
+
+
+  if ((mjob = (lprint_mjob_t *)pthread_getspecific(metrics_key)) == NULL)
+    return;
+
+  mjob->dither_secs += secs;
+  mjob->page_bytes  += bytes;
+}
+
+
+//
+// 'lprintMetricsEvent()' - Count completed jobs, pages, and labels.
+//
+
+void
+lprintMetricsEvent(
+    pappl_printer_t *printer,		// I - Printer
+    pappl_job_t     *job,		// I - Job
+    pappl_event_t   event)		// I - Event
+{
+  lprint_pmetrics_t	*metrics;	// Printer metrics
+  int			pages,		// Pages printed
+			copies;		// Copies of each page
+
+
+  if (!(event & PAPPL_EVENT_JOB_COMPLETED) || !printer || !job)
+    return;
+
+  pages  = papplJobGetImpressionsCompleted(job);
+  copies = papplJobGetCopies(job);
+
+  pthread_mutex_lock(&metrics_mutex);
+
+  if ((metrics = find_metrics(papplPrinterGetID(printer))) != NULL)
+  {
+    switch (papplJobGetState(job))
+    {
+      case IPP_JSTATE_CANCELED :
+          metrics->jobs[1] ++;
+          break;
+      case IPP_JSTATE_ABORTED :
+          metrics->jobs[2] ++;
+          break;
+      default :
+          metrics->jobs[0] ++;
+          break;
+    }
+
+    metrics->pages  += (size_t)pages;
+    metrics->labels += (size_t)(pages * (copies > 1 ? copies : 1));
+  }
+
+  pthread_mutex_unlock(&metrics_mutex);
+}
+
+
+//
+// 'lprintMetricsObserve()' - Add a time to a histogram.
+//
+
+void
+lprintMetricsObserve(
+    lprint_histogram_t *hist,		// I - Histogram
+    double             secs)		// I - Time in seconds
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < LPRINT_METRICS_BUCKETS; i ++)
+  {
+    if (secs <= metrics_bounds[i])
+    {
+      hist->buckets[i] ++;
+      break;
+    }
+  }
+
+  hist->count ++;
+  hist->sum += secs;
+}
+
+
+//
+// 'lprintMetricsTrace()' - Get the pipeline trace for the current job.
+//
+
+void *					// O - Trace or `NULL` if not tracing
+lprintMetricsTrace(void)
+{
+  lprint_mjob_t	*mjob;			// Job metrics
+
+
+  pthread_once(&metrics_once, init_key);
+
+  if ((mjob = (lprint_mjob_t *)pthread_getspecific(metrics_key)) == NULL)
+    return (NULL);
+
+  return (mjob->trace);
+}
+
+
+//
+// 'lprintMetricsTraceWrite()' - Add a device write to a pipeline trace.
+//
+// This function is called from the output buffer's writer thread, so the trace
+// is passed in rather than looked up.
+//
+
+void
+lprintMetricsTraceWrite(
+    void   *trace,			// I - Trace
+    double start,			// I - Start time in seconds
+    double secs,			// I - Duration in seconds
+    size_t bytes)			// I - Number of bytes written
+{
+  add_event((lprint_trace_t *)trace, LPRINT_TTID_WRITER, "device", "write", start, secs, "\"bytes\":%lu", (unsigned long)bytes);
+}
+
+
+//
+// 'lprintMetricsUI()' - Show the server metrics.
+//
+// The metrics use the Prometheus text exposition format.
+//
+
+bool					// O - `true` on success, `false` on failure
+lprintMetricsUI(
+    pappl_client_t *client,		// I - Client
+    pappl_system_t *system)		// I - System
+{
+  lprint_msnapshot_t	snapshot;	// Printers
+  lprint_mprinter_t	*p,		// Current printer
+			*q;		// Printer with the same driver
+  size_t		i, j,		// Looping vars
+			raster_bytes,	// Dithered bytes for driver
+			written_bytes;	// Bytes written for driver
+  char			name[1024];	// Escaped label value
+
+
+  memset(&snapshot, 0, sizeof(snapshot));
+  papplSystemIteratePrinters(system, (pappl_printer_iter_cb_t)collect_cb, &snapshot);
+
+  if (!papplClientRespond(client, HTTP_STATUS_OK, NULL, "text/plain; version=0.0.4", 0, 0))
+  {
+    free(snapshot.printers);
+    return (false);
+  }
+
+  write_counter(client, &snapshot, "lprint_jobs_total", "Jobs finished", offsetof(lprint_pmetrics_t, jobs));
+  write_counter(client, &snapshot, "lprint_pages_total", "Pages printed", offsetof(lprint_pmetrics_t, pages));
+  write_counter(client, &snapshot, "lprint_labels_total", "Labels printed, including copies", offsetof(lprint_pmetrics_t, labels));
+  write_counter(client, &snapshot, "lprint_written_bytes_total", "Bytes written to the printer", offsetof(lprint_pmetrics_t, written_bytes));
+
+  write_histogram(client, &snapshot, "lprint_dither_seconds", "Time spent dithering each page", offsetof(lprint_pmetrics_t, dither));
+  write_histogram(client, &snapshot, "lprint_encode_seconds", "Time spent encoding each page, excluding dithering", offsetof(lprint_pmetrics_t, encode));
+  write_histogram(client, &snapshot, "lprint_write_seconds", "Time spent in each write to the printer", offsetof(lprint_pmetrics_t, write));
+  write_histogram(client, &snapshot, "lprint_status_seconds", "Time spent querying the printer status", offsetof(lprint_pmetrics_t, status));
+
+  // Compression ratio for each driver, from the raster jobs that were not
+  // sent from the output cache...
+  write_header(client, "lprint_compression_ratio", "gauge", "Bytes written divided by dithered bytes");
+
+  for (i = snapshot.num_printers, p = snapshot.printers; i > 0; i --, p ++)
+  {
+    for (q = snapshot.printers; q < p; q ++)
+    {
+      if (!strcmp(q->driver_name, p->driver_name))
+        break;
+    }
+
+    if (q < p)
+      continue;				// Already reported this driver
+
+    for (j = i, q = p, raster_bytes = 0, written_bytes = 0; j > 0; j --, q ++)
+    {
+      if (!strcmp(q->driver_name, p->driver_name))
+      {
+        raster_bytes  += q->metrics.raster_bytes;
+        written_bytes += q->metrics.written_bytes;
+      }
+    }
+
+    if (raster_bytes > 0)
+      papplClientPrintf(client, "lprint_compression_ratio{driver=\"%s\"} %.4f\n", escape_label(p->driver_name, name, sizeof(name)), (double)written_bytes / (double)raster_bytes);
+  }
+
+  // Current printer state...
+  write_header(client, "lprint_printer_state", "gauge", "Current printer-state value (3=idle, 4=processing, 5=stopped)");
+
+  for (i = snapshot.num_printers, p = snapshot.printers; i > 0; i --, p ++)
+    papplClientPrintf(client, "lprint_printer_state{printer=\"%s\"} %d\n", escape_label(p->name, name, sizeof(name)), (int)p->state);
+
+  write_header(client, "lprint_printer_state_reason", "gauge", "Current printer-state-reasons values");
+
+  for (i = snapshot.num_printers, p = snapshot.printers; i > 0; i --, p ++)
+  {
+    for (j = 0; j < (sizeof(metrics_reasons) / sizeof(metrics_reasons[0])); j ++)
+    {
+      if (p->reasons & metrics_reasons[j].value)
+        papplClientPrintf(client, "lprint_printer_state_reason{printer=\"%s\",reason=\"%s\"} 1\n", escape_label(p->name, name, sizeof(name)), metrics_reasons[j].keyword);
+    }
+  }
+
+  httpWrite(papplClientGetHTTP(client), "", 0);
+
+  free(snapshot.printers);
+
+  return (true);
+}
+
+
+//
+// 'lprintMetricsWrap()' - Measure the driver callbacks for a printer.
+//
+// The driver's callbacks are saved in the per-printer data and replaced with
+// callbacks that time them.  The status callback is saved with the printer
+// metrics so that status polls don't need to copy the driver data.
+//
+
+void
+lprintMetricsWrap(
+    pappl_printer_t        *printer,	// I - Printer
+    pappl_pr_driver_data_t *data,	// I - Driver data
+    lprint_cmedia_t        *cmedia)	// I - Per-printer data
+{
+  lprint_pmetrics_t	*metrics;	// Printer metrics
+
+
+
+  if (data->rstartjob_cb && data->rstartjob_cb != metrics_rstartjob)
+  {
+    cmedia->rstartjob_cb  = data->rstartjob_cb;
+    cmedia->rstartpage_cb = data->rstartpage_cb;
+    cmedia->rwriteline_cb = data->rwriteline_cb;
+    cmedia->rendpage_cb   = data->rendpage_cb;
+    cmedia->rendjob_cb    = data->rendjob_cb;
+
+    data->rstartjob_cb  = metrics_rstartjob;
+    data->rstartpage_cb = metrics_rstartpage;
+    data->rwriteline_cb = metrics_rwriteline;
+    data->rendpage_cb   = metrics_rendpage;
+    data->rendjob_cb    = metrics_rendjob;
+  }
+
+  if (data->status_cb && data->status_cb != metrics_status)
+  {
+    pthread_mutex_lock(&metrics_mutex);
+
+    if ((metrics = find_metrics(papplPrinterGetID(printer))) != NULL)
+    {
+      metrics->status_cb = data->status_cb;
+      metrics->cmedia    = cmedia;
+      data->status_cb    = metrics_status;
+    }
+
+    pthread_mutex_unlock(&metrics_mutex);
+  }
+}
+
+
+//
+// 'add_event()' - Add an event to a pipeline trace.
+//
+
+static void
+add_event(lprint_trace_t *trace,	// I - Trace
+          int            tid,		// I - Event "thread"
+          const char     *cat,		// I - Event category
+          const char     *name,		// I - Event name
+          double         start,		// I - Start time in seconds
+          double         secs,		// I - Duration in seconds
+          const char     *format,	// I - Printf-style format for JSON arguments or `NULL`
+          ...)				// I - Additional arguments as needed
+{
+  lprint_tevent_t	*event;		// New event
+  va_list		ap;		// Pointer to additional arguments
+
+
+  pthread_mutex_lock(&trace->mutex);
+
+  if (trace->num_events >= trace->alloc_events)
+  {
+    size_t		alloc_events = trace->alloc_events ? 2 * trace->alloc_events : 256;
+					// New allocation
+    lprint_tevent_t	*events;	// New events
+
+    if ((events = (lprint_tevent_t *)realloc(trace->events, alloc_events * sizeof(lprint_tevent_t))) == NULL)
+    {
+      pthread_mutex_unlock(&trace->mutex);
+      return;
+    }
+
+    trace->events       = events;
+    trace->alloc_events = alloc_events;
+  }
+
+  event = trace->events + trace->num_events;
+  trace->num_events ++;
+
+  papplCopyString(event->name, name, sizeof(event->name));
+  event->cat   = cat;
+  event->tid   = tid;
+  event->start = start;
+  event->secs  = secs > 0.0 ? secs : 0.0;
+
+  if (format)
+  {
+    va_start(ap, format);
+    vsnprintf(event->args, sizeof(event->args), format, ap);
+    va_end(ap);
+  }
+  else
+  {
+    event->args[0] = '\0';
+  }
+
+  pthread_mutex_unlock(&trace->mutex);
+}
+
+
+//
+// 'add_histogram()' - Add one histogram to another.
+//
+
+static void
+add_histogram(
+    lprint_histogram_t       *dst,	// I - Destination histogram
+    const lprint_histogram_t *src)	// I - Source histogram
+{
+  int	i;				// Looping var
+
+
+  for (i = 0; i < LPRINT_METRICS_BUCKETS; i ++)
+    dst->buckets[i] += src->buckets[i];
+
+  dst->count += src->count;
+  dst->sum   += src->sum;
+}
+
+
+//
+// 'collect_cb()' - Copy the metrics and state of a printer.
+//
+
+static void
+collect_cb(
+    pappl_printer_t    *printer,	// I - Printer
+    lprint_msnapshot_t *snapshot)	// I - Snapshot
+{
+  lprint_mprinter_t	*p;		// Printer snapshot
+  lprint_pmetrics_t	*metrics;	// Printer metrics
+
+
+  if (snapshot->num_printers >= snapshot->alloc_printers)
+  {
+    if ((p = (lprint_mprinter_t *)realloc(snapshot->printers, (snapshot->alloc_printers + 8) * sizeof(lprint_mprinter_t))) == NULL)
+      return;
+
+    snapshot->printers       = p;
+    snapshot->alloc_printers += 8;
+  }
+
+  p = snapshot->printers + snapshot->num_printers;
+
+  memset(p, 0, sizeof(lprint_mprinter_t));
+  papplCopyString(p->name, papplPrinterGetName(printer), sizeof(p->name));
+  papplCopyString(p->driver_name, papplPrinterGetDriverName(printer), sizeof(p->driver_name));
+  p->state   = papplPrinterGetState(printer);
+  p->reasons = papplPrinterGetReasons(printer);
+
+  pthread_mutex_lock(&metrics_mutex);
+  if ((metrics = find_metrics(papplPrinterGetID(printer))) != NULL)
+    p->metrics = *metrics;
+  pthread_mutex_unlock(&metrics_mutex);
+
+  snapshot->num_printers ++;
+}
+
+
+//
+// 'compare_metrics()' - Compare the printer IDs of two metrics.
+//
+
+static int				// O - Result of comparison
+compare_metrics(lprint_pmetrics_t *a,	// I - First metrics
+                lprint_pmetrics_t *b,	// I - Second metrics
+                void              *data)// I - Callback data (not used)
+{
+  (void)data;
+
+  return (a->printer_id - b->printer_id);
+}
+
+
+//
+// 'escape_label()' - Escape a label value.
+//
+
+static char *				// O - Escaped value
+escape_label(const char *s,		// I - Value
+             char       *buffer,	// I - Buffer
+             size_t     bufsize)	// I - Size of buffer
+{
+  char	*bufptr,			// Pointer into buffer
+	*bufend = buffer + bufsize - 3;	// End of buffer
+
+
+  for (bufptr = buffer; s && *s && bufptr < bufend; s ++)
+  {
+    if (*s == '\\' || *s == '\"')
+    {
+      *bufptr++ = '\\';
+      *bufptr++ = *s;
+    }
+    else if (*s == '\n')
+    {
+      *bufptr++ = '\\';
+      *bufptr++ = 'n';
+    }
+    else
+    {
+      *bufptr++ = *s;
+    }
+  }
+
+  *bufptr = '\0';
+
+  return (buffer);
+}
+
+
+//
+// 'find_metrics()' - Find or add the metrics for a printer.
+//
+// Call with `metrics_mutex` held.
+//
+
+static lprint_pmetrics_t *		// O - Printer metrics or `NULL` on error
+find_metrics(int printer_id)		// I - Printer ID
+{
+  lprint_pmetrics_t	key,		// Search key
+			*metrics;	// Printer metrics
+
+
+  if (!metrics_printers && (metrics_printers = cupsArrayNew((cups_array_cb_t)compare_metrics, NULL, NULL, 0, NULL, (cups_afree_cb_t)free)) == NULL)
+    return (NULL);
+
+  key.printer_id = printer_id;
+
+  if ((metrics = (lprint_pmetrics_t *)cupsArrayFind(metrics_printers, &key)) == NULL)
+  {
+    if ((metrics = (lprint_pmetrics_t *)calloc(1, sizeof(lprint_pmetrics_t))) == NULL)
+      return (NULL);
+
+    metrics->printer_id = printer_id;
+    cupsArrayAdd(metrics_printers, metrics);
+  }
+
+  return (metrics);
+}
+
+
+//
+// 'flush_lines()' - Add the current write line batch to the pipeline trace.
+//
+
+static void
+flush_lines(lprint_mjob_t *mjob)	// I - Job metrics
+{
+  lprint_trace_t	*trace = mjob->trace;
+					// Pipeline trace
+
+
+  if (trace->batch_lines == 0)
+    return;
+
+  add_event(trace, LPRINT_TTID_JOB, "driver", "rwriteline", trace->batch_start, trace->batch_end - trace->batch_start, "\"y\":%u,\"lines\":%u,\"busy_ms\":%.3f,\"dither_ms\":%.3f", trace->batch_y, trace->batch_lines, 1000.0 * trace->batch_secs, 1000.0 * (mjob->dither_secs - trace->batch_dither));
+
+  trace->batch_lines = 0;
+}
+
+
+//
+// 'free_job()' - Free the metrics and pipeline trace for a job.
+//
+
+static void
+free_job(lprint_mjob_t *mjob)		// I - Job metrics
+{
+  lprint_trace_t	*trace;		// Pipeline trace
+
+
+  if ((trace = mjob->trace) != NULL)
+  {
+    // Stop status queries from adding events...
+    pthread_mutex_lock(&metrics_mutex);
+    if (trace->cmedia->trace_data == trace)
+      trace->cmedia->trace_data = NULL;
+    pthread_mutex_unlock(&metrics_mutex);
+
+    pthread_mutex_destroy(&trace->mutex);
+    free(trace->events);
+    free(trace);
+  }
+
+  free(mjob);
+}
+
+
+//
+// 'get_job()' - Get the metrics for the current job.
+//
+// Jobs are processed in their own thread, so the metrics and the driver's
+// callbacks are kept in thread-local storage.
+//
+
+static lprint_mjob_t *			// O - Job metrics or `NULL` on error
+get_job(pappl_job_t *job)		// I - Job
+{
+  lprint_mjob_t		*mjob;		// Job metrics
+  pappl_pr_driver_data_t data;		// Driver data
+  lprint_cmedia_t	*cmedia;	// Per-printer data
+
+
+  pthread_once(&metrics_once, init_key);
+
+  if ((mjob = (lprint_mjob_t *)pthread_getspecific(metrics_key)) != NULL)
+  {
+    if (mjob->job == job)
+      return (mjob);
+
+    pthread_setspecific(metrics_key, NULL);
+    free_job(mjob);
+  }
+
+  papplPrinterGetDriverData(papplJobGetPrinter(job), &data);
+
+  if ((cmedia = (lprint_cmedia_t *)data.extension) == NULL || !cmedia->rstartjob_cb)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Driver callbacks not available.");
+    return (NULL);
+  }
+
+  if ((mjob = (lprint_mjob_t *)calloc(1, sizeof(lprint_mjob_t))) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to allocate memory for job metrics.");
+    return (NULL);
+  }
+
+  mjob->job           = job;
+  mjob->rstartjob_cb  = cmedia->rstartjob_cb;
+  mjob->rstartpage_cb = cmedia->rstartpage_cb;
+  mjob->rwriteline_cb = cmedia->rwriteline_cb;
+  mjob->rendpage_cb   = cmedia->rendpage_cb;
+  mjob->rendjob_cb    = cmedia->rendjob_cb;
+
+  if (cmedia->trace && (mjob->trace = (lprint_trace_t *)calloc(1, sizeof(lprint_trace_t))) != NULL)
+  {
+    // Start the pipeline trace with the time spent waiting in the queue and
+    // preparing the job...
+    lprint_trace_t	*trace = mjob->trace;
+					// Pipeline trace
+    time_t		curtime = time(NULL),
+					// Current wall clock time
+			created = papplJobGetTimeCreated(job),
+					// Time job was created
+			processed = papplJobGetTimeProcessed(job);
+					// Time job was started
+    double		now = get_time();// Current monotonic time
+
+    if (processed < created || processed > curtime)
+      processed = curtime;
+
+    pthread_mutex_init(&trace->mutex, NULL);
+
+    trace->cmedia = cmedia;
+    trace->origin = now - (double)(curtime - created);
+
+    add_event(trace, LPRINT_TTID_JOB, "job", "queued", trace->origin, (double)(processed - created), NULL);
+    add_event(trace, LPRINT_TTID_JOB, "job", "prepare", trace->origin + (double)(processed - created), now - trace->origin - (double)(processed - created), NULL);
+
+    pthread_mutex_lock(&metrics_mutex);
+    cmedia->trace_data = trace;
+    pthread_mutex_unlock(&metrics_mutex);
+  }
+
+  pthread_setspecific(metrics_key, mjob);
+
+  return (mjob);
+}
+
+
+//
+// 'get_time()' - Get the current monotonic time in seconds.
+//
+
+static double				// O - Time in seconds
+get_time(void)
+{
+  struct timespec	curtime;	// Current time
+
+
+  clock_gettime(CLOCK_MONOTONIC, &curtime);
+
+  return (curtime.tv_sec + 0.000000001 * curtime.tv_nsec);
+}
+
+
+//
+// 'init_key()' - Create the thread-local key for job metrics.
+//
+
+static void
+init_key(void)
+{
+  pthread_key_create(&metrics_key, (void (*)(void *))free_job);
+}
+
+
+//
+// 'metrics_rendjob()' - End a job and save its metrics.
+//
+
+static bool				// O - `true` on success, `false` on failure
+metrics_rendjob(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device)		// I - Output device
+{
+  lprint_mjob_t		*mjob;		// Job metrics
+  lprint_pmetrics_t	*metrics;	// Printer metrics
+  double		start,		// Start time
+			end;		// End time
+  bool			ret;		// Return value
+
+
+  if ((mjob = get_job(job)) == NULL)
+    return (false);
+
+  start = get_time();
+  ret   = (mjob->rendjob_cb)(job, options, device);
+
+  if (mjob->trace)
+  {
+    end = get_time();
+
+    add_event(mjob->trace, LPRINT_TTID_JOB, "driver", "rendjob", start, end - start, NULL);
+    add_event(mjob->trace, LPRINT_TTID_JOB, "job", "print", mjob->trace->job_start, end - mjob->trace->job_start, "\"ok\":%s", ret ? "true" : "false");
+  }
+
+  pthread_mutex_lock(&metrics_mutex);
+
+  if ((metrics = find_metrics(papplPrinterGetID(papplJobGetPrinter(job)))) != NULL)
+  {
+    if (mjob->written_bytes > 0)
+    {
+      metrics->raster_bytes  += mjob->raster_bytes;
+      metrics->written_bytes += mjob->written_bytes;
+    }
+
+    add_histogram(&metrics->dither, &mjob->dither);
+    add_histogram(&metrics->encode, &mjob->encode);
+    add_histogram(&metrics->write, &mjob->write);
+  }
+
+  if (mjob->trace && mjob->trace->cmedia->trace_data == mjob->trace)
+    mjob->trace->cmedia->trace_data = NULL;
+
+  pthread_mutex_unlock(&metrics_mutex);
+
+  if (mjob->trace)
+    write_trace(job, mjob->trace);
+
+  pthread_setspecific(metrics_key, NULL);
+  free_job(mjob);
+
+  return (ret);
+}
+
+
+//
+// 'metrics_rendpage()' - End a page and record its dither and encode times.
+//
+
+static bool				// O - `true` on success, `false` on failure
+metrics_rendpage(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device,		// I - Output device
+    unsigned           page)		// I - Page number
+{
+  lprint_mjob_t	*mjob;			// Job metrics
+  double	start,			// Start time
+		end;			// End time
+  bool		ret;			// Return value
+
+
+  if ((mjob = get_job(job)) == NULL)
+    return (false);
+
+  if (mjob->trace)
+    flush_lines(mjob);
+
+  start = get_time();
+  ret   = (mjob->rendpage_cb)(job, options, device, page);
+  end   = get_time();
+
+  mjob->page_secs += end - start;
+
+  LPRINT_PROBE4(rendpage, papplJobGetID(job), page, mjob->page_bytes, (long long)(1000000000.0 * (end - start)));
+
+  if (mjob->trace)
+  {
+    char	name[32];		// Event name
+
+    snprintf(name, sizeof(name), "page %u", page + 1);
+
+    add_event(mjob->trace, LPRINT_TTID_JOB, "driver", "rendpage", start, end - start, "\"page\":%u", page + 1);
+    add_event(mjob->trace, LPRINT_TTID_JOB, "job", name, mjob->trace->page_start, end - mjob->trace->page_start, "\"raster_bytes\":%lu,\"dither_ms\":%.3f,\"driver_ms\":%.3f", (unsigned long)mjob->page_bytes, 1000.0 * mjob->dither_secs, 1000.0 * mjob->page_secs);
+  }
+
+  // Pages sent from the output cache are not dithered or encoded...
+  if (mjob->page_bytes > 0)
+  {
+    lprintMetricsObserve(&mjob->dither, mjob->dither_secs);
+    lprintMetricsObserve(&mjob->encode, mjob->page_secs > mjob->dither_secs ? mjob->page_secs - mjob->dither_secs : 0.0);
+
+    mjob->raster_bytes += mjob->page_bytes;
+  }
+
+  mjob->page_secs   = 0.0;
+  mjob->dither_secs = 0.0;
+  mjob->page_bytes  = 0;
+
+  return (ret);
+}
+
+
+//
+// 'metrics_rstartjob()' - Start a job.
+//
+
+static bool				// O - `true` on success, `false` on failure
+metrics_rstartjob(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device)		// I - Output device
+{
+  lprint_mjob_t	*mjob;			// Job metrics
+  double	start;			// Start time
+  bool		ret;			// Return value
+
+
+  if ((mjob = get_job(job)) == NULL)
+    return (false);
+
+  if (!mjob->trace)
+    return ((mjob->rstartjob_cb)(job, options, device));
+
+  start = get_time();
+  ret   = (mjob->rstartjob_cb)(job, options, device);
+
+  mjob->trace->job_start = start;
+
+  add_event(mjob->trace, LPRINT_TTID_JOB, "driver", "rstartjob", start, get_time() - start, "\"ok\":%s", ret ? "true" : "false");
+
+  return (ret);
+}
+
+
+//
+// 'metrics_rstartpage()' - Start a page.
+//
+
+static bool				// O - `true` on success, `false` on failure
+metrics_rstartpage(
+    pappl_job_t        *job,		// I - Job
+    pappl_pr_options_t *options,	// I - Job options
+    pappl_device_t     *device,		// I - Output device
+    unsigned           page)		// I - Page number
+{
+  lprint_mjob_t	*mjob;			// Job metrics
+  double	start,			// Start time
+		end;			// End time
+  bool		ret;			// Return value
+
+
+  if ((mjob = get_job(job)) == NULL)
+    return (false);
+
+  start = get_time();
+  ret   = (mjob->rstartpage_cb)(job, options, device, page);
+  end   = get_time();
+
+  mjob->page_secs += end - start;
+
+  if (mjob->trace)
+  {
+    mjob->trace->page_start = start;
+
+    add_event(mjob->trace, LPRINT_TTID_JOB, "driver", "rstartpage", start, end - start, "\"page\":%u", page + 1);
+  }
+
+  return (ret);
+}
+
+
+//
+// 'metrics_rwriteline()' - Write a line.
+//
+
+static bool				// O - `true` on success, `false` on failure
+metrics_rwriteline(
+    pappl_job_t         *job,		// I - Job
+    pappl_pr_options_t  *options,	// I - Job options
+    pappl_device_t      *device,	// I - Output device
+    unsigned            y,		// I - Line number
+    const unsigned char *line)		// I - Line
+{
+  lprint_mjob_t	*mjob;			// Job metrics
+  lprint_trace_t *trace;		// Pipeline trace
+  double	start,			// Start time
+		end;			// End time
+  bool		ret;			// Return value
+
+
+  if ((mjob = get_job(job)) == NULL)
+    return (false);
+
+  start = get_time();
+  ret   = (mjob->rwriteline_cb)(job, options, device, y, line);
+  end   = get_time();
+
+  mjob->page_secs += end - start;
+
+  LPRINT_PROBE3(rwriteline, papplJobGetID(job), y, (long long)(1000000000.0 * (end - start)));
+
+  if ((trace = mjob->trace) != NULL)
+  {
+    // Lines are traced in batches to keep the trace a manageable size...
+    if (trace->batch_lines == 0)
+    {
+      trace->batch_start  = start;
+      trace->batch_secs   = 0.0;
+      trace->batch_dither = mjob->dither_secs;
+      trace->batch_y      = y;
+    }
+
+    trace->batch_end  = end;
+    trace->batch_secs += end - start;
+    trace->batch_lines ++;
+
+    if (trace->batch_lines >= LPRINT_TRACE_LINES)
+      flush_lines(mjob);
+  }
+
+  return (ret);
+}
+
+
+//
+// 'metrics_status()' - Get the printer status and record the query time.
+//
+
+static bool				// O - `true` on success, `false` on failure
+metrics_status(
+    pappl_printer_t *printer)		// I - Printer
+{
+  pappl_pr_status_cb_t	status_cb = NULL;
+					// Driver status callback
+  lprint_pmetrics_t	*metrics;	// Printer metrics
+  double		start,		// Start time
+			secs;		// Query time
+  bool			ret;		// Return value
+
+
+  pthread_mutex_lock(&metrics_mutex);
+  if ((metrics = find_metrics(papplPrinterGetID(printer))) != NULL)
+    status_cb = metrics->status_cb;
+  pthread_mutex_unlock(&metrics_mutex);
+
+  if (!status_cb)
+    return (true);
+
+  start = get_time();
+  ret   = (status_cb)(printer);
+  secs  = get_time() - start;
+
+  LPRINT_PROBE3(status, papplPrinterGetID(printer), ret, (long long)(1000000000.0 * secs));
+
+  // The metrics for a printer are never freed, so the pointer is still good...
+  pthread_mutex_lock(&metrics_mutex);
+  lprintMetricsObserve(&metrics->status, secs);
+  if (metrics->cmedia->trace_data)
+    add_event((lprint_trace_t *)metrics->cmedia->trace_data, LPRINT_TTID_STATUS, "status", "status", start, secs, "\"ok\":%s", ret ? "true" : "false");
+  pthread_mutex_unlock(&metrics_mutex);
+
+  return (ret);
+}
+
+
+//
+// 'write_counter()' - Write a per-printer counter.
+//
+// The "lprint_jobs_total" counter has three values for the job state.
+//
+
+static void
+write_counter(
+    pappl_client_t     *client,		// I - Client
+    lprint_msnapshot_t *snapshot,	// I - Snapshot
+    const char         *name,		// I - Metric name
+    const char         *help,		// I - Description
+    size_t             offset)		// I - Offset of value in printer metrics
+{
+  size_t		i;		// Looping var
+  lprint_mprinter_t	*p;		// Current printer
+  const size_t		*value;		// Value(s)
+  char			pname[1024];	// Escaped printer name
+
+
+  write_header(client, name, "counter", help);
+
+  for (i = snapshot->num_printers, p = snapshot->printers; i > 0; i --, p ++)
+  {
+    value = (const size_t *)((const char *)&p->metrics + offset);
+
+    escape_label(p->name, pname, sizeof(pname));
+
+    if (offset == offsetof(lprint_pmetrics_t, jobs))
+    {
+      papplClientPrintf(client, "%s{printer=\"%s\",state=\"completed\"} %lu\n", name, pname, (unsigned long)value[0]);
+      papplClientPrintf(client, "%s{printer=\"%s\",state=\"canceled\"} %lu\n", name, pname, (unsigned long)value[1]);
+      papplClientPrintf(client, "%s{printer=\"%s\",state=\"aborted\"} %lu\n", name, pname, (unsigned long)value[2]);
+    }
+    else
+    {
+      papplClientPrintf(client, "%s{printer=\"%s\"} %lu\n", name, pname, (unsigned long)*value);
+    }
+  }
+}
+
+
+//
+// 'write_header()' - Write the help and type lines for a metric.
+//
+
+static void
+write_header(pappl_client_t *client,	// I - Client
+             const char     *name,	// I - Metric name
+             const char     *type,	// I - Metric type
+             const char     *help)	// I - Description
+{
+  papplClientPrintf(client, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+//
+// 'write_histogram()' - Write a per-printer histogram.
+//
+
+static void
+write_histogram(
+    pappl_client_t     *client,		// I - Client
+    lprint_msnapshot_t *snapshot,	// I - Snapshot
+    const char         *name,		// I - Metric name
+    const char         *help,		// I - Description
+    size_t             offset)		// I - Offset of histogram in printer metrics
+{
+  size_t		i;		// Looping var
+  int			j;		// Looping var
+  lprint_mprinter_t	*p;		// Current printer
+  const lprint_histogram_t *hist;	// Histogram
+  size_t		count;		// Cumulative count
+  char			pname[1024];	// Escaped printer name
+
+
+  write_header(client, name, "histogram", help);
+
+  for (i = snapshot->num_printers, p = snapshot->printers; i > 0; i --, p ++)
+  {
+    hist = (const lprint_histogram_t *)((const char *)&p->metrics + offset);
+
+    escape_label(p->name, pname, sizeof(pname));
+
+    for (j = 0, count = 0; j < LPRINT_METRICS_BUCKETS; j ++)
+    {
+      count += hist->buckets[j];
+      papplClientPrintf(client, "%s_bucket{printer=\"%s\",le=\"%g\"} %lu\n", name, pname, metrics_bounds[j], (unsigned long)count);
+    }
+
+    papplClientPrintf(client, "%s_bucket{printer=\"%s\",le=\"+Inf\"} %lu\n", name, pname, (unsigned long)hist->count);
+    papplClientPrintf(client, "%s_sum{printer=\"%s\"} %.6f\n", name, pname, hist->sum);
+    papplClientPrintf(client, "%s_count{printer=\"%s\"} %lu\n", name, pname, (unsigned long)hist->count);
+  }
+}
+
+
+//
+// 'write_trace()' - Write the pipeline trace for a job.
+//
+// The trace uses the Chrome trace event JSON format with times in
+// microseconds from the creation of the job.
+//
+
+static void
+write_trace(pappl_job_t    *job,	// I - Job
+            lprint_trace_t *trace)	// I - Pipeline trace
+{
+  pappl_printer_t	*printer = papplJobGetPrinter(job);
+					// Printer
+  int			pid = papplPrinterGetID(printer);
+					// Trace "process" ID
+  int			fd;		// Trace file descriptor
+  cups_file_t		*fp;		// Trace file
+  char			resname[64],	// Resource name
+			filename[1024],	// Trace filename
+			name[1024];	// Escaped printer name
+  size_t		i;		// Looping var
+  lprint_tevent_t	*event;		// Current event
+
+
+  snprintf(resname, sizeof(resname), "job-%d-trace", papplJobGetID(job));
+
+  if ((fd = papplPrinterOpenFile(printer, filename, sizeof(filename), /*directory*/NULL, resname, "json", "w")) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create trace file '%s': %s", filename, strerror(errno));
+    return;
+  }
+
+  if ((fp = cupsFileOpenFd(fd, "w")) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create trace file '%s': %s", filename, strerror(errno));
+    close(fd);
+    return;
+  }
+
+  // Name the printer and each of its event "threads" (the label escapes work
+  // for JSON strings as well)...
+  cupsFilePrintf(fp, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", pid, LPRINT_TTID_JOB, escape_label(papplPrinterGetName(printer), name, sizeof(name)));
+  cupsFilePrintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"Job %d\"}}", pid, LPRINT_TTID_JOB, papplJobGetID(job));
+  cupsFilePrintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"Device Writes\"}}", pid, LPRINT_TTID_WRITER);
+  cupsFilePrintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"Status Queries\"}}", pid, LPRINT_TTID_STATUS);
+
+  // Then write the events...
+  for (i = trace->num_events, event = trace->events; i > 0; i --, event ++)
+    cupsFilePrintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{%s}}", event->name, event->cat, 1000000.0 * (event->start - trace->origin), 1000000.0 * event->secs, pid, event->tid, event->args);
+
+  cupsFilePuts(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+  if (cupsFileClose(fp))
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to write trace file '%s': %s", filename, strerror(errno));
+  else
+    papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Wrote pipeline trace to '%s'.", filename);
+}
@@ -43,6 +43,7 @@ typedef struct lprint_sii_s		// SII driver data
   unsigned	max_width;		// Maximum width in dots
   int		blanks;			// Blank lines
   lprint_dither_t dither;		// Dither buffer
+  lprint_buffer_t buffer;		// Output buffer
 } lprint_sii_t;
 
 
@@ -204,21 +205,28 @@ lprint_sii_init(
 
   // Initialize driver data and save it...
   siidata->max_width = lprint_sii_get_max_width(driver_name);
-  switch (atoi(driver_name + 7))
-  {
-    case 100 :
-    case 410 :
-	// Reset printer...
-	papplDevicePrintf(device, "%c", LPRINT_SLP_CMD_RESET);
-	papplDeviceFlush(device);
-	sleep(3);
-	break;
 
-    default :
-        // Nothing else to do...
-        break;
+  // Reset the printer unless it just finished another job...
+  if (!lprintSessionStart(job, NULL))
+  {
+    switch (atoi(driver_name + 7))
+    {
+      case 100 :
+      case 410 :
+	  // Reset printer...
+	  papplDevicePrintf(device, "%c", LPRINT_SLP_CMD_RESET);
+	  papplDeviceFlush(device);
+	  sleep(3);
+	  break;
+
+      default :
+          // Nothing else to do...
+          break;
+    }
   }
 
+  lprintBufferInit(&siidata->buffer, device);
+
   papplJobSetData(job, siidata);
 }
 
@@ -242,6 +250,10 @@ lprint_sii_printfile(
   // Initialize driver data...
   lprint_sii_init(job, options, device, &siidata);
 
+  // Raw data can change any printer setting, so don't let the next job skip
+  // its reset...
+  lprintSessionStart(job, "raw");
+
   // Copy the raw file...
   papplJobSetImpressions(job, 1);
 
@@ -253,12 +265,17 @@ lprint_sii_printfile(
 
   while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
   {
+    LPRINT_PROBE2(raw_write_start, papplJobGetID(job), bytes);
+
     if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
     {
+      LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 0);
       papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
       close(fd);
       return (false);
     }
+
+    LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 1);
   }
   close(fd);
 
@@ -282,6 +299,9 @@ lprint_sii_rendjob(
 					// SII driver data
 
   (void)options;
+  (void)device;
+
+  lprintBufferFinish(&siidata->buffer, job);
 
   free(siidata);
   papplJobSetData(job, NULL);
@@ -303,16 +323,31 @@ lprint_sii_rendpage(
 {
   lprint_sii_t	*siidata = (lprint_sii_t *)papplJobGetData(job);
 					// SII driver data
+  unsigned	copy;			// Current copy
 
 
   (void)page;
 
+  // Nothing more to send if the output came from the cache...
+  if (siidata->buffer.cached)
+    return (true);
+
   // Write last line
   lprint_sii_rwriteline(job, options, device, options->header.cupsHeight, NULL);
 
   // Eject
-  papplDevicePrintf(device, "%c", LPRINT_SLP_CMD_FORMFEED);
-  papplDeviceFlush(device);
+  lprintBufferPrintf(&siidata->buffer, "%c", LPRINT_SLP_CMD_FORMFEED);
+
+  if (siidata->buffer.recording)
+  {
+    // Send the same page data for each additional copy...
+    lprintBufferRecord(&siidata->buffer, false);
+
+    for (copy = 1; copy < options->header.NumCopies; copy ++)
+      lprintBufferReplay(&siidata->buffer);
+  }
+
+  lprintBufferFlush(&siidata->buffer);
 
   // Free memory and return...
   lprintDitherFree(&siidata->dither);
@@ -335,11 +370,12 @@ lprint_sii_rstartjob(
 					// SII driver data
 
 
-  (void)options;
-
   // Initialize driver data...
   lprint_sii_init(job, options, device, siidata);
 
+  // Send the cached output for identical jobs...
+  lprintCacheStart(&siidata->buffer, job, options);
+
   return (true);
 }
 
@@ -365,11 +401,19 @@ lprint_sii_rstartpage(
 
   (void)page;
 
+  // Nothing more to send if the output came from the cache...
+  if (siidata->buffer.cached)
+    return (true);
+
   // Initialize the dither buffer and blanks count...
   if (!lprintDitherAlloc(&siidata->dither, job, options, CUPS_CSPACE_K, options->header.HWResolution[0] == 300 ? 1.2 : 1.0))
     return (false);
 
-  papplDevicePrintf(device, "%c%c", LPRINT_SLP_CMD_MARGIN, (int)(12.7 * (lprint_sii_get_max_width(driver_name) - options->header.cupsWidth) / options->header.HWResolution[0]));
+  // Record the page so copies can be sent without dithering it again...
+  if (options->header.NumCopies > 1)
+    lprintBufferRecord(&siidata->buffer, true);
+
+  lprintBufferPrintf(&siidata->buffer, "%c%c", LPRINT_SLP_CMD_MARGIN, (int)(12.7 * (lprint_sii_get_max_width(driver_name) - options->header.cupsWidth) / options->header.HWResolution[0]));
 
   siidata->blanks = 0;
 
@@ -379,7 +423,7 @@ lprint_sii_rstartpage(
   else if (darkness > 100)
     darkness = 100;
 
-  papplDevicePrintf(device, "%c%c", LPRINT_SLP_CMD_DENSITY, 3 * darkness / 100);
+  lprintBufferPrintf(&siidata->buffer, "%c%c", LPRINT_SLP_CMD_DENSITY, 3 * darkness / 100);
 
   // Set quality...
   switch (atoi(driver_name + 7))
@@ -390,11 +434,11 @@ lprint_sii_rstartpage(
     case 410 :
     case 420 :
     case 430 :
-        papplDevicePrintf(device, "%c%c", LPRINT_SLP_CMD_FINEMODE, options->print_quality == IPP_QUALITY_HIGH ? 0x01 : 0x00);
+        lprintBufferPrintf(&siidata->buffer, "%c%c", LPRINT_SLP_CMD_FINEMODE, options->print_quality == IPP_QUALITY_HIGH ? 0x01 : 0x00);
         break;
 
     default :
-        papplDevicePrintf(device, "%c%c", LPRINT_SLP_CMD_SETSPEED, options->print_quality == IPP_QUALITY_HIGH ? 0x02 : 0x00);
+        lprintBufferPrintf(&siidata->buffer, "%c%c", LPRINT_SLP_CMD_SETSPEED, options->print_quality == IPP_QUALITY_HIGH ? 0x02 : 0x00);
         break;
   }
 
@@ -418,6 +462,10 @@ lprint_sii_rwriteline(
 					// SII driver data
 
 
+  // Nothing more to send if the output came from the cache...
+  if (siidata->buffer.cached)
+    return (true);
+
   // Dither...
   if (!lprintDitherLine(&siidata->dither, y, line))
     return (true);
@@ -434,24 +482,24 @@ lprint_sii_rwriteline(
   {
     if (siidata->blanks == 1)
     {
-      papplDevicePuts(device, "\n");
+      lprintBufferPuts(&siidata->buffer, "\n");
       siidata->blanks = 0;
     }
     else if (siidata->blanks < 255)
     {
-      papplDevicePrintf(device, "%c%c", LPRINT_SLP_CMD_VERTTAB, (char)siidata->blanks);
+      lprintBufferPrintf(&siidata->buffer, "%c%c", LPRINT_SLP_CMD_VERTTAB, (char)siidata->blanks);
       siidata->blanks = 0;
     }
     else
     {
-      papplDevicePrintf(device, "%c%c", LPRINT_SLP_CMD_VERTTAB, (char)255);
+      lprintBufferPrintf(&siidata->buffer, "%c%c", LPRINT_SLP_CMD_VERTTAB, (char)255);
       siidata->blanks -= 255;
     }
   }
 
   // Output bitmap data...
-  papplDevicePrintf(device, "%c%c", LPRINT_SLP_CMD_PRINT, (char)siidata->dither.out_width);
-  papplDeviceWrite(device, siidata->dither.output, siidata->dither.out_width);
+  lprintBufferPrintf(&siidata->buffer, "%c%c", LPRINT_SLP_CMD_PRINT, (char)siidata->dither.out_width);
+  lprintBufferWrite(&siidata->buffer, siidata->dither.output, siidata->dither.out_width);
 
   return (true);
 }
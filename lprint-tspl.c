@@ -17,6 +17,8 @@
 typedef struct lprint_tspl_s		// TSPL driver data
 {
   lprint_dither_t dither;		// Dither buffer
+  lprint_buffer_t buffer;		// Output buffer
+  lprint_vector_t vector;		// Page bitmap for rectangles
 } lprint_tspl_t;
 
 
@@ -91,6 +93,7 @@ static const char * const lprint_tspl_media[] =
 // Local functions...
 //
 
+static bool	lprint_tspl_is_blank(lprint_tspl_t *tspl, const unsigned char *row);
 static bool	lprint_tspl_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_tspl_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_tspl_rendpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
@@ -195,12 +198,17 @@ lprint_tspl_printfile(
 
   while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
   {
+    LPRINT_PROBE2(raw_write_start, papplJobGetID(job), bytes);
+
     if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
     {
+      LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 0);
       papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
       close(fd);
       return (false);
     }
+
+    LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 1);
   }
   close(fd);
 
@@ -226,6 +234,8 @@ lprint_tspl_rendjob(
   (void)options;
   (void)device;
 
+  lprintBufferFinish(&tspl->buffer, job);
+
   free(tspl);
   papplJobSetData(job, NULL);
 
@@ -246,19 +256,47 @@ lprint_tspl_rendpage(
 {
   lprint_tspl_t	*tspl = (lprint_tspl_t *)papplJobGetData(job);
 					// TSPL driver data
+  unsigned	first,			// First non-blank line
+		last;			// Last non-blank line
+  size_t	i;			// Looping var
+  lprint_rect_t	*rect;			// Current rectangle
 
 
   (void)page;
 
+  // Nothing more to send if the output came from the cache...
+  if (tspl->buffer.cached)
+    return (true);
+
   // Write last line
   lprint_tspl_rwriteline(job, options, device, options->header.cupsHeight, NULL);
 
+  if (tspl->vector.bitmap)
+  {
+    // Pull out solid rectangles and draw them as bars...
+    lprintVectorFind(&tspl->vector, LPRINT_VECTOR_MIN_AREA);
+
+    for (i = tspl->vector.num_rects, rect = tspl->vector.rects; i > 0; i --, rect ++)
+      lprintBufferPrintf(&tspl->buffer, "BAR %u,%u,%u,%u\n", rect->x, rect->y, rect->width, rect->height);
+
+    // Then OR the remaining non-blank lines over them...
+    for (first = 0; first < tspl->vector.height && lprint_tspl_is_blank(tspl, tspl->vector.bitmap + first * tspl->vector.width); first ++);
+    for (last = tspl->vector.height; last > first && lprint_tspl_is_blank(tspl, tspl->vector.bitmap + (last - 1) * tspl->vector.width); last --);
+
+    if (first < last)
+    {
+      lprintBufferPrintf(&tspl->buffer, "BITMAP 0,%u,%u,%u,1,", first, tspl->vector.width, last - first);
+      lprintBufferWrite(&tspl->buffer, tspl->vector.bitmap + first * tspl->vector.width, (size_t)(last - first) * tspl->vector.width);
+    }
+  }
+
   // Eject
-  papplDevicePrintf(device, "PRINT %u,1\n", options->header.NumCopies);
-  papplDeviceFlush(device);
+  lprintBufferPrintf(&tspl->buffer, "PRINT %u,1\n", options->header.NumCopies);
+  lprintBufferFlush(&tspl->buffer);
 
   // Free memory and return...
   lprintDitherFree(&tspl->dither);
+  lprintVectorFree(&tspl->vector);
 
   return (true);
 }
@@ -278,11 +316,12 @@ lprint_tspl_rstartjob(
 					// TSPL driver data
 
 
-  (void)options;
-  (void)device;
-
   // Save driver data...
   papplJobSetData(job, tspl);
+  lprintBufferInit(&tspl->buffer, device);
+
+  // Send the cached output for identical jobs...
+  lprintCacheStart(&tspl->buffer, job, options);
 
   return (true);
 }
@@ -307,6 +346,10 @@ lprint_tspl_rstartpage(
 
   (void)page;
 
+  // Nothing more to send if the output came from the cache...
+  if (tspl->buffer.cached)
+    return (true);
+
   // Initialize the dither buffer...
   if (!lprintDitherAlloc(&tspl->dither, job, options, CUPS_CSPACE_W, options->header.HWResolution[0] == 300 ? 1.2 : 1.0))
     return (false);
@@ -317,22 +360,22 @@ lprint_tspl_rstartpage(
   else if (darkness > 100)
     darkness = 100;
 
-  papplDevicePrintf(device, "SIZE %d mm,%d mm\n", options->media.size_width / 100, options->media.size_length / 100);
+  lprintBufferPrintf(&tspl->buffer, "SIZE %d mm,%d mm\n", options->media.size_width / 100, options->media.size_length / 100);
 
   switch (options->orientation_requested)
   {
     default :
     case IPP_ORIENT_PORTRAIT :
-        papplDevicePuts(device, "DIRECTION 0,0\n");
+        lprintBufferPuts(&tspl->buffer, "DIRECTION 0,0\n");
         break;
     case IPP_ORIENT_LANDSCAPE :
-        papplDevicePuts(device, "DIRECTION 90,0\n");
+        lprintBufferPuts(&tspl->buffer, "DIRECTION 90,0\n");
         break;
     case IPP_ORIENT_REVERSE_PORTRAIT :
-        papplDevicePuts(device, "DIRECTION 180,0\n");
+        lprintBufferPuts(&tspl->buffer, "DIRECTION 180,0\n");
         break;
     case IPP_ORIENT_REVERSE_LANDSCAPE :
-        papplDevicePuts(device, "DIRECTION 270,0\n");
+        lprintBufferPuts(&tspl->buffer, "DIRECTION 270,0\n");
         break;
   }
 
@@ -342,23 +385,26 @@ lprint_tspl_rstartpage(
         break;
 
     case PAPPL_MEDIA_TRACKING_CONTINUOUS :
-        papplDevicePuts(device, "GAP 0 mm,0 mm\n");
+        lprintBufferPuts(&tspl->buffer, "GAP 0 mm,0 mm\n");
         break;
     case PAPPL_MEDIA_TRACKING_MARK :
-        papplDevicePuts(device, "BLINE 3 mm,0 mm\n");
+        lprintBufferPuts(&tspl->buffer, "BLINE 3 mm,0 mm\n");
         break;
     case PAPPL_MEDIA_TRACKING_GAP :
-        papplDevicePuts(device, "GAP 3 mm,0 mm\n");
+        lprintBufferPuts(&tspl->buffer, "GAP 3 mm,0 mm\n");
         break;
   }
 
-  papplDevicePrintf(device, "DENSITY %d\n", (darkness * 15 + 50) / 100);
+  lprintBufferPrintf(&tspl->buffer, "DENSITY %d\n", (darkness * 15 + 50) / 100);
   if ((speed = options->print_speed / 2540) > 0)
-    papplDevicePrintf(device, "SPEED %d\n", speed);
+    lprintBufferPrintf(&tspl->buffer, "SPEED %d\n", speed);
+
+  // Start the page image, which is sent in rendpage when looking for
+  // rectangles...
+  lprintBufferPuts(&tspl->buffer, "CLS\n");
 
-  // Start the page image...
-  papplDevicePuts(device, "CLS\n");
-  papplDevicePrintf(device, "BITMAP 0,0,%u,%u,1,", tspl->dither.out_width, options->header.cupsHeight);
+  if (!lprintVectorAlloc(&tspl->vector, &tspl->dither))
+    lprintBufferPrintf(&tspl->buffer, "BITMAP 0,0,%u,%u,1,", tspl->dither.out_width, options->header.cupsHeight);
 
   return (true);
 }
@@ -382,9 +428,18 @@ lprint_tspl_rwriteline(
 
   (void)options;
 
+  // Nothing more to send if the output came from the cache...
+  if (tspl->buffer.cached)
+    return (true);
+
   // Dither and write the line...
-  if (lprintDitherLine(&tspl->dither, y, line))
-    papplDeviceWrite(device, tspl->dither.output, tspl->dither.out_width);
+  if (!lprintDitherLine(&tspl->dither, y, line))
+    return (true);
+
+  if (tspl->vector.bitmap)
+    lprintVectorLine(&tspl->vector, &tspl->dither, y);
+  else
+    lprintBufferWrite(&tspl->buffer, tspl->dither.output, tspl->dither.out_width);
 
   return (true);
 }
@@ -402,3 +457,16 @@ lprint_tspl_status(
 
   return (true);
 }
+
+
+//
+// 'lprint_tspl_is_blank()' - Determine whether a row of the bitmap is blank.
+//
+
+static bool				// O - `true` if blank, `false` otherwise
+lprint_tspl_is_blank(
+    lprint_tspl_t       *tspl,		// I - TSPL driver data
+    const unsigned char *row)		// I - Row of bitmap
+{
+  return (row[0] == tspl->dither.out_white && !memcmp(row, row + 1, tspl->dither.out_width - 1));
+}
@@ -50,9 +50,12 @@
 typedef struct lprint_zpl_s		// ZPL driver data
 {
   lprint_dither_t dither;		// Dither buffer
+  lprint_buffer_t buffer;		// Output buffer
+  lprint_vector_t vector;		// Page bitmap for rectangles
   unsigned char	*comp_buffer;		// Compression buffer
   unsigned char *last_buffer;		// Last line
   int		last_buffer_set;	// Is the last line set?
+  bool		compress;		// Compress graphics?
 } lprint_zpl_t;
 
 
@@ -173,7 +176,7 @@ static const char * const lprint_zpl_4inch_media[] =
 //
 
 #if ZPL_COMPRESSION
-static bool	lprint_zpl_compress(pappl_device_t *device, unsigned char ch, unsigned count);
+static bool	lprint_zpl_compress(lprint_buffer_t *outbuf, unsigned char ch, unsigned count);
 #endif // ZPL_COMPRESSION
 static bool	lprint_zpl_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool	lprint_zpl_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
@@ -183,6 +186,7 @@ static bool	lprint_zpl_rstartpage(pappl_job_t *job, pappl_pr_options_t *options,
 static bool	lprint_zpl_rwriteline(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned y, const unsigned char *line);
 static bool	lprint_zpl_status(pappl_printer_t *printer);
 static bool	lprint_zpl_update_reasons(pappl_printer_t *printer, pappl_job_t *job, pappl_device_t *device);
+static void	lprint_zpl_write_row(lprint_zpl_t *zpl, const unsigned char *row);
 
 
 //
@@ -363,7 +367,7 @@ lprintZPLQueryDriver(
 
 static bool				// O - `true` on success, `false` on failure
 lprint_zpl_compress(
-    pappl_device_t *device,		// I - Output device
+    lprint_buffer_t *outbuf,		// I - Output buffer
     unsigned char  ch,			// I - Repeat character
     unsigned       count)		// I - Repeat count
 {
@@ -382,7 +386,7 @@ lprint_zpl_compress(
 
       if (bufptr >= (buffer + sizeof(buffer)))
       {
-        if (papplDeviceWrite(device, buffer, sizeof(buffer)) < 0)
+        if (!lprintBufferWrite(outbuf, buffer, sizeof(buffer)))
           return (0);
 
 	bufptr = buffer;
@@ -404,7 +408,7 @@ lprint_zpl_compress(
   // Then the character to be repeated...
   *bufptr++ = ch;
 
-  return (papplDeviceWrite(device, buffer, bufptr - buffer) > 0);
+  return (lprintBufferWrite(outbuf, buffer, (size_t)(bufptr - buffer)));
 }
 #endif // ZPL_COMPRESSION
 
@@ -424,6 +428,10 @@ lprint_zpl_printfile(
   char		buffer[65536];		// Read/write buffer
 
 
+  // Raw data can change any printer setting, so don't let the next job skip
+  // its setup...
+  lprintSessionStart(job, "raw");
+
   // Copy the raw file...
   papplJobSetImpressions(job, 1);
 
@@ -439,12 +447,17 @@ lprint_zpl_printfile(
   // Copy print data...
   while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
   {
+    LPRINT_PROBE2(raw_write_start, papplJobGetID(job), bytes);
+
     if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
     {
+      LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 0);
       papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
       close(fd);
       return (false);
     }
+
+    LPRINT_PROBE3(raw_write_done, papplJobGetID(job), bytes, 1);
   }
   close(fd);
 
@@ -472,6 +485,9 @@ lprint_zpl_rendjob(
 
 
   (void)options;
+  (void)device;
+
+  lprintBufferFinish(&zpl->buffer, job);
 
   free(zpl);
   papplJobSetData(job, NULL);
@@ -493,13 +509,34 @@ lprint_zpl_rendpage(
 {
   lprint_zpl_t	*zpl = (lprint_zpl_t *)papplJobGetData(job);
 					// ZPL driver data
+  unsigned	y;			// Current line
+  size_t	i;			// Looping var
+  lprint_rect_t	*rect;			// Current rectangle
 
 
   (void)page;
 
+  if (zpl->buffer.cached)
+  {
+    // Output came from the cache, just update the status...
+    lprintBufferFlush(&zpl->buffer);
+    lprint_zpl_update_reasons(papplJobGetPrinter(job), job, device);
+
+    return (true);
+  }
+
   lprint_zpl_rwriteline(job, options, device, options->header.cupsHeight, NULL);
 
-  papplDevicePrintf(device, "^XA\n^POI\n^PW%u\n^LH0,0\n^LT%d\n", options->header.cupsWidth, options->media.top_offset * options->printer_resolution[1] / 2540);
+  if (zpl->vector.bitmap)
+  {
+    // Pull out solid rectangles and send the rest of the page as the bitmap...
+    lprintVectorFind(&zpl->vector, LPRINT_VECTOR_MIN_AREA);
+
+    for (y = 0; y < zpl->vector.height; y ++)
+      lprint_zpl_write_row(zpl, zpl->vector.bitmap + y * zpl->vector.width);
+  }
+
+  lprintBufferPrintf(&zpl->buffer, "^XA\n^POI\n^PW%u\n^LH0,0\n^LT%d\n", options->header.cupsWidth, options->media.top_offset * options->printer_resolution[1] / 2540);
 
   if (options->media.type[0] && strcmp(options->media.type, "labels"))
   {
@@ -510,30 +547,42 @@ lprint_zpl_rendpage(
   if (options->media.tracking)
   {
     if (options->media.tracking == PAPPL_MEDIA_TRACKING_CONTINUOUS)
-      papplDevicePrintf(device, "^LL%u\n^MNN\n", options->header.cupsHeight);
+      lprintBufferPrintf(&zpl->buffer, "^LL%u\n^MNN\n", options->header.cupsHeight);
     else if (options->media.tracking == PAPPL_MEDIA_TRACKING_WEB)
-      papplDevicePuts(device, "^MNY\n");
+      lprintBufferPuts(&zpl->buffer, "^MNY\n");
     else
-      papplDevicePuts(device, "^MNM\n");
+      lprintBufferPuts(&zpl->buffer, "^MNM\n");
   }
 
   if (strstr(papplPrinterGetDriverName(papplJobGetPrinter(job)), "-tt"))
-    papplDevicePuts(device, "^MTT\n");	// Thermal transfer
+    lprintBufferPuts(&zpl->buffer, "^MTT\n");	// Thermal transfer
   else
-    papplDevicePuts(device, "^MTD\n");	// Direct thermal
+    lprintBufferPuts(&zpl->buffer, "^MTD\n");	// Direct thermal
+
+  // Print all copies from the one downloaded bitmap...
+  lprintBufferPrintf(&zpl->buffer, "^PQ%u, 0, 0, N\n", options->header.NumCopies > 1 ? options->header.NumCopies : 1);
+  lprintBufferPuts(&zpl->buffer, "^FO0,0^XGR:LPRINT.GRF,1,1^FS\n");
 
-  papplDevicePrintf(device, "^PQ1, 0, 0, N\n");
-  papplDevicePuts(device, "^FO0,0^XGR:LPRINT.GRF,1,1^FS\n^XZ\n");
-  papplDevicePuts(device, "^XA\n^IDR:LPRINT.GRF^FS\n^XZ\n");
+  for (i = zpl->vector.num_rects, rect = zpl->vector.rects; i > 0; i --, rect ++)
+  {
+    // Draw a filled box...
+    lprintBufferPrintf(&zpl->buffer, "^FO%u,%u^GB%u,%u,%u^FS\n", rect->x, rect->y, rect->width, rect->height, rect->width < rect->height ? rect->width : rect->height);
+  }
+
+  lprintBufferPuts(&zpl->buffer, "^XZ\n");
+  lprintBufferPuts(&zpl->buffer, "^XA\n^IDR:LPRINT.GRF^FS\n^XZ\n");
 
   if (options->finishings & PAPPL_FINISHINGS_TRIM)
-    papplDevicePuts(device, "^CN1\n");
+    lprintBufferPuts(&zpl->buffer, "^CN1\n");
+
+  lprintBufferFlush(&zpl->buffer);
 
   // Update status...
   lprint_zpl_update_reasons(papplJobGetPrinter(job), job, device);
 
   // Free memory and return...
   lprintDitherFree(&zpl->dither);
+  lprintVectorFree(&zpl->vector);
 
   free(zpl->comp_buffer);
   free(zpl->last_buffer);
@@ -554,12 +603,21 @@ lprint_zpl_rstartjob(
 {
   pappl_pr_driver_data_t data;		// Driver data
   int			darkness;	// Composite darkness value
+  const char		*mode;		// Label mode command
+  char			tear[16] = "",	// Tear-off offset command
+			setup[256];	// Setup commands
   lprint_zpl_t	*zpl = (lprint_zpl_t *)calloc(1, sizeof(lprint_zpl_t));
 					// ZPL driver data
 
 
   // Initialize driver data...
   papplJobSetData(job, zpl);
+  lprintBufferInit(&zpl->buffer, device);
+
+#if ZPL_COMPRESSION
+  // Compress graphics unless the link is fast...
+  zpl->compress = lprintLinkCompress(job, "compressed ASCII hex", "ASCII hex");
+#endif // ZPL_COMPRESSION
 
   papplPrinterGetDriverData(papplJobGetPrinter(job), &data);
 
@@ -567,40 +625,40 @@ lprint_zpl_rstartjob(
   switch (data.mode_configured)
   {
     case PAPPL_LABEL_MODE_APPLICATOR :
-        papplDevicePuts(device, "^MMA,Y\n");
+        mode = "^MMA,Y\n";
         break;
     case PAPPL_LABEL_MODE_CUTTER :
-        papplDevicePuts(device, "^MMC,Y\n");
+        mode = "^MMC,Y\n";
         break;
     case PAPPL_LABEL_MODE_CUTTER_DELAYED :
-        papplDevicePuts(device, "^MMD,Y\n");
+        mode = "^MMD,Y\n";
         break;
     case PAPPL_LABEL_MODE_KIOSK :
-        papplDevicePuts(device, "^MMK,Y\n");
+        mode = "^MMK,Y\n";
         break;
     case PAPPL_LABEL_MODE_PEEL_OFF :
-        papplDevicePuts(device, "^MMP,N\n");
+        mode = "^MMP,N\n";
         break;
     case PAPPL_LABEL_MODE_PEEL_OFF_PREPEEL :
-        papplDevicePuts(device, "^MMP,Y\n");
+        mode = "^MMP,Y\n";
         break;
     case PAPPL_LABEL_MODE_REWIND :
-        papplDevicePuts(device, "^MMR,Y\n");
+        mode = "^MMR,Y\n";
         break;
     case PAPPL_LABEL_MODE_RFID :
-        papplDevicePuts(device, "^MMF,Y\n");
+        mode = "^MMF,Y\n";
         break;
     case PAPPL_LABEL_MODE_TEAR_OFF :
     default :
-        papplDevicePuts(device, "^MMT,Y\n");
+        mode = "^MMT,Y\n";
         break;
   }
 
   // label-tear-offset-configured
   if (data.tear_offset_configured < 0)
-    papplDevicePrintf(device, "~TA%04d\n", data.tear_offset_configured);
+    snprintf(tear, sizeof(tear), "~TA%04d\n", data.tear_offset_configured);
   else if (data.tear_offset_configured > 0)
-    papplDevicePrintf(device, "~TA%03d\n", data.tear_offset_configured);
+    snprintf(tear, sizeof(tear), "~TA%03d\n", data.tear_offset_configured);
 
   // print-darkness / printer-darkness-configured
   if ((darkness = options->print_darkness + options->darkness_configured) < 0)
@@ -608,7 +666,15 @@ lprint_zpl_rstartjob(
   else if (darkness > 100)
     darkness = 100;
 
-  papplDevicePrintf(device, "~SD%02u\n", 30 * darkness / 100);
+  snprintf(setup, sizeof(setup), "%s%s~SD%02u\n", mode, tear, 30 * darkness / 100);
+
+  // Send the setup commands unless the printer just finished another job
+  // with the same settings...
+  if (!lprintSessionStart(job, setup))
+    lprintBufferPuts(&zpl->buffer, setup);
+
+  // Send the cached output for identical jobs...
+  lprintCacheStart(&zpl->buffer, job, options);
 
   return (true);
 }
@@ -633,7 +699,14 @@ lprint_zpl_rstartpage(
 
   (void)page;
 
-  // Update status...
+  // Nothing more to send if the output came from the cache - the status is
+  // updated once the cached output has been written...
+  if (zpl->buffer.cached)
+    return (true);
+
+  // Update status, writing any pending output first since the writer thread
+  // and status query cannot share the device...
+  lprintBufferFlush(&zpl->buffer);
   lprint_zpl_update_reasons(papplJobGetPrinter(job), job, device);
 
   // Setup dither buffer...
@@ -645,12 +718,14 @@ lprint_zpl_rstartpage(
   if (!lprintDitherAlloc(&zpl->dither, job, options, CUPS_CSPACE_K, out_gamma))
     return (false);
 
+  lprintVectorAlloc(&zpl->vector, &zpl->dither);
+
   // print-speed
   if ((ips = options->print_speed / 2540) > 0)
-    papplDevicePrintf(device, "^PR%d,%d,%d\n", ips, ips, ips);
+    lprintBufferPrintf(&zpl->buffer, "^PR%d,%d,%d\n", ips, ips, ips);
 
   // Download bitmap...
-  papplDevicePrintf(device, "~DGR:LPRINT.GRF,%u,%u,\n", zpl->dither.in_height * zpl->dither.out_width, zpl->dither.out_width);
+  lprintBufferPrintf(&zpl->buffer, "~DGR:LPRINT.GRF,%u,%u,\n", zpl->dither.in_height * zpl->dither.out_width, zpl->dither.out_width);
 
   // Allocate memory for writing the bitmap...
   zpl->comp_buffer     = malloc(2 * zpl->dither.out_width + 1);
@@ -681,77 +756,19 @@ lprint_zpl_rwriteline(
 {
   lprint_zpl_t	*zpl = (lprint_zpl_t *)papplJobGetData(job);
 					// ZPL driver data
-  unsigned		i;		// Looping var
-  const unsigned char	*ptr;		// Pointer into buffer
-  unsigned char		*compptr;	// Pointer into compression buffer
-#if ZPL_COMPRESSION
-  unsigned char		repeat_char;	// Repeated character
-  unsigned		repeat_count;	// Number of repeated characters
-#endif // ZPL_COMPRESSION
-  static const unsigned char *hex = (const unsigned char *)"0123456789ABCDEF";
-					// Hex digits
 
 
-  if (!lprintDitherLine(&zpl->dither, y, line))
+  // Nothing more to send if the output came from the cache...
+  if (zpl->buffer.cached)
     return (true);
 
-  // Determine whether this row is the same as the previous line.
-  // If so, output a ':' and return...
-  if (zpl->last_buffer_set && !memcmp(zpl->dither.output, zpl->last_buffer, zpl->dither.out_width))
-  {
-    papplDeviceWrite(device, ":", 1);
+  if (!lprintDitherLine(&zpl->dither, y, line))
     return (true);
-  }
-
-  // Convert the line to hex digits...
-  for (ptr = zpl->dither.output, compptr = zpl->comp_buffer, i = zpl->dither.out_width; i > 0; i --, ptr ++)
-  {
-    *compptr++ = hex[*ptr >> 4];
-    *compptr++ = hex[*ptr & 15];
-  }
-
-#if ZPL_COMPRESSION
-  // Send run-length compressed HEX data...
-  *compptr = '\0';
-
-  // Run-length compress the graphics...
-  for (compptr = zpl->comp_buffer + 1, repeat_char = zpl->comp_buffer[0], repeat_count = 1; *compptr; compptr ++)
-  {
-    if (*compptr == repeat_char)
-    {
-      repeat_count ++;
-    }
-    else
-    {
-      lprint_zpl_compress(device, repeat_char, repeat_count);
-      repeat_char  = *compptr;
-      repeat_count = 1;
-    }
-  }
-
-  if (repeat_char == '0')
-  {
-    // Handle 0's on the end of the line...
-    if (repeat_count & 1)
-    {
-      repeat_count --;
-      papplDevicePuts(device, "0");
-    }
 
-    if (repeat_count > 0)
-      papplDevicePuts(device, ",");
-  }
+  if (zpl->vector.bitmap)
+    lprintVectorLine(&zpl->vector, &zpl->dither, y);
   else
-    lprint_zpl_compress(device, repeat_char, repeat_count);
-
-#else
-  // Send uncompressed HEX data...
-  papplDeviceWrite(device, zpl->comp_buffer, compptr - zpl->comp_buffer);
-#endif // ZPL_COMPRESSION
-
-  // Save this line for the next round...
-  memcpy(zpl->last_buffer, zpl->dither.output, zpl->dither.out_width);
-  zpl->last_buffer_set = 1;
+    lprint_zpl_write_row(zpl, zpl->dither.output);
 
   return (true);
 }
@@ -959,3 +976,87 @@ lprint_zpl_update_reasons(
 
   return (true);
 }
+
+
+//
+// 'lprint_zpl_write_row()' - Write a row of the bitmap.
+//
+
+static void
+lprint_zpl_write_row(
+    lprint_zpl_t        *zpl,		// I - ZPL driver data
+    const unsigned char *row)		// I - Row of bitmap
+{
+  unsigned		i;		// Looping var
+  const unsigned char	*ptr;		// Pointer into buffer
+  unsigned char		*compptr;	// Pointer into compression buffer
+#if ZPL_COMPRESSION
+  unsigned char		repeat_char;	// Repeated character
+  unsigned		repeat_count;	// Number of repeated characters
+#endif // ZPL_COMPRESSION
+  static const unsigned char *hex = (const unsigned char *)"0123456789ABCDEF";
+					// Hex digits
+
+
+  // Determine whether this row is the same as the previous line.
+  // If so, output a ':' and return...
+  if (zpl->compress && zpl->last_buffer_set && !memcmp(row, zpl->last_buffer, zpl->dither.out_width))
+  {
+    lprintBufferWrite(&zpl->buffer, ":", 1);
+    return;
+  }
+
+  // Convert the line to hex digits...
+  for (ptr = row, compptr = zpl->comp_buffer, i = zpl->dither.out_width; i > 0; i --, ptr ++)
+  {
+    *compptr++ = hex[*ptr >> 4];
+    *compptr++ = hex[*ptr & 15];
+  }
+
+#if ZPL_COMPRESSION
+  if (zpl->compress)
+  {
+    // Send run-length compressed HEX data...
+    *compptr = '\0';
+
+    // Run-length compress the graphics...
+    for (compptr = zpl->comp_buffer + 1, repeat_char = zpl->comp_buffer[0], repeat_count = 1; *compptr; compptr ++)
+    {
+      if (*compptr == repeat_char)
+      {
+	repeat_count ++;
+      }
+      else
+      {
+	lprint_zpl_compress(&zpl->buffer, repeat_char, repeat_count);
+	repeat_char  = *compptr;
+	repeat_count = 1;
+      }
+    }
+
+    if (repeat_char == '0')
+    {
+      // Handle 0's on the end of the line...
+      if (repeat_count & 1)
+      {
+	repeat_count --;
+	lprintBufferPuts(&zpl->buffer, "0");
+      }
+
+      if (repeat_count > 0)
+	lprintBufferPuts(&zpl->buffer, ",");
+    }
+    else
+      lprint_zpl_compress(&zpl->buffer, repeat_char, repeat_count);
+  }
+  else
+#endif // ZPL_COMPRESSION
+  {
+    // Send uncompressed HEX data...
+    lprintBufferWrite(&zpl->buffer, zpl->comp_buffer, (size_t)(compptr - zpl->comp_buffer));
+  }
+
+  // Save this line for the next round...
+  memcpy(zpl->last_buffer, row, zpl->dither.out_width);
+  zpl->last_buffer_set = 1;
+}
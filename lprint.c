@@ -19,30 +19,84 @@
 #include "static-resources/lprint-small-png.h"
 
 
+//
+// Constants...
+//
+
+#define LPRINT_DRIVER_HASH	64	// Size of driver hash tables
+
+
 //
 // Local types...
 //
 
+typedef struct lprint_autoadd_s		// Auto-add state
+{
+  cups_array_t		*devices;	// Devices
+  pthread_mutex_t	mutex;		// Mutex for probe results
+  size_t		running;	// Number of running probes
+  time_t		deadline;	// Probe deadline
+  bool			added;		// Have the printers been added?
+} lprint_autoadd_t;
+
 typedef struct lprint_device_s
 {
   char	*device_info;			// Device description
   char	*device_uri;			// Device URI
   char	*device_id;			// Device ID
+  lprint_autoadd_t *autoadd;		// Auto-add state
+  pthread_t tid;			// Probe thread
+  bool	probing;			// Was a probe thread started?
+  bool	done;				// Has the device been probed?
+  const char *driver_name;		// Driver name, if any
 } lprint_device_t;
 
+typedef struct lprint_dindex_s		// Driver index entry
+{
+  pappl_pr_driver_t	*driver;	// Driver
+  int			num_mid;	// Number of device ID key/value pairs
+  cups_option_t		*mid;		// Device ID key/value pairs
+  struct lprint_dindex_s *next_make,	// Next driver with the same manufacturer hash
+			*next_name;	// Next driver with the same name hash
+} lprint_dindex_t;
+
+typedef struct lprint_query_s		// Cached driver query
+{
+  char	*key;				// Device URI and ID
+  char	*driver_name;			// Driver name reported by printer
+} lprint_query_t;
+
 
 //
 // Local functions...
 //
 
 static const char	*autoadd_cb(const char *device_info, const char *device_uri, const char *device_id, void *cbdata);
+static void		autoadd_printers(pappl_system_t *system);
+static bool		autoadd_timer_cb(pappl_system_t *system, lprint_autoadd_t *autoadd);
+static int		compare_query(lprint_query_t *a, lprint_query_t *b, void *data);
 static lprint_device_t	*copy_cb(lprint_device_t *src);
 static void		create_cb(pappl_printer_t *printer, void *cbdata);
 static bool		driver_cb(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
+static void		event_cb(pappl_system_t *system, pappl_printer_t *printer, pappl_job_t *job, pappl_event_t event, void *data);
+static const char	*find_driver(pappl_system_t *system, const char *device_uri, const char *device_id, bool query);
+static lprint_dindex_t	*find_name(const char *name);
+static void		finish_autoadd(lprint_autoadd_t *autoadd);
 static void		free_cb(lprint_device_t *src);
-static int		match_id(int num_did, cups_option_t *did, const char *match_id);
+static void		free_query(lprint_query_t *query);
+static bool		get_size(const char *value, size_t *size);
+static unsigned		hash_string(const char *s);
+static void		index_drivers(void);
+static void		match_drivers(lprint_dindex_t *drivers, int num_did, cups_option_t *did, int *best_score, lprint_dindex_t **best);
+static int		match_id(int num_did, cups_option_t *did, int num_mid, cups_option_t *mid);
 static const char	*mime_cb(const unsigned char *header, size_t headersize, void *data);
 static bool		printer_cb(const char *device_info, const char *device_uri, const char *device_id, cups_array_t *devices);
+static void		*probe_device(lprint_device_t *dev);
+static void		query_driver(pappl_system_t *system, const char *device_uri, const char *device_id, char *name, size_t namesize);
+static bool		save_cb(pappl_system_t *system, void *data);
+static bool		save_commit(pappl_system_t *system);
+static bool		save_state(pappl_system_t *system);
+static bool		save_timer_cb(pappl_system_t *system, void *data);
 static pappl_system_t	*system_cb(int num_options, cups_option_t *options, void *data);
 
 
@@ -66,6 +120,28 @@ static char			lprint_spooldir[1024],
 					// Spool directory
 				lprint_statefile[1024];
 					// State file
+static lprint_dindex_t		lprint_dindex[sizeof(lprint_drivers) / sizeof(lprint_drivers[0])];
+					// Driver index
+static lprint_dindex_t		*lprint_dindex_makes[LPRINT_DRIVER_HASH],
+					// Drivers by manufacturer
+				*lprint_dindex_names[LPRINT_DRIVER_HASH],
+					// Drivers by name
+				*lprint_dindex_other = NULL;
+					// Drivers without a manufacturer
+static lprint_autoadd_t		*lprint_autoadd = NULL;
+					// Auto-add state
+static pthread_once_t		lprint_dindex_once = PTHREAD_ONCE_INIT;
+					// One-time initialization of driver index
+static cups_array_t		*lprint_queries = NULL;
+					// Cached driver queries
+static pthread_mutex_t		lprint_queries_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for cached driver queries
+static pthread_mutex_t		lprint_save_mutex = PTHREAD_MUTEX_INITIALIZER;
+					// Mutex for state saving
+static bool			lprint_save_pending = false;
+					// Is there an uncommitted state file?
+static time_t			lprint_save_time = 0;
+					// Time of last state save
 
 
 //
@@ -76,15 +152,33 @@ int					// O - Exit status
 main(int  argc,				// I - Number of command-line arguments
      char *argv[])			// I - Command-line arguments
 {
-  return (papplMainloop(argc, argv,
-                        LPRINT_VERSION,
-                        "Copyright &copy; 2019-2024 by Michael R Sweet. All Rights Reserved.",
-                        (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])),
-                        lprint_drivers, autoadd_cb, driver_cb,
-                        /*subcmd_name*/NULL, /*subcmd_cb*/NULL,
-                        system_cb,
-                        /*usage_cb*/NULL,
-                        /*data*/NULL));
+  int	status;				// Exit status
+
+
+  status = papplMainloop(argc, argv,
+                         LPRINT_VERSION,
+                         "Copyright &copy; 2019-2024 by Michael R Sweet. All Rights Reserved.",
+                         (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])),
+                         lprint_drivers, autoadd_cb, driver_cb,
+                         /*subcmd_name*/NULL, /*subcmd_cb*/NULL,
+                         system_cb,
+                         /*usage_cb*/NULL,
+                         /*data*/NULL);
+
+  // Wait for any auto-add probes that are still talking to printers...
+  if (lprint_autoadd)
+  {
+    finish_autoadd(lprint_autoadd);
+    lprint_autoadd = NULL;
+  }
+
+  // Commit any state file that was written after the last save...
+  pthread_mutex_lock(&lprint_save_mutex);
+  if (!save_commit(/*system*/NULL))
+    status = 1;
+  pthread_mutex_unlock(&lprint_save_mutex);
+
+  return (status);
 }
 
 
@@ -98,54 +192,194 @@ autoadd_cb(const char *device_info,	// I - Device information/name (not used)
            const char *device_id,	// I - IEEE-1284 device ID
            void       *cbdata)		// I - Callback data (System)
 {
-  int		i,			// Looping var
-		score,			// Current driver match score
-	    	best_score = 0,		// Best score
-		num_did;		// Number of device ID key/value pairs
-  cups_option_t	*did;			// Device ID key/value pairs
-  const char	*make,			// Manufacturer name
-		*best_name = NULL;	// Best driver
-  char		name[1024] = "";	// Driver name to match
+  (void)device_info;
 
+  return (find_driver((pappl_system_t *)cbdata, device_uri, device_id, /*query*/true));
+}
 
-  (void)device_info;
 
-  // First parse the device ID and get any potential driver name to match...
-  num_did = papplDeviceParseID(device_id, &did);
+//
+// 'autoadd_printers()' - Auto-add printers when there is no saved state.
+//
+// Each printer is probed in its own thread so the server can accept
+// connections while printers are probed.  The printers are added from the
+// main loop by `autoadd_timer_cb()`, and printers that do not answer within
+// `LPRINT_PROBE_TIMEOUT` seconds are matched using their device ID.
+//
 
-  if ((make = cupsGetOption("MANUFACTURER", num_did, did)) == NULL)
-    if ((make = cupsGetOption("MANU", num_did, did)) == NULL)
-      make = cupsGetOption("MFG", num_did, did);
+static void
+autoadd_printers(
+    pappl_system_t *system)		// I - System
+{
+  lprint_autoadd_t	*autoadd;	// Auto-add state
+  lprint_device_t	*dev;		// Current device
+
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Auto-adding printers...");
+
+  if ((autoadd = (lprint_autoadd_t *)calloc(1, sizeof(lprint_autoadd_t))) == NULL)
+    return;
+
+  autoadd->devices  = cupsArrayNew(NULL, NULL, NULL, 0, (cups_acopy_cb_t)copy_cb, (cups_afree_cb_t)free_cb);
+  autoadd->deadline = time(NULL) + LPRINT_PROBE_TIMEOUT;
 
-  if (make && !strncasecmp(make, "Zebra", 5))
-    lprintZPLQueryDriver((pappl_system_t *)cbdata, device_uri, name, sizeof(name));
+  pthread_mutex_init(&autoadd->mutex, NULL);
 
-  // Then loop through the driver list to find the best match...
-  for (i = 0; i < (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])); i ++)
+  papplDeviceList(PAPPL_DEVTYPE_USB, (pappl_device_cb_t)printer_cb, autoadd->devices, papplLogDevice, system);
+
+  // Probe all of the printers at the same time...
+  pthread_mutex_lock(&autoadd->mutex);
+
+  for (dev = (lprint_device_t *)cupsArrayGetFirst(autoadd->devices); dev; dev = (lprint_device_t *)cupsArrayGetNext(autoadd->devices))
   {
-    if (!strcmp(name, lprint_drivers[i].name))
+    dev->autoadd = autoadd;
+
+    if (pthread_create(&dev->tid, NULL, (void *(*)(void *))probe_device, dev))
     {
-      // Matching driver name always the best match...
-      best_name = lprint_drivers[i].name;
-      break;
+      // Unable to create a thread, match using the device ID...
+      dev->driver_name = find_driver(system, dev->device_uri, dev->device_id, /*query*/false);
+      dev->done        = true;
+    }
+    else
+    {
+      dev->probing = true;
+      autoadd->running ++;
     }
+  }
+
+  pthread_mutex_unlock(&autoadd->mutex);
+
+  // Add the printers from the main loop...
+  lprint_autoadd = autoadd;
+
+  if (!papplSystemAddTimerCallback(system, 0, 1, (pappl_timer_cb_t)autoadd_timer_cb, autoadd))
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to auto-add printers: %s", strerror(errno));
+}
+
+
+//
+// 'autoadd_timer_cb()' - Add the probed printers.
+//
+// Printers are added once all probes have finished or the probe deadline has
+// passed, in the order they were found.  The timer then remains until the
+// probe threads that timed out have finished, so they can be cleaned up.
+//
+
+static bool				// O - `true` to keep the timer
+autoadd_timer_cb(
+    pappl_system_t   *system,		// I - System
+    lprint_autoadd_t *autoadd)		// I - Auto-add state
+{
+  lprint_device_t	*dev;		// Current device
+  size_t		running;	// Number of running probes
+
+
+  pthread_mutex_lock(&autoadd->mutex);
+  running = autoadd->running;
 
-    if (lprint_drivers[i].device_id)
+  if (autoadd->added || (running > 0 && time(NULL) < autoadd->deadline && !papplSystemIsShutdown(system)))
+  {
+    // Still waiting for the probes...
+    pthread_mutex_unlock(&autoadd->mutex);
+
+    if (autoadd->added && running == 0)
+    {
+      // All done, clean up...
+      finish_autoadd(autoadd);
+      lprint_autoadd = NULL;
+      return (false);
+    }
+
+    return (true);
+  }
+
+  // Match any printers that did not respond using the device ID...
+  for (dev = (lprint_device_t *)cupsArrayGetFirst(autoadd->devices); dev; dev = (lprint_device_t *)cupsArrayGetNext(autoadd->devices))
+  {
+    if (!dev->done)
+    {
+      papplLog(system, PAPPL_LOGLEVEL_WARN, "'%s' did not respond within %d seconds.", dev->device_uri, LPRINT_PROBE_TIMEOUT);
+
+      dev->driver_name = find_driver(system, dev->device_uri, dev->device_id, /*query*/false);
+      dev->done        = true;
+    }
+  }
+
+  autoadd->added = true;
+
+  pthread_mutex_unlock(&autoadd->mutex);
+
+  // Then add the printers in the order they were found...
+  for (dev = (lprint_device_t *)cupsArrayGetFirst(autoadd->devices); dev && !papplSystemIsShutdown(system); dev = (lprint_device_t *)cupsArrayGetNext(autoadd->devices))
+  {
+    const char *driver_name = dev->driver_name;
+					// Driver name, if any
+
+    papplLog(system, PAPPL_LOGLEVEL_DEBUG, "%s (%s;%s) -> %s", dev->device_info, dev->device_uri, dev->device_id, driver_name ? driver_name : "none");
+
+    if (driver_name)
     {
-      // See if we have a matching device ID...
-      score = match_id(num_did, did, lprint_drivers[i].device_id);
-      if (score > best_score)
+      char	name[128],		// Printer name
+	    *nameptr;			// Pointer in name
+
+      // Zebra puts "Zebra Technologies ZTC" on the front of their printer names,
+      // which is a bit, um, wordy.  Clean up the device info string to use as a
+      // printer name and drop any trailing "(ID)" nonsense if we don't need it.
+      if (!strncasecmp(dev->device_info, "Zebra Technologies ZTC ", 23))
+	snprintf(name, sizeof(name), "Zebra %s", dev->device_info + 23);
+      else
+	papplCopyString(name, dev->device_info, sizeof(name));
+
+      if ((nameptr = strstr(name, " (")) != NULL)
+	*nameptr = '\0';
+
+      if (!papplPrinterCreate(system, 0, name, driver_name, dev->device_id, dev->device_uri))
       {
-        best_score = score;
-        best_name  = lprint_drivers[i].name;
+	// Printer already exists with this name, so try adding a number to the
+	// name...
+	int	i;			// Looping var
+	char	newname[128],		// New name
+		number[4];		// Number string
+	size_t	namelen = strlen(name),	// Length of original name string
+		numberlen;		// Length of number string
+
+	for (i = 2; i < 100; i ++)
+	{
+	  // Append " NNN" to the name, truncating the existing name as needed to
+	  // include the number at the end...
+	  snprintf(number, sizeof(number), " %d", i);
+	  numberlen = strlen(number);
+
+	  papplCopyString(newname, name, sizeof(newname));
+	  if ((namelen + numberlen) < sizeof(newname))
+	    memcpy(newname + namelen, number, numberlen + 1);
+	  else
+	    memcpy(newname + sizeof(newname) - numberlen - 1, number, numberlen + 1);
+
+	  // Try creating with this name...
+	  if (papplPrinterCreate(system, 0, newname, driver_name, dev->device_id, dev->device_uri))
+	    break;
+	}
       }
     }
   }
 
-  // Clean up and return...
-  cupsFreeOptions(num_did, did);
+  return (true);
+}
+
+
+//
+// 'compare_query()' - Compare two cached driver queries.
+//
+
+static int				// O - Result of comparison
+compare_query(lprint_query_t *a,	// I - First query
+              lprint_query_t *b,	// I - Second query
+              void           *data)	// I - Callback data (not used)
+{
+  (void)data;
 
-  return (best_name);
+  return (strcmp(a->key, b->key));
 }
 
 
@@ -197,6 +431,11 @@ create_cb(pappl_printer_t *printer,	// I - Printer
   papplSystemAddResourceCallback(papplPrinterGetSystem(printer), resource, "text/html", (pappl_resource_cb_t)lprintMediaUI, printer);
   LPRINT_DEBUG("create_cb: Added new media page for '%s'.\n", resource);
 
+  // Add link status page...
+  papplPrinterGetPath(printer, "link", resource, sizeof(resource));
+  papplSystemAddResourceCallback(papplPrinterGetSystem(printer), resource, "text/html", (pappl_resource_cb_t)lprintLinkUI, printer);
+  papplPrinterAddLink(printer, "Link", resource, PAPPL_LOPTIONS_STATUS);
+
   // Load custom media sizes and report them...
   papplPrinterGetDriverData(printer, &data);
   lprintMediaLoad(printer, &data);
@@ -221,19 +460,14 @@ driver_cb(
     ipp_t                  **attrs,	// O - Pointer to driver attributes
     void                   *cbdata)	// I - Callback data (not used)
 {
-  bool	ret = false;			// Return value
-  int	i;				// Looping var
+  bool			ret = false;	// Return value
+  int			i;		// Looping var
+  lprint_dindex_t	*d;		// Driver index entry
 
 
   // Copy make/model info...
-  for (i = 0; i < (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])); i ++)
-  {
-    if (!strcmp(driver_name, lprint_drivers[i].name))
-    {
-      papplCopyString(data->make_and_model, lprint_drivers[i].description, sizeof(data->make_and_model));
-      break;
-    }
-  }
+  if ((d = find_name(driver_name)) != NULL)
+    papplCopyString(data->make_and_model, d->driver->description, sizeof(data->make_and_model));
 
   // AirPrint version...
   data->num_features = 1;
@@ -316,6 +550,159 @@ driver_cb(
 }
 
 
+//
+// 'event_cb()' - Record server events for metrics.
+//
+
+static void
+event_cb(pappl_system_t  *system,	// I - System
+         pappl_printer_t *printer,	// I - Printer, if any
+         pappl_job_t     *job,		// I - Job, if any
+         pappl_event_t   event,		// I - Event
+         void            *data)		// I - Callback data (not used)
+{
+  (void)system;
+  (void)data;
+
+  lprintMetricsEvent(printer, job, event);
+}
+
+
+//
+// 'find_driver()' - Find the best driver for a printer.
+//
+// Zebra printers are asked for their model when `query` is `true`.
+//
+
+static const char *			// O - Driver name or `NULL` for none
+find_driver(pappl_system_t *system,	// I - System or `NULL`
+            const char     *device_uri,	// I - Device URI
+            const char     *device_id,	// I - IEEE-1284 device ID
+            bool           query)	// I - Query Zebra printers for their model?
+{
+  int			i,		// Looping var
+			best_score = 0,	// Best score
+			num_did;	// Number of device ID key/value pairs
+  cups_option_t		*did;		// Device ID key/value pairs
+  const char		*make,		// Manufacturer name
+			*field,		// Start of field in manufacturer name
+			*next;		// End of field in manufacturer name
+  lprint_dindex_t	*best = NULL;	// Best driver
+  char			name[1024] = "",// Driver name to match
+			temp[256];	// Manufacturer name field
+  static const char * const make_keys[] =
+  {					// Manufacturer keys
+    "MANUFACTURER",
+    "MFG"
+  };
+
+
+  pthread_once(&lprint_dindex_once, index_drivers);
+
+  // First parse the device ID and get any potential driver name to match...
+  num_did = papplDeviceParseID(device_id, &did);
+
+  if ((make = cupsGetOption("MANUFACTURER", num_did, did)) == NULL)
+    if ((make = cupsGetOption("MANU", num_did, did)) == NULL)
+      make = cupsGetOption("MFG", num_did, did);
+
+  if (query && make && !strncasecmp(make, "Zebra", 5))
+    query_driver(system, device_uri, device_id, name, sizeof(name));
+
+  // Matching driver name always the best match...
+  if (name[0] && (best = find_name(name)) != NULL)
+  {
+    cupsFreeOptions(num_did, did);
+    return (best->driver->name);
+  }
+
+  // Then compare the device ID against drivers for the same manufacturer,
+  // including each field of a comma-delimited manufacturer name...
+  for (i = 0; i < (int)(sizeof(make_keys) / sizeof(make_keys[0])); i ++)
+  {
+    if ((make = cupsGetOption(make_keys[i], num_did, did)) == NULL)
+      continue;
+
+    match_drivers(lprint_dindex_makes[hash_string(make)], num_did, did, &best_score, &best);
+
+    if (!strchr(make, ','))
+      continue;
+
+    for (field = make; *field; field = next)
+    {
+      if ((next = strchr(field, ',')) == NULL)
+        next = field + strlen(field);
+
+      if ((size_t)(next - field) < sizeof(temp))
+      {
+        memcpy(temp, field, (size_t)(next - field));
+        temp[next - field] = '\0';
+
+        match_drivers(lprint_dindex_makes[hash_string(temp)], num_did, did, &best_score, &best);
+      }
+
+      if (*next)
+        next ++;
+    }
+  }
+
+  match_drivers(lprint_dindex_other, num_did, did, &best_score, &best);
+
+  // Clean up and return...
+  cupsFreeOptions(num_did, did);
+
+  return (best ? best->driver->name : NULL);
+}
+
+
+//
+// 'find_name()' - Find a driver by name.
+//
+
+static lprint_dindex_t *		// O - Driver index entry or `NULL` if not found
+find_name(const char *name)		// I - Driver name
+{
+  lprint_dindex_t	*d;		// Current driver
+
+
+  pthread_once(&lprint_dindex_once, index_drivers);
+
+  for (d = lprint_dindex_names[hash_string(name)]; d; d = d->next_name)
+  {
+    if (!strcmp(name, d->driver->name))
+      return (d);
+  }
+
+  return (NULL);
+}
+
+
+//
+// 'finish_autoadd()' - Wait for the auto-add probes and free the state.
+//
+// Probes that timed out are still waiting for their printer, which does not
+// take longer than the device I/O timeout.
+//
+
+static void
+finish_autoadd(
+    lprint_autoadd_t *autoadd)		// I - Auto-add state
+{
+  lprint_device_t	*dev;		// Current device
+
+
+  for (dev = (lprint_device_t *)cupsArrayGetFirst(autoadd->devices); dev; dev = (lprint_device_t *)cupsArrayGetNext(autoadd->devices))
+  {
+    if (dev->probing)
+      pthread_join(dev->tid, NULL);
+  }
+
+  cupsArrayDelete(autoadd->devices);
+  pthread_mutex_destroy(&autoadd->mutex);
+  free(autoadd);
+}
+
+
 //
 // 'free_cb()' - Free a device entry.
 //
@@ -330,6 +717,163 @@ free_cb(lprint_device_t *dev)		// I - Device entry
 }
 
 
+//
+// 'free_query()' - Free a cached driver query.
+//
+
+static void
+free_query(lprint_query_t *query)	// I - Query
+{
+  free(query->key);
+  free(query->driver_name);
+  free(query);
+}
+
+
+//
+// 'get_size()' - Get a size value in bytes.
+//
+// Sizes can use a "k", "m", or "g" suffix for kilobytes, megabytes, or
+// gigabytes.
+//
+
+static bool				// O - `true` on success, `false` on error
+get_size(const char *value,		// I - Value string
+         size_t     *size)		// O - Size in bytes
+{
+  char		*valptr;		// Pointer into value
+  unsigned long	number;			// Number
+
+
+  if (!isdigit(*value & 255))
+    return (false);
+
+  number = strtoul(value, &valptr, 10);
+
+  switch (tolower(*valptr & 255))
+  {
+    case 'k' :
+        number *= 1024;
+        valptr ++;
+        break;
+    case 'm' :
+        number *= 1024 * 1024;
+        valptr ++;
+        break;
+    case 'g' :
+        number *= 1024 * 1024 * 1024;
+        valptr ++;
+        break;
+  }
+
+  if (*valptr)
+    return (false);
+
+  *size = (size_t)number;
+
+  return (true);
+}
+
+
+//
+// 'hash_string()' - Compute a case-insensitive hash of a string.
+//
+
+static unsigned				// O - Hash value
+hash_string(const char *s)		// I - String
+{
+  unsigned	hash = 2166136261U;	// FNV-1a hash
+
+
+  while (*s)
+  {
+    hash ^= (unsigned)tolower(*s++ & 255);
+    hash *= 16777619U;
+  }
+
+  return (hash % LPRINT_DRIVER_HASH);
+}
+
+
+//
+// 'index_drivers()' - Parse the driver device IDs and build the driver index.
+//
+// Drivers are indexed by name and by manufacturer, in reverse order so that
+// each hash chain lists the drivers in their original order.
+//
+
+static void
+index_drivers(void)
+{
+  int			i;		// Looping var
+  lprint_dindex_t	*d;		// Current driver
+  const char		*make;		// Manufacturer name
+  unsigned		hash;		// Hash value
+
+
+  for (i = (int)(sizeof(lprint_drivers) / sizeof(lprint_drivers[0])) - 1, d = lprint_dindex + i; i >= 0; i --, d --)
+  {
+    d->driver = lprint_drivers + i;
+
+    hash                      = hash_string(d->driver->name);
+    d->next_name              = lprint_dindex_names[hash];
+    lprint_dindex_names[hash] = d;
+
+    if (!d->driver->device_id || (d->num_mid = papplDeviceParseID(d->driver->device_id, &d->mid)) == 0)
+      continue;
+
+    if ((make = cupsGetOption("MANUFACTURER", d->num_mid, d->mid)) == NULL)
+      make = cupsGetOption("MFG", d->num_mid, d->mid);
+
+    if (make)
+    {
+      hash                      = hash_string(make);
+      d->next_make              = lprint_dindex_makes[hash];
+      lprint_dindex_makes[hash] = d;
+    }
+    else
+    {
+      d->next_make        = lprint_dindex_other;
+      lprint_dindex_other = d;
+    }
+  }
+}
+
+
+//
+// 'match_drivers()' - Compare a device ID against a list of drivers.
+//
+// Ties go to the driver that comes first in the driver list.
+//
+
+static void
+match_drivers(
+    lprint_dindex_t *drivers,		// I  - First driver in hash chain
+    int             num_did,		// I  - Number of device ID key/value pairs
+    cups_option_t   *did,		// I  - Device ID key/value pairs
+    int             *best_score,	// IO - Best score
+    lprint_dindex_t **best)		// IO - Best driver
+{
+  lprint_dindex_t	*d;		// Current driver
+  int			score;		// Current score
+
+
+  for (d = drivers; d; d = d->next_make)
+  {
+    if (d->num_mid == 0)
+      continue;
+
+    score = match_id(num_did, did, d->num_mid, d->mid);
+
+    if (score > *best_score || (score > 0 && score == *best_score && d < *best))
+    {
+      *best_score = score;
+      *best       = d;
+    }
+  }
+}
+
+
 //
 // 'match_id()' - Compare two IEEE-1284 device IDs and return a score.
 //
@@ -340,21 +884,16 @@ free_cb(lprint_device_t *dev)		// I - Device entry
 static int				// O - Score
 match_id(int           num_did,		// I - Number of device ID key/value pairs
          cups_option_t *did,		// I - Device ID key/value pairs
-         const char    *match_id)	// I - Driver's device ID match string
+         int           num_mid,		// I - Number of driver's device ID key/value pairs
+         cups_option_t *mid)		// I - Driver's device ID key/value pairs
 {
   int		i,			// Looping var
-		score = 0,		// Score
-		num_mid;		// Number of match ID key/value pairs
-  cups_option_t	*mid,			// Match ID key/value pairs
-		*current;		// Current key/value pair
+		score = 0;		// Score
+  cups_option_t	*current;		// Current key/value pair
   const char	*value,			// Device ID value
 		*valptr;		// Pointer into value
 
 
-  // Parse the matching device ID into key/value pairs...
-  if ((num_mid = papplDeviceParseID(match_id, &mid)) == 0)
-    return (0);
-
   // Loop through the match pairs to find matches (or not)
   for (i = num_mid, current = mid; i > 0; i --, current ++)
   {
@@ -395,8 +934,6 @@ match_id(int           num_did,		// I - Number of device ID key/value pairs
     }
   }
 
-  cupsFreeOptions(num_mid, mid);
-
   return (score);
 }
 
@@ -412,16 +949,95 @@ mime_cb(const unsigned char *header,	// I - Header data
 {
   char	testpage[] = LPRINT_TESTPAGE_HEADER;
 					// Test page file header
+  const unsigned char	*ptr,		// Pointer into header
+			*numptr,	// Pointer to number in header
+			*end = header + headersize;
+					// End of header
+  size_t		i;		// Looping var
+  static const char * const tspl_commands[] =
+  {					// Commands that start TSPL jobs
+    "BLINE ",
+    "CLS\n",
+    "CLS\r",
+    "CODEPAGE ",
+    "DENSITY ",
+    "DIRECTION ",
+    "GAP ",
+    "REFERENCE ",
+    "SIZE ",
+    "SPEED "
+  };
 
 
+  (void)cbdata;
+
   if (headersize >= sizeof(testpage) && !memcmp(header, testpage, sizeof(testpage)))
     return (LPRINT_TESTPAGE_MIMETYPE);
-  else if (headersize >= 2 && header[0] == '^' && isupper(header[1] & 255))
-    return (LPRINT_ZPL_MIMETYPE);
-  else if (headersize >= 3 && !memcmp(header, "\nN\n", 3))
-    return (LPRINT_EPL2_MIMETYPE);
-  else
-    return (NULL);
+
+  // Binary formats start with a reset sequence: nuls for Brother and DYMO
+  // tape printers, escapes for DYMO label printers...
+  for (ptr = header; ptr < end && !*ptr; ptr ++);
+
+#ifdef LPRINT_EXPERIMENTAL
+  if ((end - ptr) >= 4 && !memcmp(ptr, "\033@\033i", 4))
+    return (LPRINT_BROTHER_PT_CBP_MIMETYPE);	// ESC @ ESC i ...
+#endif // LPRINT_EXPERIMENTAL
+
+  if (ptr > header && (end - ptr) >= 2 && !memcmp(ptr, "\033C", 2))
+    return (LPRINT_DYMO_LM_MIMETYPE);		// NUL ... ESC C
+
+  for (ptr = header; ptr < end && *ptr == 0x1b; ptr ++);
+
+  if ((ptr - header) >= 2 && ptr < end && *ptr == '@')
+    return (LPRINT_DYMO_LW_MIMETYPE);		// ESC ESC ... ESC @
+
+  // SII SLP jobs start with an optional reset followed by margin, density (0
+  // to 3), and then a fine mode, speed, print, or feed command...
+  ptr = header;
+  if (ptr < end && *ptr == 0x0f)
+    ptr ++;					// Reset
+
+  if ((end - ptr) >= 6 && ptr[0] == 0x06 && ptr[2] == 0x0e && ptr[3] <= 3)
+  {
+    if ((ptr[4] == 0x17 && ptr[5] <= 1) || (ptr[4] == 0x0d && ptr[5] <= 2) || ptr[4] == 0x04 || ptr[4] == 0x0b || ptr[4] == 0x0c)
+      return (LPRINT_SLP_MIMETYPE);		// Margin, density, ...
+  }
+
+  // Text formats can start with blank lines...
+  for (ptr = header; ptr < end && isspace(*ptr & 255); ptr ++);
+
+  if ((end - ptr) >= 2 && (*ptr == '^' || *ptr == '~') && isupper(ptr[1] & 255))
+    return (LPRINT_ZPL_MIMETYPE);		// ^XA, ~SD, etc.
+  else if ((end - ptr) >= 7 && !memcmp(ptr, "CT~~CD,", 7))
+    return (LPRINT_ZPL_MIMETYPE);		// Change control prefix
+
+  if ((end - ptr) >= 2 && *ptr == 'N' && (ptr[1] == '\r' || ptr[1] == '\n'))
+    return (LPRINT_EPL2_MIMETYPE);		// N (clear image buffer)
+
+  if ((end - ptr) >= 3 && (*ptr == 'q' || *ptr == 'Q'))
+  {
+    // qWIDTH or QLENGTH,GAP
+    for (numptr = ptr + 1; numptr < end && isdigit(*numptr & 255); numptr ++);
+
+    if (numptr > (ptr + 1) && numptr < end && (*numptr == '\r' || *numptr == '\n' || (*ptr == 'Q' && *numptr == ',')))
+      return (LPRINT_EPL2_MIMETYPE);
+  }
+
+#ifdef LPRINT_EXPERIMENTAL
+  if ((end - ptr) >= 4 && (!memcmp(ptr, "! 0 ", 4) || !memcmp(ptr, "! U1", 4) || !memcmp(ptr, "! UT", 4)))
+    return (LPRINT_CPCL_MIMETYPE);		// ! 0 ..., ! U1 ..., ! UTILITIES
+#endif // LPRINT_EXPERIMENTAL
+
+  for (i = 0; i < (sizeof(tspl_commands) / sizeof(tspl_commands[0])); i ++)
+  {
+    size_t len = strlen(tspl_commands[i]);
+					// Length of command
+
+    if ((size_t)(end - ptr) >= len && !memcmp(ptr, tspl_commands[i], len))
+      return (LPRINT_TSPL_MIMETYPE);
+  }
+
+  return (NULL);
 }
 
 
@@ -448,6 +1064,227 @@ printer_cb(const char   *device_info,	// I - Device information
 }
 
 
+//
+// 'probe_device()' - Probe a printer for auto-adding.
+//
+// The probe does not use the system object, which may be deleted before a
+// probe that timed out finishes.
+//
+
+static void *				// O - Thread exit status (not used)
+probe_device(lprint_device_t *dev)	// I - Device
+{
+  lprint_autoadd_t	*autoadd = dev->autoadd;
+					// Auto-add state
+  const char		*driver_name;	// Driver name, if any
+
+
+  driver_name = find_driver(/*system*/NULL, dev->device_uri, dev->device_id, /*query*/true);
+
+  pthread_mutex_lock(&autoadd->mutex);
+
+  if (!dev->done)
+  {
+    // Still waiting for this device...
+    dev->driver_name = driver_name;
+    dev->done        = true;
+  }
+
+  autoadd->running --;
+
+  pthread_mutex_unlock(&autoadd->mutex);
+
+  return (NULL);
+}
+
+
+//
+// 'query_driver()' - Query a Zebra printer for its driver name.
+//
+// Results are cached by device URI and ID so that a printer is only queried
+// once.
+//
+
+static void
+query_driver(
+    pappl_system_t *system,		// I - System
+    const char     *device_uri,		// I - Device URI
+    const char     *device_id,		// I - IEEE-1284 device ID
+    char           *name,		// I - Name buffer
+    size_t         namesize)		// I - Size of name buffer
+{
+  char			key[2048];	// Cache key
+  lprint_query_t	kquery,		// Search key
+			*query;		// Cached query
+
+
+  // See if we already asked this printer...
+  snprintf(key, sizeof(key), "%s\n%s", device_uri, device_id ? device_id : "");
+  kquery.key = key;
+
+  pthread_mutex_lock(&lprint_queries_mutex);
+  if ((query = (lprint_query_t *)cupsArrayFind(lprint_queries, &kquery)) != NULL)
+    papplCopyString(name, query->driver_name, namesize);
+  pthread_mutex_unlock(&lprint_queries_mutex);
+
+  if (query)
+    return;
+
+  // Nope, ask it and remember the answer...
+  lprintZPLQueryDriver(system, device_uri, name, namesize);
+
+  if (!*name)
+    return;
+
+  pthread_mutex_lock(&lprint_queries_mutex);
+
+  if (!lprint_queries)
+    lprint_queries = cupsArrayNew((cups_array_cb_t)compare_query, NULL, NULL, 0, NULL, (cups_afree_cb_t)free_query);
+
+  if (!cupsArrayFind(lprint_queries, &kquery) && (query = (lprint_query_t *)calloc(1, sizeof(lprint_query_t))) != NULL)
+  {
+    query->key         = strdup(key);
+    query->driver_name = strdup(name);
+
+    if (query->key && query->driver_name)
+      cupsArrayAdd(lprint_queries, query);
+    else
+      free_query(query);
+  }
+
+  pthread_mutex_unlock(&lprint_queries_mutex);
+}
+
+
+//
+// 'save_cb()' - Save the system state after a configuration change.
+//
+// The state is written to a temporary file on every change, but the file is
+// only synced and moved into place at most once every `LPRINT_SAVE_INTERVAL`
+// seconds.  Later changes are committed by `save_timer_cb()`, or by `main()`
+// once the server has shut down.
+//
+
+static bool				// O - `true` on success, `false` on error
+save_cb(pappl_system_t *system,		// I - System
+        void           *data)		// I - Callback data (not used)
+{
+  bool	ret;				// Return value
+
+
+  (void)data;
+
+  pthread_mutex_lock(&lprint_save_mutex);
+
+  if ((ret = save_state(system)) == true && (papplSystemIsShutdown(system) || time(NULL) >= (lprint_save_time + LPRINT_SAVE_INTERVAL)))
+    ret = save_commit(system);
+
+  pthread_mutex_unlock(&lprint_save_mutex);
+
+  return (ret);
+}
+
+
+//
+// 'save_commit()' - Replace the state file with the last saved state.
+//
+// The temporary file is synced before it is renamed so that an interrupted
+// save never leaves a truncated state file.  The system may be `NULL` once
+// the server has shut down.  Call with `lprint_save_mutex` held.
+//
+
+static bool				// O - `true` on success, `false` on error
+save_commit(pappl_system_t *system)	// I - System or `NULL`
+{
+  int	fd;				// Temporary state file descriptor
+  char	tempfile[1040];			// Temporary state file
+
+
+  if (!lprint_save_pending)
+    return (true);
+
+  lprint_save_pending = false;
+  lprint_save_time    = time(NULL);
+
+  snprintf(tempfile, sizeof(tempfile), "%s.tmp", lprint_statefile);
+
+  if ((fd = open(tempfile, O_RDWR)) >= 0)
+  {
+#ifndef _WIN32
+    fsync(fd);
+#endif // !_WIN32
+    close(fd);
+
+#ifdef _WIN32
+    unlink(lprint_statefile);
+#endif // _WIN32
+
+    if (!rename(tempfile, lprint_statefile))
+      return (true);
+  }
+
+  if (system)
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to save state to '%s': %s", lprint_statefile, strerror(errno));
+  else
+    fprintf(stderr, "lprint: Unable to save state to '%s': %s\n", lprint_statefile, strerror(errno));
+
+  unlink(tempfile);
+
+  return (false);
+}
+
+
+//
+// 'save_state()' - Write the system state to a temporary file.
+//
+// Call with `lprint_save_mutex` held.
+//
+
+static bool				// O - `true` on success, `false` on error
+save_state(pappl_system_t *system)	// I - System
+{
+  char	tempfile[1040];			// Temporary state file
+
+
+  snprintf(tempfile, sizeof(tempfile), "%s.tmp", lprint_statefile);
+
+  if (!papplSystemSaveState(system, tempfile))
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to save state to '%s'.", tempfile);
+    unlink(tempfile);
+    lprint_save_pending = false;
+    return (false);
+  }
+
+  lprint_save_pending = true;
+
+  return (true);
+}
+
+
+//
+// 'save_timer_cb()' - Commit any uncommitted state changes.
+//
+// Changes are also committed as soon as a shutdown is requested.
+//
+
+static bool				// O - `true` to keep the timer
+save_timer_cb(pappl_system_t *system,	// I - System
+              void           *data)	// I - Callback data (not used)
+{
+  (void)data;
+
+  pthread_mutex_lock(&lprint_save_mutex);
+
+  if (lprint_save_pending && (papplSystemIsShutdown(system) || time(NULL) >= (lprint_save_time + LPRINT_SAVE_INTERVAL)))
+    save_commit(system);
+
+  pthread_mutex_unlock(&lprint_save_mutex);
+
+  return (true);
+}
+
+
 //
 // 'system_cb()' - Setup the system object.
 //
@@ -467,6 +1304,10 @@ system_cb(
 			*system_name;	// System name, if any
   pappl_loglevel_t	loglevel;	// Log level
   int			port = 0;	// Port number, if any
+  size_t		cache_size = LPRINT_CACHE_SIZE,
+					// Size of output cache in memory
+			cache_disk_size = LPRINT_CACHE_DISK_SIZE;
+					// Size of output cache files
   pappl_soptions_t	soptions = PAPPL_SOPTIONS_MULTI_QUEUE | PAPPL_SOPTIONS_WEB_INTERFACE | PAPPL_SOPTIONS_WEB_LOG | PAPPL_SOPTIONS_WEB_SECURITY;
 					// System options
   static pappl_version_t versions[1] =	// Software versions
@@ -550,6 +1391,31 @@ system_cb(
       port = atoi(val);
   }
 
+  if ((val = cupsGetOption("cache-size", num_options, options)) != NULL && !get_size(val, &cache_size))
+  {
+    fprintf(stderr, "lprint: Bad cache-size value '%s'.\n", val);
+    return (NULL);
+  }
+
+  if ((val = cupsGetOption("cache-disk-size", num_options, options)) != NULL && !get_size(val, &cache_disk_size))
+  {
+    fprintf(stderr, "lprint: Bad cache-disk-size value '%s'.\n", val);
+    return (NULL);
+  }
+
+  if ((val = cupsGetOption("vectors", num_options, options)) != NULL)
+  {
+    if (!strcmp(val, "yes") || !strcmp(val, "on") || !strcmp(val, "true"))
+    {
+      lprintVectorInit(true);
+    }
+    else if (strcmp(val, "no") && strcmp(val, "off") && strcmp(val, "false"))
+    {
+      fprintf(stderr, "lprint: Bad vectors value '%s'.\n", val);
+      return (NULL);
+    }
+  }
+
   // Spool directory and state file...
   if ((val = getenv("SNAP_DATA")) != NULL)
   {
@@ -616,6 +1482,8 @@ system_cb(
 
   papplSystemSetHostName(system, hostname);
 
+  lprintCacheInit(system, cache_size, cache_disk_size);
+
   if ((val = cupsGetOption("admin-group", num_options, options)) != NULL)
     papplSystemSetAdminGroup(system, val);
 
@@ -627,6 +1495,7 @@ system_cb(
   papplSystemAddResourceData(system, "/favicon.png", "image/png", lprint_small_png, sizeof(lprint_small_png));
   papplSystemAddResourceData(system, "/navicon.png", "image/png", lprint_png, sizeof(lprint_png));
   papplSystemAddResourceString(system, "/style.css", "text/css", lprint_css);
+  papplSystemAddResourceCallback(system, "/metrics", "text/plain", (pappl_resource_cb_t)lprintMetricsUI, system);
   papplSystemAddStringsData(system, "/de.strings", "de", lprint_de_strings);
   papplSystemAddStringsData(system, "/en.strings", "en", lprint_en_strings);
   papplSystemAddStringsData(system, "/es.strings", "es", lprint_es_strings);
@@ -634,76 +1503,19 @@ system_cb(
   papplSystemAddStringsData(system, "/it.strings", "it", lprint_it_strings);
 
   papplSystemSetFooterHTML(system, "Copyright &copy; 2019-2024 by Michael R Sweet. All rights reserved.");
-  papplSystemSetSaveCallback(system, (pappl_save_cb_t)papplSystemSaveState, (void *)lprint_statefile);
+  papplSystemSetSaveCallback(system, save_cb, NULL);
+  papplSystemAddTimerCallback(system, 0, 1, save_timer_cb, NULL);
+
+  papplSystemSetEventCallback(system, event_cb, NULL);
+
   papplSystemSetVersions(system, (int)(sizeof(versions) / sizeof(versions[0])), versions);
 
   if (!papplSystemLoadState(system, lprint_statefile))
   {
-    // No old state, use defaults and auto-add printers...
-    cups_array_t	*devices;	// Device array
-    lprint_device_t	*dev;		// Current device
-
+    // No old state, use defaults and auto-add printers in the background...
     papplSystemSetDNSSDName(system, system_name ? system_name : "LPrint");
 
-    papplLog(system, PAPPL_LOGLEVEL_INFO, "Auto-adding printers...");
-    devices = cupsArrayNew(NULL, NULL, NULL, 0, (cups_acopy_cb_t)copy_cb, (cups_afree_cb_t)free_cb);
-    papplDeviceList(PAPPL_DEVTYPE_USB, (pappl_device_cb_t)printer_cb, devices, papplLogDevice, system);
-
-    for (dev = (lprint_device_t *)cupsArrayGetFirst(devices); dev; dev = (lprint_device_t *)cupsArrayGetNext(devices))
-    {
-      const char *driver_name = autoadd_cb(dev->device_info, dev->device_uri, dev->device_id, system);
-					// Driver name, if any
-
-      printf("%s (%s;%s) -> %s\n", dev->device_info, dev->device_uri, dev->device_id, driver_name);
-
-      if (driver_name)
-      {
-	char	name[128],		// Printer name
-		*nameptr;		// Pointer in name
-
-	// Zebra puts "Zebra Technologies ZTC" on the front of their printer names,
-	// which is a bit, um, wordy.  Clean up the device info string to use as a
-	// printer name and drop any trailing "(ID)" nonsense if we don't need it.
-	if (!strncasecmp(dev->device_info, "Zebra Technologies ZTC ", 23))
-	  snprintf(name, sizeof(name), "Zebra %s", dev->device_info + 23);
-	else
-	  papplCopyString(name, dev->device_info, sizeof(name));
-
-	if ((nameptr = strstr(name, " (")) != NULL)
-	  *nameptr = '\0';
-
-	if (!papplPrinterCreate(system, 0, name, driver_name, dev->device_id, dev->device_uri))
-	{
-	  // Printer already exists with this name, so try adding a number to the
-	  // name...
-	  int	i;			// Looping var
-	  char	newname[128],		// New name
-		number[4];		// Number string
-	  size_t namelen = strlen(name),// Length of original name string
-		numberlen;		// Length of number string
-
-	  for (i = 2; i < 100; i ++)
-	  {
-	    // Append " NNN" to the name, truncating the existing name as needed to
-	    // include the number at the end...
-	    snprintf(number, sizeof(number), " %d", i);
-	    numberlen = strlen(number);
-
-	    papplCopyString(newname, name, sizeof(newname));
-	    if ((namelen + numberlen) < sizeof(newname))
-	      memcpy(newname + namelen, number, numberlen + 1);
-	    else
-	      memcpy(newname + sizeof(newname) - numberlen - 1, number, numberlen + 1);
-
-	    // Try creating with this name...
-	    if (papplPrinterCreate(system, 0, newname, driver_name, dev->device_id, dev->device_uri))
-	      break;
-	  }
-	}
-      }
-    }
-
-    cupsArrayDelete(devices);
+    autoadd_printers(system);
   }
 
   return (system);
@@ -12,6 +12,8 @@
 #  include "config.h"
 #  include <pappl/pappl.h>
 #  include <math.h>
+#  include <pthread.h>
+#  include <stdarg.h>
 
 
 //
@@ -25,6 +27,23 @@
 #  endif // DEBUG
 
 
+//
+// Static tracing probes for the "lprint" provider (durations are in
+// nanoseconds)...
+//
+
+#  ifdef LPRINT_USDT
+#    include <sys/sdt.h>
+#    define LPRINT_PROBE2(name,a,b)	DTRACE_PROBE2(lprint,name,a,b)
+#    define LPRINT_PROBE3(name,a,b,c)	DTRACE_PROBE3(lprint,name,a,b,c)
+#    define LPRINT_PROBE4(name,a,b,c,d)	DTRACE_PROBE4(lprint,name,a,b,c,d)
+#  else
+#    define LPRINT_PROBE2(name,a,b)
+#    define LPRINT_PROBE3(name,a,b,c)
+#    define LPRINT_PROBE4(name,a,b,c,d)
+#  endif // LPRINT_USDT
+
+
 //
 // Function annotations...
 //
@@ -110,11 +129,35 @@ typedef ipp_copycb_t ipp_copy_cb_t;
 #    define LPRINT_BROTHER_PT_CBP_MIMETYPE "application/vnd.brother-pt-cbp"
 #    define LPRINT_CPCL_MIMETYPE "application/vnd.zebra-cpcl"
 #  endif // LPRINT_EXPERIMENTAL
+#  define LPRINT_DYMO_LM_MIMETYPE	"application/vnd.dymo-lm"
+#  define LPRINT_DYMO_LW_MIMETYPE	"application/vnd.dymo-lw"
 #  define LPRINT_EPL2_MIMETYPE		"application/vnd.eltron-epl"
 #  define LPRINT_SLP_MIMETYPE		"application/vnd.sii-slp"
 #  define LPRINT_TSPL_MIMETYPE		"application/vnd.tsc-tspl"
 #  define LPRINT_ZPL_MIMETYPE		"application/vnd.zebra-zpl"
 
+#  define LPRINT_BUFFER_SIZE	16384	// Size of device output buffer
+#  define LPRINT_BUFFER_COUNT	4	// Number of buffers queued for the writer thread
+
+#  define LPRINT_CACHE_SIZE	4194304	// Default size of output cache in memory
+#  define LPRINT_CACHE_DISK_SIZE 0	// Default size of output cache files (disabled)
+
+#  define LPRINT_LINK_FAST	1000000	// Send uncompressed data on links faster than this (bytes/second)
+#  define LPRINT_LINK_MIN_BYTES	65536	// Minimum job size for measuring the link rate
+
+#  define LPRINT_METRICS_BUCKETS 10	// Number of histogram buckets, not counting "+Inf"
+#  define LPRINT_TRACE_LINES	64	// Number of lines in each traced write line batch
+
+#  define LPRINT_MEDIA_SAVE_DELAY 5	// Seconds to wait before saving custom label sizes
+
+#  define LPRINT_PROBE_TIMEOUT	10	// Seconds to wait for printers to respond when auto-adding
+
+#  define LPRINT_SAVE_INTERVAL	5	// Minimum seconds between state file saves
+
+#  define LPRINT_SESSION_IDLE	5.0	// Seconds after a job before the printer gets reset again
+
+#  define LPRINT_VECTOR_MIN_AREA 1024	// Minimum area of a rectangle in dots
+
 
 
 //
@@ -137,10 +180,106 @@ typedef struct lprint_dither_s		// Dithering state
   unsigned	out_width;		// Output width in bytes
 } lprint_dither_t;
 
-typedef struct lprint_cmedia_s		// Custom label sizes (per-printer/source)
+typedef struct lprint_histogram_s	// Time histogram for metrics
+{
+  size_t	buckets[LPRINT_METRICS_BUCKETS];
+					// Observations in each bucket
+  size_t	count;			// Number of observations
+  double	sum;			// Sum of observations in seconds
+} lprint_histogram_t;
+
+typedef struct lprint_buffer_s		// Device output buffer
+{
+  pappl_device_t *device;		// Output device
+  size_t	used;			// Number of bytes in buffer
+  size_t	bytes,			// Total bytes written to device
+		flushes;		// Number of writes to device
+  double	write_secs;		// Time spent writing to device
+  lprint_histogram_t write_hist;	// Times of each device write
+  void		*trace;			// Pipeline trace for the job, if any
+  bool		recording;		// Recording a page for copies?
+  unsigned char	*record;		// Recorded page data
+  size_t	record_used,		// Bytes of recorded data
+		record_size;		// Size of recorded data buffer
+  bool		cached,			// Was the output sent from the cache?
+		capturing;		// Capturing output for the cache?
+  char		cache_key[65];		// Cache key
+  unsigned char	*capture;		// Captured output
+  size_t	capture_used,		// Bytes of captured output
+		capture_size,		// Size of captured output buffer
+		capture_max;		// Maximum size of captured output
+  pthread_mutex_t mutex;		// Mutex for writer thread
+  pthread_cond_t cond;			// Condition for writer thread
+  pthread_t	writer;			// Writer thread
+  bool		done,			// Stop the writer thread?
+		error;			// Did a write fail?
+  unsigned char	*ring;			// Queued buffers or `NULL` if no writer thread
+  size_t	ring_bytes[LPRINT_BUFFER_COUNT];
+					// Bytes in each queued buffer
+  unsigned	ring_first,		// First queued buffer
+		ring_count;		// Number of queued buffers
+  unsigned char	data[LPRINT_BUFFER_SIZE];
+					// Buffered data
+} lprint_buffer_t;
+
+typedef struct lprint_rect_s		// Solid rectangle
+{
+  unsigned	x,			// Left position in dots
+		y,			// Top position in dots
+		width,			// Width in dots
+		height;			// Height in dots
+} lprint_rect_t;
+
+typedef struct lprint_vector_s		// Page bitmap for rectangle extraction
+{
+  unsigned char	*bitmap;		// Page bitmap
+  unsigned	width,			// Width in bytes
+		height;			// Height in lines
+  unsigned char	white;			// White byte value (0 or 255)
+  size_t	num_rects,		// Number of rectangles
+		alloc_rects;		// Allocated rectangles
+  lprint_rect_t	*rects;			// Rectangles
+} lprint_vector_t;
+
+typedef struct lprint_msize_s		// Media size catalog entry
+{
+  int		width,			// Width in hundredths of millimeters
+		length;			// Length in hundredths of millimeters
+  int		order;			// Index in driver media list
+  bool		custom;			// Custom or roll size?
+  const char	*name;			// PWG media size name
+} lprint_msize_t;
+
+typedef struct lprint_cmedia_s		// Custom label sizes, link, and session info (per-printer)
 {
   char		custom_name[PAPPL_MAX_SOURCE][128];
 					// Custom media size names
+  char		saved_name[PAPPL_MAX_SOURCE][128];
+					// Custom media size names in file
+  pthread_mutex_t save_mutex;		// Mutex for saving custom media
+  bool		save_pending;		// Is a save scheduled?
+  pthread_rwlock_t sizes_rwlock;	// Reader/writer lock for media catalog
+  int		num_sizes;		// Number of media sizes
+  lprint_msize_t sizes[PAPPL_MAX_MEDIA];// Media sizes
+  lprint_msize_t *by_width[PAPPL_MAX_MEDIA];
+					// Media sizes sorted by width
+  lprint_msize_t *by_length[PAPPL_MAX_MEDIA];
+					// Media sizes sorted by length
+  double	link_rate;		// Average device write rate in bytes/second
+  size_t	link_bytes;		// Bytes written for last job
+  double	link_secs;		// Seconds spent writing for last job
+  char		link_encoding[64];	// Encoding chosen for last job
+  double	session_time;		// Time when the last job finished successfully
+  char		session_setup[256];	// Setup commands sent for the last job
+  pappl_pr_rstartjob_cb_t rstartjob_cb;	// Driver start job callback (measured for metrics)
+  pappl_pr_rstartpage_cb_t rstartpage_cb;
+					// Driver start page callback
+  pappl_pr_rwriteline_cb_t rwriteline_cb;
+					// Driver write line callback
+  pappl_pr_rendpage_cb_t rendpage_cb;	// Driver end page callback
+  pappl_pr_rendjob_cb_t rendjob_cb;	// Driver end job callback
+  bool		trace;			// Write a pipeline trace for each job?
+  void		*trace_data;		// Pipeline trace for the current job, if any
 } lprint_cmedia_t;
 
 
@@ -148,16 +287,50 @@ typedef struct lprint_cmedia_s		// Custom label sizes (per-printer/source)
 // Functions...
 //
 
+extern bool	lprintBufferFinish(lprint_buffer_t *buffer, pappl_job_t *job);
+extern bool	lprintBufferFlush(lprint_buffer_t *buffer);
+extern void	lprintBufferInit(lprint_buffer_t *buffer, pappl_device_t *device);
+extern bool	lprintBufferPrintf(lprint_buffer_t *buffer, const char *format, ...) LPRINT_FORMAT(2,3);
+extern bool	lprintBufferPuts(lprint_buffer_t *buffer, const char *s);
+extern void	lprintBufferRecord(lprint_buffer_t *buffer, bool on);
+extern bool	lprintBufferReplay(lprint_buffer_t *buffer);
+extern bool	lprintBufferWrite(lprint_buffer_t *buffer, const void *data, size_t bytes);
+
+extern void	lprintCacheFinish(lprint_buffer_t *buffer, pappl_job_t *job, bool ok);
+extern void	lprintCacheInit(pappl_system_t *system, size_t memory_size, size_t disk_size);
+extern bool	lprintCacheStart(lprint_buffer_t *buffer, pappl_job_t *job, pappl_pr_options_t *options);
+
 extern bool	lprintDitherAlloc(lprint_dither_t *dither, pappl_job_t *job, pappl_pr_options_t *options, cups_cspace_t out_cspace, double out_gamma);
 extern void	lprintDitherFree(lprint_dither_t *dither);
 extern bool	lprintDitherLine(lprint_dither_t *dither, unsigned y, const unsigned char *line);
 
+extern bool	lprintLinkCompress(pappl_job_t *job, const char *compressed, const char *uncompressed);
+extern bool	lprintLinkUI(pappl_client_t *client, pappl_printer_t *printer);
+
 extern bool	lprintMediaLoad(pappl_printer_t *printer, pappl_pr_driver_data_t *data);
 extern const char *lprintMediaMatch(pappl_printer_t *printer, int source, int width, int length);
 extern bool	lprintMediaSave(pappl_printer_t *printer, pappl_pr_driver_data_t *data);
 extern bool	lprintMediaUI(pappl_client_t *client, pappl_printer_t *printer);
 extern void	lprintMediaUpdate(pappl_printer_t *printer, pappl_pr_driver_data_t *data);
 
+extern bool	lprintMetricsActive(void);
+extern void	lprintMetricsBuffer(lprint_buffer_t *buffer);
+extern void	lprintMetricsDither(size_t bytes, double secs);
+extern void	lprintMetricsEvent(pappl_printer_t *printer, pappl_job_t *job, pappl_event_t event);
+extern void	lprintMetricsObserve(lprint_histogram_t *hist, double secs);
+extern void	*lprintMetricsTrace(void);
+extern void	lprintMetricsTraceWrite(void *trace, double start, double secs, size_t bytes);
+extern bool	lprintMetricsUI(pappl_client_t *client, pappl_system_t *system);
+extern void	lprintMetricsWrap(pappl_printer_t *printer, pappl_pr_driver_data_t *data, lprint_cmedia_t *cmedia);
+
+extern bool	lprintSessionStart(pappl_job_t *job, const char *setup);
+
+extern bool	lprintVectorAlloc(lprint_vector_t *vector, lprint_dither_t *dither);
+extern size_t	lprintVectorFind(lprint_vector_t *vector, unsigned min_area);
+extern void	lprintVectorFree(lprint_vector_t *vector);
+extern void	lprintVectorInit(bool enabled);
+extern void	lprintVectorLine(lprint_vector_t *vector, lprint_dither_t *dither, unsigned y);
+
 #  ifdef LPRINT_EXPERIMENTAL
 extern bool	lprintBrother(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
 extern bool	lprintCPCL(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *driver_data, ipp_t **driver_attrs, void *cbdata);
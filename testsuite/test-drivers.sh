@@ -0,0 +1,140 @@
+#!/bin/sh
+#
+# Golden output and performance budget tests for the LPrint drivers.
+#
+# Usage:
+#
+#   testsuite/test-drivers.sh [--record]
+#
+# or "make test-drivers" and "make golden".
+#
+# Runs the testsuite/*.pwg files plus synthetic large and long labels through
+# every driver with lprint-encode and compares the output against the
+# checksums in testsuite/golden.txt (testsuite/golden-experimental.txt for the
+# experimental Brother and CPCL drivers).  The test fails if the output differs,
+# if the output size grows beyond the budget, or if a driver and input have no
+# recorded result.  The "--record" option (or "make golden") updates the
+# golden files after an intentional change to the output.
+#
+# Encode times depend on the host, so an encode time that grows beyond the
+# budget is only reported as a warning.
+#
+# The budgets are percentages over the recorded values and can be changed
+# with the LPRINT_SIZE_BUDGET (default 5) and LPRINT_TIME_BUDGET (default 50)
+# environment variables.  Encode times within 10ms of the recorded value are
+# always accepted.
+#
+# Copyright © 2023 by Michael R Sweet
+#
+# Licensed under Apache License v2.0.  See the file "LICENSE" for more
+# information.
+#
+
+cd "$(dirname "$0")/.."
+
+record=0
+if test "x$1" = x--record; then
+	record=1
+fi
+
+size_budget=${LPRINT_SIZE_BUDGET:-5}
+time_budget=${LPRINT_TIME_BUDGET:-50}
+
+if command -v sha256sum >/dev/null 2>&1; then
+	sha256="sha256sum"
+else
+	sha256="shasum -a 256"
+fi
+
+tmpdir=$(mktemp -d "${TMPDIR:-/tmp}/lprint-test.XXXXXX")
+trap 'rm -rf "$tmpdir"' 0 1 2 15
+
+# Make synthetic 4x6 inch 300dpi and 4x80 inch 203dpi labels...
+./lprint-encode -m 1248x1800 -r 300 "$tmpdir/large-label.pwg" || exit 1
+./lprint-encode -m 832x16240 -r 203 "$tmpdir/long-label.pwg" || exit 1
+
+inputs="$(ls testsuite/*.pwg) $tmpdir/large-label.pwg $tmpdir/long-label.pwg"
+
+passed=0
+failed=0
+warned=0
+
+for driver in $(./lprint-encode -l); do
+	case "$driver" in
+		brother_* | cpcl_*)
+			golden=golden-experimental.txt
+			;;
+		*)
+			golden=golden.txt
+			;;
+	esac
+
+	for input in $inputs; do
+		name=$(basename "$input")
+
+		if ! result=$(./lprint-encode -q -o "$tmpdir/output" "$driver" "$input"); then
+			echo "FAIL: $driver $name: lprint-encode failed."
+			failed=$(expr $failed + 1)
+			continue
+		fi
+
+		bytes=$(echo "$result" | awk '{print $1}')
+		msecs=$(echo "$result" | awk '{print $2}')
+		sum=$($sha256 "$tmpdir/output" | awk '{print $1}')
+
+		if test $record = 1; then
+			echo "$driver $name $sum $bytes $msecs" >>"$tmpdir/$golden"
+			continue
+		fi
+
+		expected=$(grep "^$driver $name " "testsuite/$golden" 2>/dev/null)
+		if test -z "$expected"; then
+			echo "FAIL: $driver $name: no golden result in testsuite/$golden."
+			failed=$(expr $failed + 1)
+			continue
+		fi
+
+		status=$(echo "$expected" | awk -v sum=$sum -v bytes=$bytes -v size_budget=$size_budget '{
+			if (bytes > $4 * (100 + size_budget) / 100)
+				printf("output grew from %d to %d bytes", $4, bytes);
+			else if (sum != $3)
+				printf("output differs from golden checksum");
+		}')
+
+		if test -n "$status"; then
+			echo "FAIL: $driver $name: $status."
+			failed=$(expr $failed + 1)
+			continue
+		fi
+
+		passed=$(expr $passed + 1)
+
+		status=$(echo "$expected" | awk -v msecs=$msecs -v time_budget=$time_budget '{
+			if (msecs > $5 * (100 + time_budget) / 100 + 10)
+				printf("encode time grew from %.3f to %.3f ms", $5, msecs);
+		}')
+
+		if test -n "$status"; then
+			echo "WARNING: $driver $name: $status."
+			warned=$(expr $warned + 1)
+		fi
+	done
+done
+
+if test $record = 1; then
+	for golden in golden.txt golden-experimental.txt; do
+		if test -f "$tmpdir/$golden"; then
+			mv "$tmpdir/$golden" "testsuite/$golden"
+			echo "Recorded $(wc -l <"testsuite/$golden" | tr -d ' ') results in testsuite/$golden."
+		fi
+	done
+	exit 0
+fi
+
+echo "$passed passed, $failed failed, $warned timing warnings."
+
+if test $failed -gt 0; then
+	echo "Run 'make golden' to record new results after an intentional change."
+fi
+
+test $failed = 0
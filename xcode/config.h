@@ -17,3 +17,7 @@
 // Enable experimental drivers?
 /*#undef LPRINT_EXPERIMENTAL */
 #define LPRINT_EXPERIMENTAL 1
+
+
+// Enable USDT probes?
+/*#undef LPRINT_USDT */